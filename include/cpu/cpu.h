@@ -19,6 +19,18 @@
 #include <common.h>
 
 void cpu_exec(uint64_t n);
+int cpu_hart_id();
+
+// virtual time, in guest instructions executed
+uint64_t cpu_inst_count();
+void cpu_set_deadline(uint64_t inst);
+// guest instructions executed by all the harts, in either scheduling of them;
+// with SMP_PARALLEL, only exact while cpu_exec() does not run
+uint64_t cpu_total_inst();
+// called by the translated code at an instruction jumping to itself
+void cpu_spin();
+// called by the timer at each read of the host time `us'
+void cpu_poll(uint64_t us);
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
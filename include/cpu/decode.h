@@ -96,6 +96,48 @@ finish:
   } \
 } while (0)
 
+/* Dispatch on `idx' to an entry of an instruction list, see INSTPAT_LIST in
+ * the ISAs. The entries are numbered in the order of the list, and one
+ * which does not match falls through to the next one, so `idx' only needs
+ * to be an entry no later than the first one matching.
+ */
+#define INSTPAT_SWITCH(idx, list) { \
+  enum { __instpat_base = __COUNTER__ + 1 }; \
+  switch (idx) { list(INSTPAT_CASE) } \
+}
+#define INSTPAT_CASE(pattern, ...) case __COUNTER__ - __instpat_base: INSTPAT(pattern, ##__VA_ARGS__);
+#define INSTPAT_PATTERN(pattern, ...) pattern,
+
+// the bits of `x' selected by `sel', packed towards bit 0
+static inline uint32_t instpat_pack(uint32_t x, uint32_t sel) {
+  uint32_t r = 0;
+  for (int k = 0; sel != 0; sel &= sel - 1) {
+    if (x & sel & -sel) r |= 1u << k;
+    k ++;
+  }
+  return r;
+}
+
+/* Fill `table', indexed by the bits of a 32-bit instruction selected by
+ * `sel' (see instpat_pack()), with the index of the first of the `n'
+ * patterns which may match an instruction with them.
+ */
+static inline void instpat_build_table(uint8_t *table, uint32_t sel, const char **patterns, int n) {
+  Assert(n <= 256, "too many patterns for the table");
+  for (int k = n - 1; k >= 0; k --) {
+    uint64_t key, mask, shift;
+    pattern_decode(patterns[k], strlen(patterns[k]), &key, &mask, &shift);
+    uint32_t fixed_key = (uint32_t)(key << shift) & sel;
+    uint32_t free = ~(uint32_t)(mask << shift) & sel;
+    // every value of the selected bits not fixed by the pattern
+    uint32_t x = 0;
+    do {
+      table[instpat_pack(fixed_key | x, sel)] = k;
+      x = (x - free) & free;
+    } while (x != 0);
+  }
+}
+
 #define INSTPAT_START(name) { const void ** __instpat_end = &&concat(__instpat_end_, name);
 #define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
 
@@ -0,0 +1,32 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_BLKIMG_H__
+#define __DEVICE_BLKIMG_H__
+
+#include <common.h>
+
+#define SECTOR_SIZE 512
+
+// a disk image accessed in sectors, optionally with a copy-on-write overlay
+typedef struct BlkImg BlkImg;
+
+BlkImg* blkimg_open(const char *path, bool overlay, bool direct);
+uint64_t blkimg_nr_sector(BlkImg *img);
+void blkimg_read(BlkImg *img, void *buf, uint64_t sector, uint32_t nr_sector);
+void blkimg_write(BlkImg *img, const void *buf, uint64_t sector, uint32_t nr_sector);
+void blkimg_prefetch(BlkImg *img, uint64_t sector, uint32_t nr_sector);
+
+#endif
@@ -52,5 +52,17 @@ void add_mmio_map(const char *name, paddr_t addr,
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
+#ifdef CONFIG_SMP_PARALLEL
+void device_lock();
+void device_unlock();
+#endif
+
+// interrupts of the devices, see src/device/intr.c
+enum { DEV_INTR_TIMER, DEV_INTR_DISK };
+void dev_raise_intr(int dev);
+void dev_clear_intr(int dev);
+#ifdef CONFIG_SMP_PARALLEL
+void dev_intr_sync();
+#endif
 
 #endif
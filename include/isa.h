@@ -29,7 +29,7 @@ extern char isa_logo[];
 void init_isa();
 
 // reg
-extern CPU_state cpu;
+extern HART_LOCAL CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
 
@@ -46,10 +46,31 @@ int isa_mmu_check(vaddr_t vaddr, int len, int type);
 #endif
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type);
 
+// harts, called before the running hart is parked
+#ifndef isa_hart_switch
+#define isa_hart_switch()
+#endif
+
 // interrupt/exception
 vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
+#ifndef isa_query_intr
 word_t isa_query_intr();
+#endif
+void isa_dev_intr(bool level); // the level of the interrupt line of the devices changes
+
+// timer, called when cpu_inst_count() reaches the deadline set by
+// cpu_set_deadline(), and after another hart is switched in
+void isa_timer_update();
+
+// bench
+typedef struct {
+  const char *name;
+  const uint32_t *img;
+  size_t size;
+} BenchKernel;
+extern const BenchKernel isa_bench_kernel[];
+extern const int isa_nr_bench_kernel;
 
 // difftest
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
@@ -38,4 +38,15 @@ static inline void host_write(void *addr, int len, word_t data) {
   }
 }
 
+// write `data' if `addr' holds `old', atomically with the other host threads
+static inline bool host_cas(void *addr, int len, word_t old, word_t data) {
+  switch (len) {
+    case 4: { uint32_t o = old; return __atomic_compare_exchange_n((uint32_t *)addr, &o, (uint32_t)data,
+                  false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+    IFDEF(CONFIG_ISA64, case 8: { uint64_t o = old; return __atomic_compare_exchange_n((uint64_t *)addr, &o,
+                  (uint64_t)data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); });
+    default: MUXDEF(CONFIG_RT_CHECK, assert(0), return false);
+  }
+}
+
 #endif
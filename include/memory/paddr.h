@@ -31,7 +31,16 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+/* back [addr, addr + len) with a private mapping of the file, return false if
+ * physical memory can not be mapped or the range is not page aligned */
+bool pmem_map_file(paddr_t addr, size_t len, int fd, size_t offset);
+
+/* tell that [addr, addr + len) of pmem is written by NEMU itself, such as
+ * an image being loaded or the DMA of a device, instead of paddr_write() */
+void pmem_host_written(paddr_t addr, size_t len);
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
+bool paddr_cas(paddr_t addr, int len, word_t old, word_t data);
 
 #endif
@@ -21,6 +21,13 @@
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
+// for LL/SC and AMOs, the access must be aligned
+bool vaddr_cas(vaddr_t addr, int len, word_t old, word_t data);
+
+// the accesses before a fence are seen by the other harts before the ones after it
+static inline void vaddr_fence() {
+  IFDEF(CONFIG_SMP_PARALLEL, __atomic_thread_fence(__ATOMIC_SEQ_CST));
+}
 
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
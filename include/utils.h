@@ -34,6 +34,20 @@ extern NEMUState nemu_state;
 
 uint64_t get_time();
 
+// ----------- symbol -----------
+
+const char* elf_sym_name(vaddr_t addr, vaddr_t *offset);
+bool elf_sym_addr(const char *name, vaddr_t *addr);
+
+// ----------- trace -----------
+
+extern bool g_log_enable;
+void trace_update(uint64_t nr_inst);
+uint64_t trace_window(uint64_t nr_inst, uint64_t n, bool *on);
+bool trace_inst_enable(vaddr_t pc, uint32_t inst);
+bool trace_set(const char *kind, char *args);
+void trace_display();
+
 // ----------- log -----------
 
 #define ANSI_FG_BLACK   "\33[1;30m"
@@ -59,8 +73,7 @@ uint64_t get_time();
 #define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
   do { \
     extern FILE* log_fp; \
-    extern bool log_enable(); \
-    if (log_enable()) { \
+    if (g_log_enable) { \
       fprintf(log_fp, __VA_ARGS__); \
       fflush(log_fp); \
     } \
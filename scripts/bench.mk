@@ -0,0 +1,91 @@
+#***************************************************************************************
+# Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+# Run the built-in kernels of the guest ISA (see src/isa/$(GUEST_ISA)/bench.c)
+# and compare the simulation speed with a baseline. For stable numbers, build
+# NEMU without tracing and with devices that do not open a window. The
+# baseline is kept out of $(BUILD_DIR), so that it survives `make clean'.
+
+# mips32 has no kernels, and the mmio kernel polls the RTC of the timer
+BENCH_KERNELS   ?= $(if $(CONFIG_ISA_mips32),,alu mem branch $(if $(CONFIG_HAS_TIMER),mmio) mix)
+BENCH_RESULT    ?= $(BUILD_DIR)/bench.txt
+BENCH_BASELINE  ?= $(NEMU_HOME)/bench/$(NAME).txt
+# Maximal slowdown (or growth of peak RSS) in percent before a kernel is reported
+BENCH_TOLERANCE ?= 10
+
+# Each line of the result is "kernel host_time_us instructions inst/s peak_rss_kb",
+# or "kernel FAIL" if the kernel does not hit the good trap.
+define bench_parse
+sed 's/\x1b\[[0-9;]*m//g' $(1) | awk -v k=$(2) ' \
+  /HIT GOOD TRAP/ { good = 1 } \
+  /host time spent/ { t = $$(NF-1) } \
+  /total guest instructions/ { n = $$NF } \
+  /peak RSS/ { r = $$(NF-1) } \
+  END { if (!good) print k, "FAIL"; \
+        else printf "%s %.0f %.0f %.0f %.0f\n", k, t, n, (t > 0 ? n * 1000000 / t : 0), r }'
+endef
+
+define bench_compare
+awk -v tol=$(BENCH_TOLERANCE) ' \
+  FILENAME == ARGV[1] { ips[$$1] = $$4; rss[$$1] = $$5; next } \
+  { fail = ($$2 == "FAIL"); slow = 0; fat = 0; change = "-"; \
+    if (!fail && ($$1 in ips) && ips[$$1] > 0) { \
+      d = ($$4 - ips[$$1]) * 100 / ips[$$1]; change = sprintf("%+.1f%%", d); \
+      slow = (d < -tol); fat = (rss[$$1] > 0 && ($$5 - rss[$$1]) * 100 / rss[$$1] > tol); } \
+    verdict = fail ? "FAIL" : slow ? "SLOWER" : fat ? "MORE RSS" : "ok"; bad += (verdict != "ok"); \
+    if (fail) printf "%-8s %12s %10s %10s %9s  %s\n", $$1, "-", "-", "-", "-", verdict; \
+    else printf "%-8s %12.0f %10.2f %10.0f %9s  %s\n", $$1, $$2, $$4 / 1000000, $$5, change, verdict; } \
+  END { exit(bad != 0) }'
+endef
+
+bench: $(BINARY)
+	@test -n "$(strip $(BENCH_KERNELS))" || { echo "No built-in kernels for $(GUEST_ISA)"; exit 1; }
+	@rm -f $(BENCH_RESULT)
+	@for k in $(BENCH_KERNELS); do \
+	  LC_ALL=C $(BINARY) -b --log=/dev/null --kernel=$$k > $(BUILD_DIR)/bench-$$k.log 2>&1; \
+	  $(call bench_parse,$(BUILD_DIR)/bench-$$k.log,$$k) >> $(BENCH_RESULT); \
+	done
+	@printf "%-8s %12s %10s %10s %9s\n" kernel "time (us)" MIPS "RSS (KB)" change
+	@if [ -f $(BENCH_BASELINE) ]; then \
+	  $(call bench_compare) $(BENCH_BASELINE) $(BENCH_RESULT); \
+	else \
+	  $(call bench_compare) /dev/null $(BENCH_RESULT); ret=$$?; \
+	  echo "No baseline, run 'make bench-update' to save this result to $(BENCH_BASELINE)"; \
+	  exit $$ret; \
+	fi
+
+bench-update:
+	@test -f $(BENCH_RESULT) || $(MAKE) -s bench
+	@mkdir -p $(dir $(BENCH_BASELINE))
+	cp $(BENCH_RESULT) $(BENCH_BASELINE)
+
+.PHONY: bench bench-update
+
+# Host-side micro-benchmarks of the hot paths, linked with the objects of NEMU
+# (see src/microbench.c). Arguments select benchmarks by name, e.g.
+#   make microbench MBARGS="paddr_read mmio"
+MICROBENCH      = $(BUILD_DIR)/$(NAME)-microbench
+MICROBENCH_OBJS = $(filter-out $(OBJ_DIR)/src/nemu-main.o,$(OBJS)) $(OBJ_DIR)/src/microbench.o
+
+-include $(OBJ_DIR)/src/microbench.d
+
+$(MICROBENCH): $(MICROBENCH_OBJS) $(ARCHIVES)
+	@echo + LD $@
+	@$(LD) -o $@ $(MICROBENCH_OBJS) $(LDFLAGS) $(ARCHIVES) $(LIBS)
+
+microbench: $(MICROBENCH)
+	@$(MICROBENCH) $(MBARGS)
+
+.PHONY: microbench
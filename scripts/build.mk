@@ -11,8 +11,9 @@ WORK_DIR  = $(shell pwd)
 BUILD_DIR = $(WORK_DIR)/build
 
 INC_PATH := $(WORK_DIR)/include $(INC_PATH)
-OBJ_DIR  = $(BUILD_DIR)/obj-$(NAME)$(SO)
-BINARY   = $(BUILD_DIR)/$(NAME)$(SO)
+PGO_SUFFIX = $(if $(filter gen,$(PGO_STAGE)),-pgo-gen,)
+OBJ_DIR  = $(BUILD_DIR)/obj-$(NAME)$(SO)$(PGO_SUFFIX)
+BINARY   = $(BUILD_DIR)/$(NAME)$(SO)$(PGO_SUFFIX)
 
 # Compilation flags
 ifeq ($(CC),clang)
@@ -27,6 +28,88 @@ LDFLAGS := -O2 $(LDFLAGS)
 
 OBJS = $(SRCS:%.c=$(OBJ_DIR)/%.o) $(CXXSRC:%.cc=$(OBJ_DIR)/%.o)
 
+# Profile-guided optimization. The instrumented NEMU is built by a recursive
+# make with PGO_STAGE=gen into separate object and binary paths, and runs the
+# training set. gcc accumulates the counters of all runs in .gcda files beside
+# the instrumented objects, which are copied to where the final objects look
+# for them. clang writes raw profiles which are merged with llvm-profdata.
+ifdef CONFIG_CC_PGO
+PGO_DIR       = $(BUILD_DIR)/pgo-$(NAME)
+PGO_GEN_DIR   = $(BUILD_DIR)/obj-$(NAME)-pgo-gen
+PGO_BINARY    = $(BUILD_DIR)/$(NAME)-pgo-gen
+PGO_TRAIN     = $(call remove_quote,$(CONFIG_CC_PGO_TRAIN))
+PGO_KERNELS  ?= $(BENCH_KERNELS)
+LLVM_PROFDATA ?= llvm-profdata
+
+ifeq ($(CC),clang)
+PGO_PROFILE = $(PGO_DIR)/default.profdata
+PGO_GEN_FLAGS = -fprofile-generate=$(PGO_DIR)
+PGO_USE_FLAGS = -fprofile-use=$(PGO_PROFILE) -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date
+else
+PGO_PROFILE = $(PGO_DIR)/gcda.stamp
+# the entry counts of functions with computed gotos and of the ones updated by
+# several threads are inconsistent; -fprofile-correction smooths them instead
+# of reporting "missing counts" which has no -Wno-* option
+PGO_GEN_FLAGS = -fprofile-generate -fprofile-update=prefer-atomic
+PGO_USE_FLAGS = -fprofile-use -fprofile-partial-training -fprofile-correction -Wno-missing-profile
+endif
+
+ifeq ($(PGO_STAGE),gen)
+CFLAGS  += $(PGO_GEN_FLAGS)
+LDFLAGS += $(PGO_GEN_FLAGS)
+else
+CFLAGS  += $(PGO_USE_FLAGS)
+LDFLAGS += $(PGO_USE_FLAGS)
+$(OBJS): $(PGO_PROFILE)
+endif
+
+$(PGO_PROFILE): $(SRCS) $(CXXSRC) $(NEMU_HOME)/include/generated/autoconf.h
+	@$(MAKE) -s PGO_STAGE=gen app
+	@echo + PGO train $(if $(PGO_TRAIN),$(PGO_TRAIN),$(PGO_KERNELS))
+	@rm -rf $(PGO_DIR) && mkdir -p $(PGO_DIR)
+	@find $(PGO_GEN_DIR) -name "*.gcda" -delete
+ifneq ($(PGO_TRAIN),)
+	@$(PGO_BINARY) --log=/dev/null --batch-list=$(PGO_TRAIN) > /dev/null || true
+else
+	@for k in $(PGO_KERNELS); do $(PGO_BINARY) -b --log=/dev/null --kernel=$$k > /dev/null 2>&1; done; true
+endif
+ifeq ($(CC),clang)
+	@$(LLVM_PROFDATA) merge -o $@ $(PGO_DIR)/*.profraw
+else
+	@cd $(PGO_GEN_DIR) && find . -name "*.gcda" | while read f; do \
+	  mkdir -p $(OBJ_DIR)/`dirname $$f` && cp $$f $(OBJ_DIR)/$$f; done
+	@touch $@
+endif
+endif
+
+# Copy-and-patch stencils. The instruction list of the guest ISA is compiled
+# once more into stencils, whose code and relocations are turned into C
+# tables by gen-stencil and linked into NEMU. Instrumentation is left out,
+# since its references can not be patched.
+ifdef CONFIG_JIT_STENCIL
+GEN_STENCIL   = $(NEMU_HOME)/tools/gen-stencil/build/gen-stencil
+STENCIL_DIR   = $(OBJ_DIR)/stencil
+STENCIL_FLAGS = -D__STENCIL__ -mcmodel=large -fno-pic -ffunction-sections -fno-jump-tables \
+                -fno-asynchronous-unwind-tables -fno-stack-protector -fcf-protection=none -fno-ipa-icf
+OBJS += $(STENCIL_DIR)/stencils.o
+
+$(GEN_STENCIL):
+	@$(MAKE) -s -C $(NEMU_HOME)/tools/gen-stencil
+
+$(STENCIL_DIR)/stencil.o: src/isa/$(GUEST_ISA)/inst.c
+	@echo + CC stencils of $<
+	@mkdir -p $(dir $@)
+	@$(CC) $(filter-out -flto -fsanitize=% -fprofile%,$(CFLAGS)) $(STENCIL_FLAGS) -c -o $@ $<
+
+$(STENCIL_DIR)/stencils.c: $(STENCIL_DIR)/stencil.o $(GEN_STENCIL)
+	@$(GEN_STENCIL) $< > $@
+
+$(STENCIL_DIR)/stencils.o: $(STENCIL_DIR)/stencils.c
+	@$(CC) $(CFLAGS) -c -o $@ $<
+
+-include $(STENCIL_DIR)/stencil.d
+endif
+
 # Compilation patterns
 $(OBJ_DIR)/%.o: %.c
 	@echo + CC $<
@@ -17,6 +17,10 @@
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
 #include <locale.h>
+#ifndef CONFIG_TARGET_AM
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -25,19 +29,126 @@
  */
 #define MAX_INST_TO_PRINT 10
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_inst = 0;
+HART_LOCAL CPU_state cpu = {};
+HART_LOCAL uint64_t g_nr_guest_inst = 0;
+static HART_LOCAL uint64_t g_deadline = UINT64_MAX; // of the timer of the ISA, in g_nr_guest_inst
+static HART_LOCAL uint64_t g_nr_skipped = 0;
+static HART_LOCAL bool g_spin = false; // the last instruction jumped to itself, or polled the timer
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+#if defined(CONFIG_HAS_SERIAL) && !defined(CONFIG_TARGET_AM)
+void serial_flush();
+#endif
+#ifdef CONFIG_ENGINE_JIT
+uint64_t jit_exec(uint64_t n);
+bool jit_runnable();
+uint64_t jit_inflight();
+void jit_leave();
+void jit_yield();
+void jit_statistic();
+#endif
 
-static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
-#ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
+#if CONFIG_NR_HART > 1
+/* With SMP_ROUND_ROBIN, only the running hart lives in `cpu'. The others
+ * are parked here and swapped in when the quantum of the running one is
+ * used up. With SMP_PARALLEL, `cpu' is local to the thread of each hart,
+ * and a hart is parked here while cpu_exec() does not run.
+ */
+static CPU_state hart[CONFIG_NR_HART] = {};
+static uint64_t hart_nr_inst[CONFIG_NR_HART] = {};
+static HART_LOCAL int cur_hart = 0;
+static HART_LOCAL int quantum_left = CONFIG_SMP_QUANTUM;
+
+static void end_quantum() {
+  quantum_left = CONFIG_SMP_QUANTUM;
+#ifdef CONFIG_SMP_ROUND_ROBIN
+  isa_hart_switch();
+  hart[cur_hart] = cpu;
+  cur_hart = (cur_hart + 1) % CONFIG_NR_HART;
+  cpu = hart[cur_hart];
+  g_spin = false;
+#endif
+  // in parallel, this is where a hart sees the writes of the others to its timer and IPI
+  isa_timer_update();
+}
+#endif
+
+int cpu_hart_id() {
+#if CONFIG_NR_HART > 1
+  return cur_hart;
+#else
+  return 0;
+#endif
+}
+
+// exact, also in the middle of translated code
+uint64_t cpu_inst_count() {
+  return g_nr_guest_inst + MUXDEF(CONFIG_ENGINE_JIT, jit_inflight(), 0);
+}
+
+void cpu_set_deadline(uint64_t inst) {
+  g_deadline = inst;
+  // the running slice of translated code may end after the new deadline
+  IFDEF(CONFIG_ENGINE_JIT, jit_leave());
+}
+
+void cpu_spin() {
+  g_spin = true;
+  IFDEF(CONFIG_ENGINE_JIT, jit_leave());
+}
+
+/* A loop polling the timer reads the host time at the same pc every few
+ * instructions, and an iteration which read the same time as the one before
+ * it leaves the registers as they were. After POLL_REPEAT such iterations in
+ * a row, the host sleeps at each read instead of spinning, and the
+ * repetitions up to the deadline of the timer are skipped as for `idle'.
+ * This goes on until the timer is read elsewhere, or an iteration changes
+ * the registers although the time has not changed, as a loop counting its
+ * reads does. The next POLL_BACKOFF reads are not examined then, to keep
+ * such a loop fast. Neither changes what the guest executes.
+ */
+#define POLL_MAX_INST 32
+#define POLL_REPEAT 16
+#define POLL_BACKOFF 1024
+
+void cpu_poll(uint64_t us) {
+  static HART_LOCAL vaddr_t last_pc = 0;
+  static HART_LOCAL uint64_t last_inst = 0, last_us = 0;
+  static HART_LOCAL word_t last_gpr[ARRLEN(cpu.gpr)] = {};
+  static HART_LOCAL bool compare = false; // last_gpr is from a read of the same time as the one before it
+  static HART_LOCAL int repeat = 0, backoff = 0;
+  if (backoff > 0) { backoff --; return; }
+  uint64_t now = cpu_inst_count();
+  if (cpu.pc != last_pc || now - last_inst > POLL_MAX_INST) repeat = 0;
+  else if (compare) {
+    if (memcmp(last_gpr, cpu.gpr, sizeof(last_gpr)) == 0) { if (repeat < POLL_REPEAT) repeat ++; }
+    else { repeat = 0; backoff = POLL_BACKOFF; }
+  }
+  last_pc = cpu.pc;
+  last_inst = now;
+  compare = (us == last_us);
+  last_us = us;
+  if (compare) memcpy(last_gpr, cpu.gpr, sizeof(last_gpr));
+  if (repeat < POLL_REPEAT) return;
+#if !defined(CONFIG_TARGET_AM) && CONFIG_RTC_POLL_SLEEP > 0
+  usleep(CONFIG_RTC_POLL_SLEEP);
+#endif
+  g_spin = true;
+  IFDEF(CONFIG_ENGINE_JIT, jit_yield());
+}
+
+void init_cpu() {
+#if CONFIG_NR_HART > 1
+  // every hart starts from the state set up by the ISA and the loader
+  for (int i = 0; i < CONFIG_NR_HART; i ++) hart[i] = cpu;
+#ifdef CONFIG_SMP_PARALLEL
+  Log("%d harts, running in parallel", CONFIG_NR_HART);
+#else
+  Log("%d harts, switching every %d instructions", CONFIG_NR_HART, CONFIG_SMP_QUANTUM);
+#endif
 #endif
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
 }
 
 static void exec_once(Decode *s, vaddr_t pc) {
@@ -45,7 +156,10 @@ static void exec_once(Decode *s, vaddr_t pc) {
   s->snpc = pc;
   isa_exec_once(s);
   cpu.pc = s->dnpc;
+}
+
 #ifdef CONFIG_ITRACE
+static void format_logbuf(Decode *s) {
   char *p = s->logbuf;
   p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
   int ilen = s->snpc - s->pc;
@@ -68,30 +182,216 @@ static void exec_once(Decode *s, vaddr_t pc) {
 #else
   p[0] = '\0'; // the upstream llvm does not support loongarch32r
 #endif
+}
+#endif
+
+static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+#ifdef CONFIG_ITRACE
+  // the logbuf is only formatted when it is output
+  bool traced = g_log_enable && (ITRACE_COND) && trace_inst_enable(_this->pc, _this->isa.inst.val);
+  if (traced || g_print_step) format_logbuf(_this);
+  if (traced) { log_write("%s\n", _this->logbuf); }
+  if (g_print_step) { puts(_this->logbuf); }
 #endif
+  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
 }
 
-static void execute(uint64_t n) {
+/* An instruction jumping to itself, such as `idle', `wfi' or a branch to
+ * itself, changes nothing but the time until an interrupt is taken, and so
+ * does a loop polling the timer. Skip their repetitions up to the deadline of
+ * the timer, but no more than `left' instructions, and return the number
+ * skipped. Nothing is skipped if no deadline is set, since only the host may
+ * raise an interrupt then.
+ */
+static uint64_t fast_forward(uint64_t left) {
+  g_spin = false;
+  if (g_deadline == UINT64_MAX || isa_query_intr() != INTR_EMPTY) return 0;
+  uint64_t skip = g_deadline - g_nr_guest_inst;
+  if (skip > left) skip = left;
+#if CONFIG_NR_HART > 1
+  if (skip > quantum_left) skip = quantum_left;
+  IFDEF(CONFIG_SMP_ROUND_ROBIN, hart_nr_inst[cur_hart] += skip);
+  quantum_left -= skip;
+#endif
+  g_nr_guest_inst += skip;
+  g_nr_skipped += skip;
+  return skip;
+}
+
+/* The execute loop is instantiated twice. The instrumented copy formats the
+ * instruction trace and runs DiffTest, the fast copy has neither of them.
+ * `instrumented' is a constant in both copies, so the compiler removes the
+ * branches on it. Both return the number of instructions executed.
+ */
+static inline __attribute__((always_inline))
+uint64_t execute_loop(uint64_t n, bool instrumented) {
   Decode s;
-  for (;n > 0; n --) {
+  uint64_t i;
+  for (i = 0; i < n; ) {
+    if (g_nr_guest_inst >= g_deadline) isa_timer_update();
+    word_t intr = isa_query_intr();
+    if (intr != INTR_EMPTY) {
+      cpu.pc = isa_raise_intr(intr, cpu.pc);
+      if (instrumented) difftest_intr(intr);
+    }
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
-    trace_and_difftest(&s, cpu.pc);
+    i ++;
+#if CONFIG_NR_HART > 1
+    IFDEF(CONFIG_SMP_ROUND_ROBIN, hart_nr_inst[cur_hart] ++);
+    quantum_left --;
+#endif
+    if (instrumented) trace_and_difftest(&s, cpu.pc);
+    if (nemu_state.state != NEMU_RUNNING) break;
+    // the reference of DiffTest runs every repetition
+    if ((cpu.pc == s.pc || g_spin) && !instrumented) i += fast_forward(n - i);
+    // in parallel, hart 0 updates the devices for all harts
+    IFDEF(CONFIG_DEVICE, if (MUXDEF(CONFIG_SMP_PARALLEL, cur_hart == 0, true)) device_update());
+#if CONFIG_NR_HART > 1
+    if (quantum_left == 0) end_quantum();
+#endif
+  }
+  return i;
+}
+
+#ifdef CONFIG_ENGINE_JIT
+/* Devices are updated, harts are switched and the timer is checked
+ * between slices of the translated code, and a slice does not run past the
+ * deadline of the timer. What the JIT can not run is interpreted. The
+ * translated code leaves with cpu_spin() at an instruction jumping to itself
+ * or at a read of the timer by a polling loop.
+ */
+#define JIT_SLICE 65536
+
+static uint64_t execute_fast(uint64_t n) {
+  uint64_t i = 0;
+  while (i < n && nemu_state.state == NEMU_RUNNING) {
+    uint64_t slice = (n - i < JIT_SLICE ? n - i : JIT_SLICE);
+#if CONFIG_NR_HART > 1
+    if (slice > quantum_left) slice = quantum_left;
+#endif
+    if (g_nr_guest_inst >= g_deadline) isa_timer_update();
+    if (slice > g_deadline - g_nr_guest_inst) slice = g_deadline - g_nr_guest_inst;
+    uint64_t k = jit_exec(slice);
+    g_nr_guest_inst += k;
+    i += k;
+#if CONFIG_NR_HART > 1
+    IFDEF(CONFIG_SMP_ROUND_ROBIN, hart_nr_inst[cur_hart] += k);
+    quantum_left -= k;
+#endif
     if (nemu_state.state != NEMU_RUNNING) break;
+    if (g_spin) i += fast_forward(n - i);
+    // the rest of the slice is interpreted if the code cache can not run at all
+    else if (k < slice) { i += execute_loop(jit_runnable() ? 1 : slice - k, false); continue; }
     IFDEF(CONFIG_DEVICE, device_update());
+#if CONFIG_NR_HART > 1
+    if (quantum_left == 0) end_quantum();
+#endif
+  }
+  return i;
+}
+#else
+static uint64_t execute_fast(uint64_t n) { return execute_loop(n, false); }
+#endif
+static uint64_t execute_instrumented(uint64_t n) { return execute_loop(n, true); }
+
+static void execute(uint64_t n) {
+  while (n > 0 && nemu_state.state == NEMU_RUNNING) {
+    // a single step is always instrumented, and so is every instruction
+    // under DiffTest since the reference must be stepped in lockstep
+    bool instrumented;
+    uint64_t len = trace_window(g_nr_guest_inst, n, &instrumented);
+    instrumented |= g_print_step || ISDEF(CONFIG_DIFFTEST);
+    n -= (instrumented ? execute_instrumented(len) : execute_fast(len));
+  }
+  trace_update(g_nr_guest_inst);
+}
+
+#ifdef CONFIG_SMP_PARALLEL
+#include <pthread.h>
+#include <signal.h>
+
+/* Hart 0 runs on the thread calling cpu_exec(), and the others on threads
+ * running until it returns or the guest stops. Their instructions are not
+ * traced, and they do not update the devices.
+ */
+static pthread_t thread[CONFIG_NR_HART];
+static bool harts_stop = false;
+static uint64_t others_nr_skipped = 0;
+
+static void *hart_main(void *arg) {
+  // the alarm of the devices interrupts hart 0
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGVTALRM);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  cur_hart = (intptr_t)arg;
+  cpu = hart[cur_hart];
+  g_nr_guest_inst = hart_nr_inst[cur_hart];
+  isa_timer_update();
+  while (nemu_state.state == NEMU_RUNNING && !__atomic_load_n(&harts_stop, __ATOMIC_RELAXED)) {
+    execute_fast(CONFIG_SMP_QUANTUM);
   }
+  hart[cur_hart] = cpu;
+  hart_nr_inst[cur_hart] = g_nr_guest_inst;
+  __atomic_fetch_add(&others_nr_skipped, g_nr_skipped, __ATOMIC_SEQ_CST);
+  return NULL;
+}
+
+static void start_harts() {
+  harts_stop = false;
+  for (intptr_t i = 1; i < CONFIG_NR_HART; i ++) {
+    int ret = pthread_create(&thread[i], NULL, hart_main, (void *)i);
+    Assert(ret == 0, "Can not create the thread of hart %d", (int)i);
+  }
+}
+
+static void stop_harts() {
+  __atomic_store_n(&harts_stop, true, __ATOMIC_SEQ_CST);
+  for (int i = 1; i < CONFIG_NR_HART; i ++) pthread_join(thread[i], NULL);
+}
+#endif
+
+uint64_t cpu_total_inst() {
+#ifdef CONFIG_SMP_PARALLEL
+  // the harts count their instructions on their own, and have saved the counts when joined
+  uint64_t total = g_nr_guest_inst;
+  for (int i = 0; i < CONFIG_NR_HART; i ++) if (i != cur_hart) total += hart_nr_inst[i];
+  return total;
+#else
+  return g_nr_guest_inst;
+#endif
 }
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
+  uint64_t total = cpu_total_inst();
+  uint64_t skipped = g_nr_skipped + MUXDEF(CONFIG_SMP_PARALLEL, others_nr_skipped, 0);
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
-  Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
-  if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
+  Log("total guest instructions = " NUMBERIC_FMT, total);
+  if (skipped > 0) Log("guest instructions skipped while waiting = " NUMBERIC_FMT, skipped);
+  if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", (total - skipped) * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+#ifndef CONFIG_TARGET_AM
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  Log("peak RSS = " NUMBERIC_FMT " KB", (uint64_t)usage.ru_maxrss);
+#endif
+  IFDEF(CONFIG_ENGINE_JIT, jit_statistic());
+#if CONFIG_NR_HART > 1
+  for (int i = 0; i < CONFIG_NR_HART; i ++) {
+    Log("hart %d: guest instructions = " NUMBERIC_FMT, i, hart_nr_inst[i]);
+  }
+#endif
 }
 
 void assert_fail_msg() {
+  // abort() does not run the handlers of atexit()
+#if defined(CONFIG_HAS_SERIAL) && !defined(CONFIG_TARGET_AM)
+  serial_flush();
+#endif
   isa_reg_display();
   statistic();
 }
@@ -108,7 +408,9 @@ void cpu_exec(uint64_t n) {
 
   uint64_t timer_start = get_time();
 
+  IFDEF(CONFIG_SMP_PARALLEL, start_harts());
   execute(n);
+  IFDEF(CONFIG_SMP_PARALLEL, stop_harts());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -91,6 +91,12 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
 }
 
+// an interrupt is injected into DUT by the devices and REF never sees it,
+// so REF is told to take it before its next step
+void difftest_intr(word_t NO) {
+  ref_difftest_raise_intr(NO);
+}
+
 static void checkregs(CPU_state *ref, vaddr_t pc) {
   if (!isa_difftest_checkregs(ref, pc)) {
     nemu_state.state = NEMU_ABORT;
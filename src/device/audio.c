@@ -30,7 +30,140 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+// `sbuf` is a circular buffer. The guest writes samples to it and then
+// writes the new number of bytes in it to `reg_count`. The consumer, which
+// is the SDL audio callback running in its own thread, drains it.
+// `sbuf_head` and `sbuf_tail` count the bytes ever produced and consumed.
+// They are only written by the emulation thread and the consumer
+// respectively, so neither side takes a lock.
+static uint32_t sbuf_head = 0, sbuf_tail = 0;
+// `sbuf_tail` seen by the guest when it last read `reg_count`
+static uint32_t count_tail = 0;
+
+static void sbuf_copy_out(uint8_t *dst, uint32_t pos, uint32_t len) {
+  pos %= CONFIG_SB_SIZE;
+  uint32_t n = CONFIG_SB_SIZE - pos;
+  if (n > len) n = len;
+  memcpy(dst, sbuf + pos, n);
+  memcpy(dst + n, sbuf, len - n);
+}
+
+#ifdef CONFIG_AUDIO_WAV_DUMP
+// Samples are consumed as soon as they are produced and appended to a WAV
+// file, which makes the output independent of host time.
+static FILE *wav_fp = NULL;
+static uint32_t wav_data_size = 0;
+
+static void wav_write_header() {
+  uint32_t freq = audio_base[reg_freq], channels = audio_base[reg_channels];
+  struct {
+    char riff[4]; uint32_t riff_size; char wave[4];
+    char fmt[4]; uint32_t fmt_size; uint16_t format, channels;
+    uint32_t freq, byte_rate; uint16_t block_align, bits;
+    char data[4]; uint32_t data_size;
+  } __attribute__((packed)) h = {
+    .riff = "RIFF", .riff_size = 36 + wav_data_size, .wave = "WAVE",
+    .fmt = "fmt ", .fmt_size = 16, .format = 1, .channels = channels,
+    .freq = freq, .byte_rate = freq * channels * 2, .block_align = channels * 2, .bits = 16,
+    .data = "data", .data_size = wav_data_size,
+  };
+  fseek(wav_fp, 0, SEEK_SET);
+  __attribute__((unused)) int ret = fwrite(&h, sizeof(h), 1, wav_fp);
+  fseek(wav_fp, 0, SEEK_END);
+}
+
+static void audio_consume() {
+  static uint8_t buf[4096];
+  while (sbuf_tail != sbuf_head) {
+    uint32_t n = sbuf_head - sbuf_tail;
+    if (n > sizeof(buf)) n = sizeof(buf);
+    sbuf_copy_out(buf, sbuf_tail, n);
+    __attribute__((unused)) int ret = fwrite(buf, n, 1, wav_fp);
+    sbuf_tail += n;
+    wav_data_size += n;
+  }
+}
+
+static void audio_open() {
+  if (wav_fp == NULL) {
+    wav_fp = fopen(CONFIG_AUDIO_WAV_PATH, "wb");
+    Assert(wav_fp, "Can not open '%s'", CONFIG_AUDIO_WAV_PATH);
+  }
+  wav_write_header();
+}
+
+static void audio_close() {
+  if (wav_fp == NULL) return;
+  wav_write_header();
+  fclose(wav_fp);
+  Log("audio: %u bytes of samples are dumped to %s", wav_data_size, CONFIG_AUDIO_WAV_PATH);
+}
+#else
+static uint64_t nr_underrun = 0;
+static bool starving = true;
+
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint32_t tail = sbuf_tail;
+  uint32_t head = __atomic_load_n(&sbuf_head, __ATOMIC_ACQUIRE);
+  uint32_t n = head - tail;
+  if (n > len) n = len;
+  sbuf_copy_out(stream, tail, n);
+  __atomic_store_n(&sbuf_tail, tail + n, __ATOMIC_RELEASE);
+
+  if (n < len) {
+    memset(stream + n, 0, len - n);
+    // count once when the buffer runs dry while the guest is playing
+    if (!starving) __atomic_add_fetch(&nr_underrun, 1, __ATOMIC_RELAXED);
+    starving = true;
+  } else {
+    starving = false;
+  }
+}
+
+static void audio_open() {
+  SDL_AudioSpec s = {};
+  s.format = AUDIO_S16SYS;
+  s.userdata = NULL;
+  s.freq = audio_base[reg_freq];
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  SDL_CloseAudio();
+  SDL_InitSubSystem(SDL_INIT_AUDIO);
+  int ret = SDL_OpenAudio(&s, NULL);
+  Assert(ret == 0, "Can not open audio device: %s", SDL_GetError());
+  SDL_PauseAudio(0);
+}
+
+static void audio_close() {
+  Log("audio: %" PRIu64 " underruns", __atomic_load_n(&nr_underrun, __ATOMIC_RELAXED));
+}
+#endif
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init]) {
+        IFNDEF(CONFIG_AUDIO_WAV_DUMP, SDL_PauseAudio(1));
+        sbuf_head = sbuf_tail = count_tail = 0;
+        audio_open();
+        audio_base[reg_init] = 0;
+      }
+      break;
+    case reg_count:
+      if (is_write) {
+        uint32_t count = audio_base[reg_count];
+        if (count > CONFIG_SB_SIZE) count = CONFIG_SB_SIZE;
+        // the guest computes the new count from the one it read last time,
+        // while the consumer may have drained more since then
+        __atomic_store_n(&sbuf_head, count_tail + count, __ATOMIC_RELEASE);
+        IFDEF(CONFIG_AUDIO_WAV_DUMP, audio_consume());
+      } else {
+        count_tail = __atomic_load_n(&sbuf_tail, __ATOMIC_ACQUIRE);
+        audio_base[reg_count] = sbuf_head - count_tail;
+      }
+      break;
+  }
 }
 
 void init_audio() {
@@ -44,4 +177,6 @@ void init_audio() {
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
+  atexit(audio_close);
 }
@@ -0,0 +1,142 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#define _GNU_SOURCE // for O_DIRECT
+#include <device/blkimg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// With an overlay, the image is opened read-only and shared by all NEMU
+// instances, while writes go to a per-run delta file. The delta file is
+// sparse and has the same layout as the image, so a sector of the delta
+// file lives at the same offset as in the image, and the bitmap only
+// records which sectors are in the delta file. The delta file is unlinked
+// right after creation and disappears when NEMU exits.
+struct BlkImg {
+  const char *path;
+  int fd;
+  int delta_fd; // -1 if there is no overlay
+  uint64_t *bitmap;
+  uint64_t bitmap_nr_sector;
+  uint64_t nr_sector;
+};
+
+static void do_io(BlkImg *img, int fd, bool is_write, void *buf, uint64_t len, uint64_t offset) {
+  ssize_t ret = (is_write ? pwrite(fd, buf, len, offset) : pread(fd, buf, len, offset));
+  if (ret < 0 && errno == EINVAL && (fcntl(fd, F_GETFL) & O_DIRECT)) {
+    // the buffer or the host file system does not meet the alignment of O_DIRECT
+    Log("Can not use O_DIRECT with image %s, fall back to buffered I/O", img->path);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    ret = (is_write ? pwrite(fd, buf, len, offset) : pread(fd, buf, len, offset));
+  }
+  Assert(ret >= 0, "%s image %s at offset 0x%" PRIx64 " failed: %s",
+      (is_write ? "writing" : "reading"), img->path, offset, strerror(errno));
+  // reading beyond the end of the image returns zeros
+  if (!is_write && ret < len) memset((uint8_t *)buf + ret, 0, len - ret);
+}
+
+static inline bool in_delta(BlkImg *img, uint64_t sector) {
+  return sector < img->bitmap_nr_sector && ((img->bitmap[sector / 64] >> (sector % 64)) & 1);
+}
+
+static void grow_bitmap(BlkImg *img, uint64_t nr_sector) {
+  uint64_t old_words = img->bitmap_nr_sector / 64;
+  uint64_t new_words = nr_sector / 64 + 1;
+  img->bitmap = realloc(img->bitmap, new_words * sizeof(img->bitmap[0]));
+  assert(img->bitmap);
+  memset(img->bitmap + old_words, 0, (new_words - old_words) * sizeof(img->bitmap[0]));
+  img->bitmap_nr_sector = new_words * 64;
+}
+
+static void mark_delta(BlkImg *img, uint64_t sector, uint32_t nr_sector) {
+  uint64_t end = sector + nr_sector;
+  // the guest may write beyond the end of the image
+  if (end > img->bitmap_nr_sector) grow_bitmap(img, end * 2);
+  for (uint64_t s = sector; s < end; s ++) {
+    img->bitmap[s / 64] |= 1ull << (s % 64);
+  }
+}
+
+void blkimg_read(BlkImg *img, void *buf, uint64_t sector, uint32_t nr_sector) {
+  if (img->delta_fd < 0) {
+    do_io(img, img->fd, false, buf, (uint64_t)nr_sector * SECTOR_SIZE, sector * SECTOR_SIZE);
+    return;
+  }
+  // read each run of sectors in the same file with a single call
+  uint8_t *p = buf;
+  uint64_t end = sector + nr_sector;
+  while (sector < end) {
+    bool delta = in_delta(img, sector);
+    uint64_t s = sector + 1;
+    while (s < end && in_delta(img, s) == delta) s ++;
+    uint64_t len = (s - sector) * SECTOR_SIZE;
+    do_io(img, (delta ? img->delta_fd : img->fd), false, p, len, sector * SECTOR_SIZE);
+    p += len;
+    sector = s;
+  }
+}
+
+void blkimg_write(BlkImg *img, const void *buf, uint64_t sector, uint32_t nr_sector) {
+  int fd = (img->delta_fd < 0 ? img->fd : img->delta_fd);
+  do_io(img, fd, true, (void *)buf, (uint64_t)nr_sector * SECTOR_SIZE, sector * SECTOR_SIZE);
+  if (img->delta_fd >= 0) mark_delta(img, sector, nr_sector);
+}
+
+void blkimg_prefetch(BlkImg *img, uint64_t sector, uint32_t nr_sector) {
+  posix_fadvise(img->fd, sector * SECTOR_SIZE, (off_t)nr_sector * SECTOR_SIZE, POSIX_FADV_WILLNEED);
+}
+
+uint64_t blkimg_nr_sector(BlkImg *img) {
+  return img->nr_sector;
+}
+
+static int open_delta(BlkImg *img) {
+  const char *dir = getenv("TMPDIR");
+  char path[256];
+  snprintf(path, sizeof(path), "%s/nemu-overlay-XXXXXX", (dir ? dir : "/tmp"));
+  int fd = mkstemp(path);
+  Assert(fd >= 0, "Can not create overlay file %s: %s", path, strerror(errno));
+  unlink(path);
+  int ret = ftruncate(fd, img->nr_sector * SECTOR_SIZE);
+  Assert(ret == 0, "Can not resize overlay file: %s", strerror(errno));
+  return fd;
+}
+
+BlkImg* blkimg_open(const char *path, bool overlay, bool direct) {
+  int flags = (overlay ? O_RDONLY : O_RDWR);
+  int fd = open(path, flags | (direct ? O_DIRECT : 0));
+  if (fd < 0 && direct && errno == EINVAL) fd = open(path, flags);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+  fstat(fd, &st);
+  BlkImg *img = malloc(sizeof(BlkImg));
+  assert(img);
+  img->path = path;
+  img->fd = fd;
+  img->nr_sector = st.st_size / SECTOR_SIZE;
+  img->delta_fd = -1;
+  img->bitmap = NULL;
+  img->bitmap_nr_sector = 0;
+  if (overlay) {
+    img->delta_fd = open_delta(img);
+    grow_bitmap(img, img->nr_sector);
+  }
+  Log("Open image %s, %" PRIu64 " sectors%s", path, img->nr_sector,
+      (overlay ? ", writes go to a temporary overlay" : ""));
+  return img;
+}
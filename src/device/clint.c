@@ -0,0 +1,56 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The CLINT of RISC-V. mtime is the tick of the virtual time, and the
+ * running hart reads msip and mtimecmp at isa_timer_update(), which is
+ * called after they are written. The other harts see the writes to theirs
+ * when they are switched in.
+ */
+
+#include <device/map.h>
+#include <cpu/cpu.h>
+#include <isa.h>
+
+#define CLINT_MSIP     0x0
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0x10000
+
+static uint8_t *clint_base = NULL;
+
+bool clint_msip(int hart) {
+  return *(uint32_t *)(clint_base + CLINT_MSIP + 4 * hart) & 1;
+}
+
+uint64_t clint_mtimecmp(int hart) {
+  return *(uint64_t *)(clint_base + CLINT_MTIMECMP + 8 * hart);
+}
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  uint64_t *mtime = (uint64_t *)(clint_base + CLINT_MTIME);
+  if (!is_write) {
+    if (offset >= CLINT_MTIME) *mtime = cpu_inst_count() / CONFIG_TIMER_RATIO;
+  } else if (offset < CLINT_MTIME) {
+    isa_timer_update();
+  }
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  memset(clint_base, 0, CLINT_SIZE);
+  // no timer interrupt until mtimecmp is written
+  memset(clint_base + CLINT_MTIMECMP, 0xff, 8 * CONFIG_NR_HART);
+  add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_io_handler);
+}
@@ -16,6 +16,7 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/map.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -23,6 +24,7 @@
 void init_map();
 void init_serial();
 void init_timer();
+void init_clint();
 void init_vga();
 void init_i8042();
 void init_audio();
@@ -32,16 +34,23 @@ void init_alarm();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
+void serial_update();
 
+/* With SMP_PARALLEL, only hart 0 calls this, and it takes the changes of
+ * the interrupt line made by the other harts here.
+ */
 void device_update() {
+  IFDEF(CONFIG_SMP_PARALLEL, dev_intr_sync());
   static uint64_t last = 0;
   uint64_t now = get_time();
   if (now - last < 1000000 / TIMER_HZ) {
     return;
   }
   last = now;
+  IFDEF(CONFIG_SMP_PARALLEL, device_lock());
 
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+  IFDEF(CONFIG_HAS_SERIAL, serial_update());
 
 #ifndef CONFIG_TARGET_AM
   SDL_Event event;
@@ -64,6 +73,7 @@ void device_update() {
     }
   }
 #endif
+  IFDEF(CONFIG_SMP_PARALLEL, device_unlock());
 }
 
 void sdl_clear_event_queue() {
@@ -79,6 +89,7 @@ void init_device() {
 
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
   IFDEF(CONFIG_HAS_VGA, init_vga());
   IFDEF(CONFIG_HAS_KEYBOARD, init_i8042());
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
@@ -14,6 +14,88 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/blkimg.h>
+#include <memory/paddr.h>
+
+// The guest programs a transfer descriptor and starts it by writing
+// `reg_cmd`. The transfer completes before the write returns: the data is
+// moved between the image and the guest memory directly, without staging
+// it in the device. `reg_status` tells the result of the last transfer.
+enum {
+  reg_present,
+  reg_blksz,
+  reg_blkcnt,  // number of blocks of the disk
+  reg_buf_lo,  // guest physical address of the buffer
+  reg_buf_hi,
+  reg_blkno,
+  reg_count,   // number of blocks to transfer
+  reg_cmd,
+  reg_status,
+  reg_intr,    // raise an interrupt on completion if non-zero, a write to
+               // `reg_status` acknowledges it
+  nr_reg
+};
+
+enum { DISK_CMD_NONE, DISK_CMD_READ, DISK_CMD_WRITE };
+enum { DISK_STATUS_OK, DISK_STATUS_ERROR };
+
+static uint32_t *disk_base = NULL;
+static BlkImg *img = NULL;
+
+static bool check_transfer(uint64_t buf, uint64_t blkno, uint32_t count) {
+  if (img == NULL || count == 0) return false;
+  if (blkno + count > blkimg_nr_sector(img)) return false;
+  uint64_t len = (uint64_t)count * SECTOR_SIZE;
+  return buf >= CONFIG_MBASE && buf - CONFIG_MBASE + len <= CONFIG_MSIZE;
+}
+
+static void disk_transfer(int cmd) {
+  uint64_t buf = ((uint64_t)disk_base[reg_buf_hi] << 32) | disk_base[reg_buf_lo];
+  uint64_t blkno = disk_base[reg_blkno];
+  uint32_t count = disk_base[reg_count];
+  if (!check_transfer(buf, blkno, count)) {
+    disk_base[reg_status] = DISK_STATUS_ERROR;
+    return;
+  }
+
+  if (cmd == DISK_CMD_WRITE) blkimg_write(img, guest_to_host(buf), blkno, count);
+  else {
+    blkimg_read(img, guest_to_host(buf), blkno, count);
+    pmem_host_written(buf, (size_t)count * SECTOR_SIZE);
+    // the memory written by DMA is invisible to REF
+    IFDEF(CONFIG_DIFFTEST, ref_difftest_memcpy(buf, guest_to_host(buf),
+          (size_t)count * SECTOR_SIZE, DIFFTEST_TO_REF));
+  }
+  disk_base[reg_status] = DISK_STATUS_OK;
+
+  if (disk_base[reg_intr]) dev_raise_intr(DEV_INTR_DISK);
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_status * sizeof(uint32_t)) dev_clear_intr(DEV_INTR_DISK);
+  if (is_write && offset == reg_cmd * sizeof(uint32_t)) {
+    int cmd = disk_base[reg_cmd];
+    disk_base[reg_cmd] = DISK_CMD_NONE;
+    if (cmd == DISK_CMD_READ || cmd == DISK_CMD_WRITE) disk_transfer(cmd);
+    else disk_base[reg_status] = DISK_STATUS_ERROR;
+  }
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+
+  const char *path = CONFIG_DISK_IMG_PATH;
+  if (path[0] != '\0') {
+    img = blkimg_open(path, ISDEF(CONFIG_DISK_OVERLAY), ISDEF(CONFIG_DISK_ODIRECT));
+    if (img == NULL) Log("Can not find disk image: %s", path);
+  }
+  disk_base[reg_present] = (img != NULL);
+  disk_base[reg_blksz] = SECTOR_SIZE;
+  disk_base[reg_blkcnt] = (img ? blkimg_nr_sector(img) : 0);
 }
@@ -14,6 +14,45 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/map.h>
+#include <cpu/cpu.h>
 
-void dev_raise_intr() {
+/* The devices share one interrupt line of the ISA, which stays raised as
+ * long as any device asserts its interrupt. A device deasserts it when the
+ * guest acknowledges the interrupt at the device.
+ *
+ * With SMP_PARALLEL, the line goes to hart 0. Another hart acknowledging an
+ * interrupt leaves the change to hart 0, which takes it at dev_intr_sync().
+ * The line is changed atomically, since the alarm raises it from a signal
+ * handler, where the lock of the devices can not be taken.
+ */
+static uint32_t dev_intr = 0;
+#ifdef CONFIG_SMP_PARALLEL
+static bool dev_intr_changed = false;
+#endif
+
+static void line_changed() {
+#ifdef CONFIG_SMP_PARALLEL
+  if (cpu_hart_id() != 0) { __atomic_store_n(&dev_intr_changed, true, __ATOMIC_SEQ_CST); return; }
+#endif
+  isa_dev_intr(__atomic_load_n(&dev_intr, __ATOMIC_SEQ_CST) != 0);
+}
+
+void dev_raise_intr(int dev) {
+  uint32_t old = __atomic_fetch_or(&dev_intr, 1u << dev, __ATOMIC_SEQ_CST);
+  if (old == 0) line_changed();
+}
+
+void dev_clear_intr(int dev) {
+  uint32_t old = __atomic_fetch_and(&dev_intr, ~(1u << dev), __ATOMIC_SEQ_CST);
+  if (old == (1u << dev)) line_changed();
+}
+
+#ifdef CONFIG_SMP_PARALLEL
+void dev_intr_sync() {
+  if (__atomic_load_n(&dev_intr_changed, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&dev_intr_changed, false, __ATOMIC_SEQ_CST)) {
+    isa_dev_intr(__atomic_load_n(&dev_intr, __ATOMIC_SEQ_CST) != 0);
+  }
 }
+#endif
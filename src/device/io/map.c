@@ -23,6 +23,17 @@
 static uint8_t *io_space = NULL;
 static uint8_t *p_space = NULL;
 
+#ifdef CONFIG_SMP_PARALLEL
+#include <pthread.h>
+/* The harts running in parallel access the devices one at a time, and hart
+ * 0 updates them under the same lock.
+ */
+static pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void device_lock() { pthread_mutex_lock(&device_mutex); }
+void device_unlock() { pthread_mutex_unlock(&device_mutex); }
+#endif
+
 uint8_t* new_space(int size) {
   uint8_t *p = p_space;
   // page aligned;
@@ -56,8 +67,10 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_SMP_PARALLEL, device_lock());
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  IFDEF(CONFIG_SMP_PARALLEL, device_unlock());
   return ret;
 }
 
@@ -65,6 +78,8 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_SMP_PARALLEL, device_lock());
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
+  IFDEF(CONFIG_SMP_PARALLEL, device_unlock());
 }
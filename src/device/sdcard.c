@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/blkimg.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -40,22 +41,55 @@ enum {
   SDHBLC
 };
 
-static FILE *fp = NULL;
+static BlkImg *img = NULL;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
-static long blk_addr = 0;
+static uint64_t blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
 
+// Data of SDDATA is staged in `blk_buf`, which is moved from/to the image
+// with a single pread()/pwrite() of up to CONFIG_SDCARD_READAHEAD sectors.
+// `blk_addr` is the sector of the image where the next move happens.
+static uint8_t blk_buf[CONFIG_SDCARD_READAHEAD * SECTOR_SIZE] PG_ALIGN = {};
+static uint32_t buf_pos = 0, buf_len = 0;
+static uint32_t nr_blk_left = 0; // 0 means the number of blocks is unknown
+
+static void fill_buf() {
+  uint32_t n = (nr_blk_left == 0 ? 1 :
+      (nr_blk_left < CONFIG_SDCARD_READAHEAD ? nr_blk_left : CONFIG_SDCARD_READAHEAD));
+  blkimg_read(img, blk_buf, blk_addr, n);
+  blk_addr += n;
+  if (nr_blk_left > 0) nr_blk_left -= n;
+  buf_pos = 0;
+  buf_len = n * SECTOR_SIZE;
+}
+
+static void flush_buf() {
+  // a partial sector at the end of a transfer is dropped
+  uint32_t n = buf_pos / SECTOR_SIZE;
+  blkimg_write(img, blk_buf, blk_addr, n);
+  blk_addr += n;
+  nr_blk_left = (nr_blk_left > n ? nr_blk_left - n : 0);
+  buf_pos = 0;
+}
+
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
+  buf_pos = buf_len = 0;
+  nr_blk_left = blkcnt;
+  blkcnt = 0;
+  if (img && !is_write && nr_blk_left > CONFIG_SDCARD_READAHEAD) {
+    blkimg_prefetch(img, blk_addr, nr_blk_left);
+  }
 }
 
 static void sdcard_handle_cmd(int cmd) {
+  // a new command ends the previous write transfer
+  if (img && write_cmd && buf_pos > 0) flush_buf();
   switch (cmd) {
     case MMC_GO_IDLE_STATE: break;
     case MMC_SEND_OP_COND: base[SDRSP0] = 0x80ff8000; break;
@@ -109,10 +143,16 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else if (img) {
+         if (!write_cmd) {
+           if (buf_pos == buf_len) fill_buf();
+           memcpy(&base[SDDATA], blk_buf + buf_pos, 4);
+           buf_pos += 4;
+         } else {
+           memcpy(blk_buf + buf_pos, &base[SDDATA], 4);
+           buf_pos += 4;
+           if (buf_pos == sizeof(blk_buf) || buf_pos == nr_blk_left * SECTOR_SIZE) flush_buf();
+         }
        }
        addr += 4;
        break;
@@ -128,7 +168,7 @@ void init_sdcard() {
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  img = blkimg_open(path, ISDEF(CONFIG_SDCARD_OVERLAY), ISDEF(CONFIG_SDCARD_ODIRECT));
+  if (img == NULL) Log("Can not find sdcard image: %s", path);
 }
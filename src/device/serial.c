@@ -19,24 +19,112 @@
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
-#define CH_OFFSET 0
+#define CH_OFFSET  0
+#define IIR_OFFSET 2
+#define LCR_OFFSET 3
+#define LSR_OFFSET 5
+
+#define IIR_NO_INT 0x01
+#define LCR_DLAB   0x80
+#define LSR_DR     0x01 // data ready
+#define LSR_THRE   0x20 // transmitter holding register empty
+#define LSR_TEMT   0x40 // transmitter empty
 
 static uint8_t *serial_base = NULL;
 
+#ifndef CONFIG_TARGET_AM
+// Characters are collected and written to the host with a single call when
+// a line ends, when the buffer is full, or at the next device update. They
+// are also flushed at exit and before NEMU aborts on a failed assertion.
+#define OUTPUT_BUF_LEN 4096
+static char output_buf[OUTPUT_BUF_LEN] = {};
+static int output_len = 0;
+
+void serial_flush() {
+  if (output_len > 0) {
+    __attribute__((unused)) int ret = fwrite(output_buf, output_len, 1, stderr);
+    output_len = 0;
+  }
+}
+#endif
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+#ifdef CONFIG_TARGET_AM
+  putch(ch);
+#else
+  output_buf[output_len ++] = ch;
+  if (ch == '\n' || output_len == OUTPUT_BUF_LEN) serial_flush();
+#endif
+}
+
+#define RX_QUEUE_LEN 1024
+static uint8_t rx_queue[RX_QUEUE_LEN] = {};
+static int rx_f = 0, rx_r = 0;
+
+static uint8_t rx_dequeue() {
+  uint8_t ch = 0;
+  if (rx_f != rx_r) {
+    ch = rx_queue[rx_f];
+    rx_f = (rx_f + 1) % RX_QUEUE_LEN;
+  }
+  return ch;
+}
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define FIFO_PATH "/tmp/nemu.serial"
+static int fifo_fd = -1;
+
+// Move the input from the FIFO to the receive queue without blocking.
+static void rx_poll() {
+  uint8_t buf[256];
+  int room = (rx_f - rx_r - 1 + RX_QUEUE_LEN) % RX_QUEUE_LEN;
+  if (room > sizeof(buf)) room = sizeof(buf);
+  if (room == 0) return;
+  int n = read(fifo_fd, buf, room);
+  for (int i = 0; i < n; i ++) {
+    rx_queue[rx_r] = buf[i];
+    rx_r = (rx_r + 1) % RX_QUEUE_LEN;
+  }
+}
+
+static void init_fifo() {
+  int ret = mkfifo(FIFO_PATH, 0666);
+  Assert(ret == 0 || errno == EEXIST, "Can not create " FIFO_PATH);
+  fifo_fd = open(FIFO_PATH, O_RDONLY | O_NONBLOCK);
+  Assert(fifo_fd >= 0, "Can not open " FIFO_PATH);
+  // keep a writer to avoid reading EOF when no one else opens the FIFO
+  __attribute__((unused)) int wfd = open(FIFO_PATH, O_WRONLY | O_NONBLOCK);
+  Log("Serial input is read from " FIFO_PATH);
+}
+#endif
+
+void serial_update() {
+  IFNDEF(CONFIG_TARGET_AM, serial_flush());
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, rx_poll());
 }
 
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
+  bool dlab = serial_base[LCR_OFFSET] & LCR_DLAB;
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
+      if (dlab) break; // divisor latch
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else serial_base[0] = rx_dequeue();
       break;
-    default: panic("do not support offset = %d", offset);
+    case IIR_OFFSET:
+      if (!is_write) serial_base[IIR_OFFSET] = IIR_NO_INT;
+      break;
+    case LSR_OFFSET:
+      if (!is_write) serial_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT | (rx_f != rx_r ? LSR_DR : 0);
+      break;
+    default: break; // other registers only hold what is written
   }
 }
 
@@ -47,5 +135,6 @@ void init_serial() {
 #else
   add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
 #endif
-
+  IFNDEF(CONFIG_TARGET_AM, atexit(serial_flush));
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_fifo());
 }
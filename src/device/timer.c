@@ -13,27 +13,28 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#include <cpu/cpu.h>
 #include <device/map.h>
 #include <device/alarm.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
 
+// an access to the RTC also acknowledges its tick interrupt
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
+  IFNDEF(CONFIG_TARGET_AM, dev_clear_intr(DEV_INTR_TIMER));
   if (!is_write && offset == 4) {
     uint64_t us = get_time();
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
+    cpu_poll(us);
   }
 }
 
 #ifndef CONFIG_TARGET_AM
 static void timer_intr() {
-  if (nemu_state.state == NEMU_RUNNING) {
-    extern void dev_raise_intr();
-    dev_raise_intr();
-  }
+  if (nemu_state.state == NEMU_RUNNING) dev_raise_intr(DEV_INTR_TIMER);
 }
 #endif
 
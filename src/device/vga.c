@@ -34,58 +34,321 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+void vga_update_screen();
+
+// Scanlines written by the guest since the last update are recorded as
+// [dirty_y0, dirty_y1). Only these lines are uploaded to the screen.
+static uint32_t pitch = 0; // bytes per scanline
+static uint32_t dirty_y0 = 0, dirty_y1 = 0;
+
+static inline void mark_dirty(uint32_t y0, uint32_t y1) {
+  if (dirty_y0 == dirty_y1) { dirty_y0 = y0; dirty_y1 = y1; return; }
+  if (y0 < dirty_y0) dirty_y0 = y0;
+  if (y1 > dirty_y1) dirty_y1 = y1;
+}
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write) mark_dirty(offset / pitch, (offset + len - 1) / pitch + 1);
+}
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 
+static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static void init_screen() {
-  SDL_Window *window = NULL;
-  char title[128];
-  sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
-  SDL_Init(SDL_INIT_VIDEO);
-  SDL_CreateWindowAndRenderer(
-      SCREEN_W * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
-      SCREEN_H * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
-      0, &window, &renderer);
-  SDL_SetWindowTitle(window, title);
+static void init_renderer() {
+  renderer = SDL_CreateRenderer(window, -1, 0);
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
       SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
-  SDL_RenderClear(renderer);
+static void present(const void *fb, uint32_t y0, uint32_t y1) {
+  SDL_Rect rect = { .x = 0, .y = y0, .w = SCREEN_W, .h = y1 - y0 };
+  SDL_UpdateTexture(texture, &rect, (uint8_t *)fb + y0 * pitch, pitch);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
+
+#ifdef CONFIG_VGA_RENDER_THREAD
+// SDL does not support video calls outside the main thread on every backend,
+// see the help of VGA_RENDER_THREAD.
+// The emulation thread copies dirty scanlines into `staging` and hands the
+// range over to the render thread, which moves them into its own `front`
+// buffer under the lock and then uploads and presents without holding it.
+// Consecutive frames that are not yet consumed are merged.
+static uint8_t *staging = NULL, *front = NULL;
+static uint32_t pending_y0 = 0, pending_y1 = 0;
+static SDL_mutex *fb_lock = NULL;
+static SDL_cond *fb_cond = NULL;
+
+static int render_thread(void *arg) {
+  init_renderer();
+  while (true) {
+    SDL_LockMutex(fb_lock);
+    while (pending_y0 == pending_y1) SDL_CondWait(fb_cond, fb_lock);
+    uint32_t y0 = pending_y0, y1 = pending_y1;
+    memcpy(front + y0 * pitch, staging + y0 * pitch, (y1 - y0) * pitch);
+    pending_y0 = pending_y1 = 0;
+    SDL_UnlockMutex(fb_lock);
+
+    present(front, y0, y1);
+  }
+  return 0;
+}
+
+static void init_render_thread() {
+  staging = calloc(1, screen_size());
+  front = calloc(1, screen_size());
+  assert(staging && front);
+  fb_lock = SDL_CreateMutex();
+  fb_cond = SDL_CreateCond();
+  SDL_Thread *t = SDL_CreateThread(render_thread, "nemu-vga", NULL);
+  Assert(t, "Can not create render thread: %s", SDL_GetError());
+  SDL_DetachThread(t);
+}
+
+static inline void update_screen() {
+  SDL_LockMutex(fb_lock);
+  memcpy(staging + dirty_y0 * pitch, (uint8_t *)vmem + dirty_y0 * pitch, (dirty_y1 - dirty_y0) * pitch);
+  if (pending_y0 == pending_y1) { pending_y0 = dirty_y0; pending_y1 = dirty_y1; }
+  else {
+    if (dirty_y0 < pending_y0) pending_y0 = dirty_y0;
+    if (dirty_y1 > pending_y1) pending_y1 = dirty_y1;
+  }
+  SDL_CondSignal(fb_cond);
+  SDL_UnlockMutex(fb_lock);
+}
+#else
+static inline void update_screen() {
+  present(vmem, dirty_y0, dirty_y1);
+}
+#endif
+
+static void init_screen() {
+  char title[128];
+  sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
+  SDL_Init(SDL_INIT_VIDEO);
+  window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+      SCREEN_W * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
+      SCREEN_H * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)), 0);
+  MUXDEF(CONFIG_VGA_RENDER_THREAD, init_render_thread(), init_renderer());
+}
 #else
 static void init_screen() {}
 
 static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+  io_write(AM_GPU_FBDRAW, 0, dirty_y0, (uint8_t *)vmem + dirty_y0 * pitch,
+      screen_width(), dirty_y1 - dirty_y0, true);
 }
 #endif
 #endif
 
+#ifdef CONFIG_VGA_CAPTURE
+#include <SDL2/SDL.h>
+#include <isa.h>
+#include <sys/stat.h>
+
+// Every synced frame is hashed and the hash is appended to `hashes.txt`
+// under CONFIG_VGA_CAPTURE_DIR, so the file of one run can be used as the
+// golden hashes of the following runs. Every CONFIG_VGA_CAPTURE_INTERVAL-th
+// frame is also dumped as a PPM file by an encoder thread.
+#define CAPTURE_QUEUE_LEN 8
+#define NR_FRAME_TIME_BUCKET 12 // the last bucket is for >= 2^10 ms
+
+static uint64_t nr_frame = 0, nr_dump = 0, nr_mismatch = 0;
+static uint64_t frame_hash = 0;
+static uint64_t first_frame_time = 0, last_frame_time = 0;
+static uint64_t frame_time_hist[NR_FRAME_TIME_BUCKET] = {};
+static FILE *hash_fp = NULL;
+static uint64_t *golden = NULL;
+static uint64_t nr_golden = 0;
+
+static struct {
+  uint64_t no;
+  uint8_t *buf;
+} capture_queue[CAPTURE_QUEUE_LEN] = {};
+static int queue_f = 0, queue_r = 0;
+static SDL_mutex *queue_lock = NULL;
+static SDL_cond *queue_cond = NULL;
+
+static uint64_t hash_frame(const void *fb, uint32_t size) {
+  const uint64_t *p = fb;
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int i = 0; i < size / sizeof(p[0]); i ++) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+static void dump_ppm(uint64_t no, const uint32_t *fb, uint8_t *rgb) {
+  char path[256];
+  snprintf(path, sizeof(path), CONFIG_VGA_CAPTURE_DIR "/frame-%06" PRIu64 ".ppm", no);
+  FILE *fp = fopen(path, "wb");
+  Assert(fp, "Can not open '%s'", path);
+  int n = SCREEN_W * SCREEN_H;
+  for (int i = 0; i < n; i ++) {
+    rgb[i * 3 + 0] = fb[i] >> 16;
+    rgb[i * 3 + 1] = fb[i] >> 8;
+    rgb[i * 3 + 2] = fb[i];
+  }
+  fprintf(fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+  __attribute__((unused)) int ret = fwrite(rgb, n * 3, 1, fp);
+  fclose(fp);
+}
+
+static int encoder_thread(void *arg) {
+  uint8_t *rgb = malloc(SCREEN_W * SCREEN_H * 3);
+  assert(rgb);
+  while (true) {
+    SDL_LockMutex(queue_lock);
+    while (queue_f == queue_r) SDL_CondWait(queue_cond, queue_lock);
+    SDL_UnlockMutex(queue_lock);
+
+    // the slot at `queue_f` is not touched by the emulation thread until it is released
+    dump_ppm(capture_queue[queue_f].no, (uint32_t *)capture_queue[queue_f].buf, rgb);
+
+    SDL_LockMutex(queue_lock);
+    queue_f = (queue_f + 1) % CAPTURE_QUEUE_LEN;
+    SDL_CondBroadcast(queue_cond);
+    SDL_UnlockMutex(queue_lock);
+  }
+  return 0;
+}
+
+static void capture_enqueue(uint64_t no) {
+  SDL_LockMutex(queue_lock);
+  while ((queue_r + 1) % CAPTURE_QUEUE_LEN == queue_f) SDL_CondWait(queue_cond, queue_lock);
+  SDL_UnlockMutex(queue_lock);
+
+  capture_queue[queue_r].no = no;
+  memcpy(capture_queue[queue_r].buf, vmem, screen_size());
+
+  SDL_LockMutex(queue_lock);
+  queue_r = (queue_r + 1) % CAPTURE_QUEUE_LEN;
+  SDL_CondBroadcast(queue_cond);
+  SDL_UnlockMutex(queue_lock);
+}
+
+static void capture_frame(bool dirty) {
+  uint64_t now = get_time();
+  if (nr_frame == 0) first_frame_time = now;
+  else {
+    uint64_t ms = (now - last_frame_time) / 1000;
+    int b = 0;
+    while (ms > 0 && b < NR_FRAME_TIME_BUCKET - 1) { ms >>= 1; b ++; }
+    frame_time_hist[b] ++;
+  }
+  last_frame_time = now;
+
+  if (dirty || nr_frame == 0) frame_hash = hash_frame(vmem, screen_size());
+  fprintf(hash_fp, "%" PRIu64 " %016" PRIx64 "\n", nr_frame, frame_hash);
+  if (nr_frame < nr_golden && golden[nr_frame] != frame_hash) {
+    Log("frame %" PRIu64 " is different from the golden one, right = %016" PRIx64
+        ", wrong = %016" PRIx64, nr_frame, golden[nr_frame], frame_hash);
+    nr_mismatch ++;
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = cpu.pc;
+  }
+
+  if (CONFIG_VGA_CAPTURE_INTERVAL > 0 && nr_frame % CONFIG_VGA_CAPTURE_INTERVAL == 0) {
+    capture_enqueue(nr_frame);
+    nr_dump ++;
+  }
+  nr_frame ++;
+}
+
+static void capture_report() {
+  SDL_LockMutex(queue_lock);
+  while (queue_f != queue_r) SDL_CondWait(queue_cond, queue_lock);
+  SDL_UnlockMutex(queue_lock);
+  fflush(hash_fp);
+
+  Log("vga capture: %" PRIu64 " frames, %" PRIu64 " dumped, %" PRIu64 " different from golden",
+      nr_frame, nr_dump, nr_mismatch);
+  uint64_t elapsed = last_frame_time - first_frame_time;
+  if (nr_frame > 1 && elapsed > 0) {
+    Log("vga capture: %" PRIu64 " frames/s", (nr_frame - 1) * 1000000 / elapsed);
+  }
+  for (int i = 0; i < NR_FRAME_TIME_BUCKET; i ++) {
+    if (frame_time_hist[i] == 0) continue;
+    if (i == 0) Log("vga capture: frame time < 1 ms: %" PRIu64, frame_time_hist[i]);
+    else Log("vga capture: frame time %s %d ms: %" PRIu64,
+        (i == NR_FRAME_TIME_BUCKET - 1 ? ">=" : "~"), 1 << (i - 1), frame_time_hist[i]);
+  }
+}
+
+static void load_golden(const char *file) {
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open '%s'", file);
+  uint64_t no, hash, cap = 0;
+  while (fscanf(fp, "%" SCNu64 " %" SCNx64, &no, &hash) == 2) {
+    if (no >= cap) {
+      cap = (no + 1) * 2;
+      golden = realloc(golden, cap * sizeof(golden[0]));
+      assert(golden);
+    }
+    golden[no] = hash;
+    if (no >= nr_golden) nr_golden = no + 1;
+  }
+  fclose(fp);
+  Log("Load %" PRIu64 " golden frame hashes from %s", nr_golden, file);
+}
+
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  // handle the frame right at sync to make the frame sequence independent of host time
+  if (is_write && offset == 4) vga_update_screen();
+}
+
+static void init_capture() {
+  mkdir(CONFIG_VGA_CAPTURE_DIR, 0755);
+  hash_fp = fopen(CONFIG_VGA_CAPTURE_DIR "/hashes.txt", "w");
+  Assert(hash_fp, "Can not open '%s'", CONFIG_VGA_CAPTURE_DIR "/hashes.txt");
+  if (strlen(CONFIG_VGA_CAPTURE_GOLDEN) > 0) load_golden(CONFIG_VGA_CAPTURE_GOLDEN);
+
+  for (int i = 0; i < CAPTURE_QUEUE_LEN; i ++) {
+    capture_queue[i].buf = malloc(screen_size());
+    assert(capture_queue[i].buf);
+  }
+  queue_lock = SDL_CreateMutex();
+  queue_cond = SDL_CreateCond();
+  SDL_Thread *t = SDL_CreateThread(encoder_thread, "nemu-vga-capture", NULL);
+  Assert(t, "Can not create encoder thread: %s", SDL_GetError());
+  SDL_DetachThread(t);
+  atexit(capture_report);
+}
+#endif
+
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  uint32_t sync = vgactl_port_base[1];
+  if (sync == 0) return;
+  vgactl_port_base[1] = 0;
+  bool dirty = (dirty_y0 != dirty_y1);
+  IFDEF(CONFIG_VGA_CAPTURE, capture_frame(dirty));
+  if (!dirty) return;
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+  dirty_y0 = dirty_y1 = 0;
 }
 
 void init_vga() {
   vgactl_port_base = (uint32_t *)new_space(8);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8,
+      MUXDEF(CONFIG_VGA_CAPTURE, vgactl_io_handler, NULL));
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8,
+      MUXDEF(CONFIG_VGA_CAPTURE, vgactl_io_handler, NULL));
 #endif
 
+  pitch = screen_width() * sizeof(uint32_t);
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_io_handler);
+  mark_dirty(0, screen_height());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  IFDEF(CONFIG_VGA_CAPTURE, memset(vmem, 0, screen_size()));
+  IFDEF(CONFIG_VGA_CAPTURE, init_capture());
 }
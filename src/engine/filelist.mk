@@ -15,3 +15,5 @@
 
 INC_PATH += $(NEMU_HOME)/src/engine/$(ENGINE)
 DIRS-y += src/engine/$(ENGINE)
+# the JIT runs with the interpreter for what it does not translate
+DIRS-$(CONFIG_ENGINE_JIT) += src/engine/interpreter
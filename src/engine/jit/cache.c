@@ -0,0 +1,449 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The code cache and the dispatcher. Translated blocks are found by their
+ * guest pc in a hash table. A block which ends with a direct jump is chained
+ * to its successor the first time it is left, so hot loops stay in the code
+ * cache. Other exits look up the next pc in a small indirect branch target
+ * cache, and only come back to the dispatcher when it misses. The whole
+ * cache is flushed when it is full.
+ *
+ * Writes to guest memory check a bitmap of the lines holding translated
+ * code. A write to such a line invalidates the blocks it overlaps: their
+ * entries are patched to leave the code cache, and the jumps chained to
+ * them are unlinked back to their exit stubs, so they are chained again to
+ * the new translation when it is reached.
+ *
+ * With the second tier, the entry of each block counts down how often it is
+ * entered, and leaves with JIT_HOT when the count runs out. The region
+ * entered at the block is then compiled by LLVM in the background. Once it
+ * is installed, the entry of the block and the jumps chained to it are
+ * patched to go to a stub which calls the region, so the IBTC and the
+ * dispatcher enter the region as well. The region returns to the stub,
+ * which goes on at cpu.pc through the IBTC. Once a region is requested,
+ * the blocks in it are patched the same way to skip their counters.
+ */
+
+#include <memory/paddr.h>
+#include <sys/mman.h>
+#include "jit.h"
+#include "stencil.h"
+
+#define CACHE_SIZE (CONFIG_JIT_CACHE_SIZE * 1024 * 1024)
+#ifdef CONFIG_JIT_STENCIL
+#define BLOCK_CODE_MAX (CONFIG_JIT_MAX_BLOCK_INST * (256 + jit_stencil_max_size) + 1024)
+#else
+#define BLOCK_CODE_MAX (CONFIG_JIT_MAX_BLOCK_INST * 256 + 1024)
+#endif
+#define NR_BLOCK (CACHE_SIZE / 512)
+#define HASH_SIZE 65536
+#define NR_PAGE (CONFIG_MSIZE >> JIT_PAGE_SHIFT)
+#define NR_LINE (CONFIG_MSIZE >> JIT_LINE_SHIFT)
+#define NR_EDGE (NR_BLOCK * 2)
+#define REGION_STUB_MAX 64
+#define IBTC_EMPTY 1 // never a valid pc
+
+uint8_t *x86_p = NULL;
+int64_t jit_budget = 0;
+bool jit_exit_req = false;
+bool jit_stop = false;
+uint8_t *jit_epilogue = NULL;
+uint8_t *jit_indirect = NULL;
+IBTCEntry jit_ibtc[JIT_IBTC_SIZE] = {};
+IBTCEntry jit_ras[JIT_RAS_SIZE] = {};
+uint32_t jit_ras_top = 0;
+uint8_t jit_code_line[NR_LINE + 1] = {}; // a write may pass the end by a line
+#ifdef CONFIG_JIT_TIER2
+uint32_t jit_block_count[NR_BLOCK] = {};
+#endif
+
+static uint8_t *cache = NULL;
+static uint8_t *cache_start = NULL; // after the trampolines
+static uint8_t* (*jit_enter)(uint8_t *code) = NULL;
+static Block *block_pool = NULL;
+static int nr_block = 0;
+static Edge *edge_pool = NULL;
+static int nr_edge = 0;
+static Block *hash[HASH_SIZE] = {};
+static Block *page_blocks[NR_PAGE] = {};
+static uint64_t generation = 0; // increased when the cache is flushed
+static uint64_t slice = 0;      // the budget given to jit_exec()
+
+static uint64_t nr_translate = 0, nr_flush = 0, nr_invalidate = 0, nr_chain = 0, nr_unlink = 0;
+static uint64_t nr_dispatch = 0;
+#ifdef CONFIG_JIT_TIER2
+static uint64_t nr_install = 0, nr_discard = 0;
+#endif
+
+static inline uint32_t hash_idx(vaddr_t pc) { return (pc >> 2) & (HASH_SIZE - 1); }
+static inline IBTCEntry* ibtc_entry(vaddr_t pc) { return &jit_ibtc[(pc >> 2) & (JIT_IBTC_SIZE - 1)]; }
+
+static void flush() {
+  x86_p = cache_start;
+  nr_block = 0;
+  nr_edge = 0;
+  for (int i = 0; i < JIT_IBTC_SIZE; i ++) jit_ibtc[i].pc = IBTC_EMPTY;
+  for (int i = 0; i < JIT_RAS_SIZE; i ++) jit_ras[i].pc = IBTC_EMPTY;
+  memset(hash, 0, sizeof(hash));
+  memset(page_blocks, 0, sizeof(page_blocks));
+  memset(jit_code_line, 0, sizeof(jit_code_line));
+  generation ++;
+  nr_flush ++;
+}
+
+static void init_jit() {
+  cache = mmap(NULL, CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  Assert(cache != MAP_FAILED, "Can not allocate the code cache");
+  block_pool = malloc(sizeof(Block) * NR_BLOCK);
+  edge_pool = malloc(sizeof(Edge) * NR_EDGE);
+  assert(block_pool && edge_pool);
+  // every global used by the translated code must be in reach of rbx
+  intptr_t lo = (intptr_t)jit_code_line - (intptr_t)&cpu, hi = lo + NR_LINE;
+  Assert(lo == (int32_t)lo && hi == (int32_t)hi, "jit_code_line is too far away from cpu");
+  assert(sizeof(IBTCEntry) == 16);
+  lo = (intptr_t)jit_ibtc - (intptr_t)&cpu, hi = lo + sizeof(jit_ibtc);
+  Assert(lo == (int32_t)lo && hi == (int32_t)hi, "jit_ibtc is too far away from cpu");
+  lo = (intptr_t)jit_ras - (intptr_t)&cpu, hi = lo + sizeof(jit_ras);
+  Assert(lo == (int32_t)lo && hi == (int32_t)hi, "jit_ras is too far away from cpu");
+#ifdef CONFIG_JIT_TIER2
+  lo = (intptr_t)jit_block_count - (intptr_t)&cpu, hi = lo + sizeof(jit_block_count);
+  Assert(lo == (int32_t)lo && hi == (int32_t)hi, "jit_block_count is too far away from cpu");
+#endif
+
+  x86_p = cache;
+  jit_enter = (void *)x86_p;
+  int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+  for (int i = 0; i < ARRLEN(saved); i ++) x86_push(saved[i]);
+  x86_alu_ri64(ALU_SUB, RSP, 8); // keep rsp 16-byte aligned for calls
+  x86_mov_ri64(REG_CPU, (uintptr_t)&cpu);
+  x86_mov_ri64(REG_MEM, (uintptr_t)guest_to_host(CONFIG_MBASE) - CONFIG_MBASE);
+  x86_jmp_r(RDI);
+
+  jit_epilogue = x86_p;
+  x86_alu_ri64(ALU_ADD, RSP, 8);
+  for (int i = ARRLEN(saved) - 1; i >= 0; i --) x86_pop(saved[i]);
+  x86_ret();
+
+  // continue at cpu.pc if it hits the IBTC, or return 0 to the dispatcher
+  jit_indirect = x86_p;
+  x86_cmp_mi8(REG_CPU, CPU_REL(jit_stop), 0);
+  uint8_t *stop = x86_jcc(CC_NE, x86_p);
+  x86_load(RAX, REG_CPU, offsetof(CPU_state, pc));
+  x86_mov_rr(RCX, RAX);
+  x86_shift_ri(SFT_SHR, RCX, 2);
+  x86_alu_ri(ALU_AND, RCX, JIT_IBTC_SIZE - 1);
+  x86_shift_ri(SFT_SHL, RCX, 4);
+  x86_alu_rm_idx(ALU_CMP, RAX, REG_CPU, RCX, CPU_REL(jit_ibtc));
+  uint8_t *miss = x86_jcc(CC_NE, x86_p);
+  x86_store_i8(REG_CPU, CPU_REL(jit_exit_req), 0);
+  x86_jmp_m_idx(REG_CPU, RCX, CPU_REL(jit_ibtc[0].code));
+  x86_patch(stop, x86_p);
+  x86_patch(miss, x86_p);
+  x86_alu_rr(ALU_XOR, RAX, RAX);
+  x86_jmp(jit_epilogue);
+
+  cache_start = x86_p;
+  flush();
+  nr_flush = 0;
+  Log("JIT code cache: %d MB at %p", CONFIG_JIT_CACHE_SIZE, cache);
+}
+
+// start and end of the guest code the block depends on
+static inline vaddr_t block_start(Block *b) {
+#ifdef CONFIG_JIT_TIER2
+  if (b->tier2 != NULL && b->tier2_start < b->pc) return b->tier2_start;
+#endif
+  return b->pc;
+}
+
+static inline vaddr_t block_end(Block *b) {
+  vaddr_t end = b->pc + b->ninst * 4;
+#ifdef CONFIG_JIT_TIER2
+  if (b->tier2 != NULL && b->tier2_end > end) end = b->tier2_end;
+#endif
+  return end;
+}
+
+static void mark_lines(Block *b) {
+  paddr_t lo = block_start(b) - 3, hi = block_end(b) - 1;
+  // a misaligned write right before the block also reaches it
+  if (!in_pmem(lo)) lo = block_start(b);
+  for (paddr_t l = (lo - CONFIG_MBASE) >> JIT_LINE_SHIFT; l <= (hi - CONFIG_MBASE) >> JIT_LINE_SHIFT; l ++) {
+    jit_code_line[l] = 1;
+  }
+}
+
+static Block* lookup(vaddr_t pc) {
+  for (Block *b = hash[hash_idx(pc)]; b != NULL; b = b->hash_next) {
+    if (b->pc == pc) return b;
+  }
+  return NULL;
+}
+
+Block* jit_lookup(vaddr_t pc) {
+  return lookup(pc);
+}
+
+#ifdef CONFIG_JIT_TIER2
+// patch the entry of a block and the jumps chained to it to go to `target'
+static void redirect(Block *b, uint8_t *target) {
+  uint8_t *save = x86_p;
+  x86_p = b->code;
+  x86_jmp(target);
+  x86_p = save;
+  b->chain_to = target;
+  for (Edge *e = b->chain_in; e != NULL; e = e->next) x86_patch(e->patch, target);
+}
+
+// stop counting the entries of a block, unless its region is installed
+void jit_skip_counter(Block *b) {
+  if (b->tier2 == NULL) redirect(b, b->checks);
+}
+
+// whether the block is in the range of a region requested by another block in its page
+static bool in_region(Block *b, uint32_t page) {
+  for (Block *p = page_blocks[page]; p != NULL; p = p->page_next) {
+    if (p->tier2_start <= b->pc && b->pc < p->tier2_end) return true;
+  }
+  return false;
+}
+#endif
+
+static Block* translate(vaddr_t pc) {
+  if (!in_pmem(pc) || (pc & 3)) return NULL;
+  if (nr_block == NR_BLOCK || x86_p + BLOCK_CODE_MAX > cache + CACHE_SIZE) flush();
+
+  Block *b = &block_pool[nr_block];
+  uint8_t *start = x86_p;
+  b->pc = pc;
+  b->chain_in = NULL;
+#ifdef CONFIG_JIT_TIER2
+  b->id = nr_block;
+  b->tier2 = NULL;
+  jit_block_count[b->id] = CONFIG_JIT_TIER2_THRESHOLD;
+#endif
+  if (!jit_translate(b)) { x86_p = start; return NULL; }
+#ifdef CONFIG_JIT_TIER2
+  b->tier2_start = b->tier2_end = pc;
+  b->chain_to = b->code;
+#endif
+  assert(x86_p <= start + BLOCK_CODE_MAX);
+  nr_block ++;
+  nr_translate ++;
+
+  uint32_t idx = hash_idx(pc);
+  b->hash_next = hash[idx];
+  hash[idx] = b;
+  uint32_t page = (pc - CONFIG_MBASE) >> JIT_PAGE_SHIFT;
+  IFDEF(CONFIG_JIT_TIER2, if (in_region(b, page)) jit_skip_counter(b));
+  b->page_next = page_blocks[page];
+  page_blocks[page] = b;
+  mark_lines(b);
+  return b;
+}
+
+static void chain(uint8_t *patch, Block *next) {
+  if (nr_edge == NR_EDGE) return;
+  Edge *e = &edge_pool[nr_edge ++];
+  e->patch = patch;
+  e->next = next->chain_in;
+  next->chain_in = e;
+  x86_patch(patch, MUXDEF(CONFIG_JIT_TIER2, next->chain_to, next->code));
+  nr_chain ++;
+}
+
+/* Stop entering the translated code of a block. Its entry leaves to the
+ * dispatcher, and the jumps chained to it go back to their exit stubs,
+ * which are right after them.
+ */
+static void kill_entry(Block *b) {
+  uint8_t *save = x86_p;
+  x86_p = b->code;
+  x86_jmp(b->dead_exit);
+  x86_p = save;
+  for (Edge *e = b->chain_in; e != NULL; e = e->next) {
+    x86_patch(e->patch, e->patch + 4);
+    nr_unlink ++;
+  }
+  b->chain_in = NULL;
+  IBTCEntry *t = ibtc_entry(b->pc);
+  if (t->code == b->code) t->pc = IBTC_EMPTY;
+}
+
+static void remove_block(Block *b) {
+  Block **pp;
+  for (pp = &hash[hash_idx(b->pc)]; *pp != b; pp = &(*pp)->hash_next) ;
+  *pp = b->hash_next;
+  kill_entry(b);
+}
+
+static void invalidate_page(uint32_t page, paddr_t lo, paddr_t hi) {
+  bool changed = false;
+  for (Block **pp = &page_blocks[page]; *pp != NULL; ) {
+    Block *b = *pp;
+    if (block_start(b) <= hi && lo < block_end(b)) {
+      remove_block(b);
+      *pp = b->page_next;
+      changed = true;
+      nr_invalidate ++;
+    } else {
+      pp = &b->page_next;
+    }
+  }
+  if (!changed) return;
+
+  // the lines of the page are marked again by the remaining blocks
+  uint32_t first = page << (JIT_PAGE_SHIFT - JIT_LINE_SHIFT);
+  memset(&jit_code_line[first], 0, 1 << (JIT_PAGE_SHIFT - JIT_LINE_SHIFT));
+  for (Block *b = page_blocks[page]; b != NULL; b = b->page_next) mark_lines(b);
+  // the running block may have been changed
+  jit_exit_req = true;
+}
+
+// invalidate the blocks overlapping [addr, addr + len), in every page of the range
+void jit_invalidate(paddr_t addr, size_t len) {
+  paddr_t hi = (len > PMEM_RIGHT - addr ? PMEM_RIGHT : addr + len - 1);
+  uint32_t p0 = (addr - CONFIG_MBASE) >> JIT_PAGE_SHIFT;
+  uint32_t p1 = (hi - CONFIG_MBASE) >> JIT_PAGE_SHIFT;
+  for (uint32_t p = p0; p <= p1; p ++) invalidate_page(p, addr, hi);
+}
+
+#ifdef CONFIG_JIT_TIER2
+/* The stub entering the region of a block. With an interrupt pending or
+ * less budget than the longest segment of a region, it goes on with the
+ * checks of the block instead, so the block runs or leaves to the
+ * dispatcher, and the region is never entered without running anything.
+ */
+static uint8_t* emit_region_stub(Block *b) {
+  uint8_t *stub = x86_p;
+  x86_alu_mi(ALU_CMP, REG_CPU, offsetof(CPU_state, intr), 0);
+  x86_jcc(CC_NE, b->checks);
+  x86_alu_mi64(ALU_CMP, REG_CPU, CPU_REL(jit_budget), CONFIG_JIT_MAX_BLOCK_INST);
+  x86_jcc(CC_L, b->checks);
+  x86_mov_ri64(RAX, (uintptr_t)b->tier2);
+  x86_call_r(RAX);
+  x86_jmp(jit_indirect);
+  return stub;
+}
+
+/* Install the compiled regions whose block is still there, and whose guest
+ * code is the same as when they were requested. The stubs are appended to
+ * the code cache, a region is dropped if there is no room left.
+ */
+static void install_regions() {
+  T2Job *list = tier2_done();
+  while (list != NULL) {
+    T2Job *job = list;
+    list = job->next;
+    Block *b = job->block;
+    bool ok = job->code != NULL && job->generation == generation && lookup(b->pc) == b &&
+      x86_p + REGION_STUB_MAX <= cache + CACHE_SIZE;
+    for (int i = 0; ok && i < job->ninst; i ++) {
+      ok = paddr_read(job->insts[i].pc, 4) == job->insts[i].inst;
+    }
+    if (ok) {
+      b->tier2 = job->code;
+      redirect(b, emit_region_stub(b));
+      mark_lines(b);
+      nr_install ++;
+    } else {
+      nr_discard ++;
+    }
+    free(job);
+  }
+}
+#endif
+
+/* The translated code takes guest addresses as physical ones, so it only
+ * runs in direct address translation mode.
+ */
+bool jit_runnable() {
+  return !cpu.pg;
+}
+
+/* Run at most `n' instructions in the code cache, return the number of
+ * instructions executed. Fewer than `n' instructions are executed when the
+ * next block can not be translated or does not fit in the budget, or an
+ * interrupt is pending, or the code cache is not runnable. The caller
+ * should run the next instruction with the interpreter then.
+ */
+uint64_t jit_exec(uint64_t n) {
+  if (cache == NULL) init_jit();
+  slice = jit_budget = n;
+  jit_stop = false;
+  while (nemu_state.state == NEMU_RUNNING && !jit_stop && isa_query_intr() == INTR_EMPTY && jit_runnable()) {
+    Block *b = lookup(cpu.pc);
+    if (b == NULL) b = translate(cpu.pc);
+    if (b == NULL || jit_budget < b->ninst) break;
+
+    uint64_t gen = generation;
+    jit_exit_req = false;
+    nr_dispatch ++;
+    IFDEF(CONFIG_JIT_TIER2, install_regions());
+    IBTCEntry *t = ibtc_entry(b->pc);
+    t->pc = b->pc;
+    t->code = b->code;
+    uint8_t *patch = jit_enter(b->code);
+#ifdef CONFIG_JIT_TIER2
+    if (patch == JIT_HOT) { tier2_request(b, gen); continue; }
+#endif
+    if (patch == NULL || nemu_state.state != NEMU_RUNNING) continue;
+
+    // chain the exit just taken to its successor
+    Block *next = lookup(cpu.pc);
+    if (next == NULL) next = translate(cpu.pc);
+    if (next != NULL && gen == generation) {
+      chain(patch, next);
+    }
+  }
+  uint64_t k = slice - jit_budget;
+  slice = jit_budget = 0;
+  return k;
+}
+
+/* The instructions run by jit_exec() so far. A block takes the budget of
+ * all its instructions when entered, and gives back what it has not run
+ * around the helpers, so this is exact when they are running.
+ */
+uint64_t jit_inflight() {
+  return slice - jit_budget;
+}
+
+// leave the code cache after the running instruction
+void jit_leave() {
+  jit_exit_req = jit_stop = true;
+}
+
+/* Leave the code cache at the next block, and let the running one finish.
+ * This may be called by a load, which can not leave in the middle of a block
+ * since its result is written after the helper returns.
+ */
+void jit_yield() {
+  slice -= jit_budget;
+  jit_budget = 0;
+}
+
+void jit_statistic() {
+  Log("JIT: %" PRIu64 " blocks translated, %" PRIu64 " chained, %" PRIu64 " unlinked, "
+      "%" PRIu64 " invalidated, %" PRIu64 " flushes, %" PRIu64 " dispatched",
+      nr_translate, nr_chain, nr_unlink, nr_invalidate, nr_flush, nr_dispatch);
+  jit_fuse_statistic();
+  IFDEF(CONFIG_JIT_STENCIL, jit_stencil_statistic());
+#ifdef CONFIG_JIT_TIER2
+  Log("JIT tier 2: %" PRIu64 " regions installed, %" PRIu64 " discarded", nr_install, nr_discard);
+  tier2_statistic();
+#endif
+}
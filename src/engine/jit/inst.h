@@ -0,0 +1,84 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __JIT_INST_H__
+#define __JIT_INST_H__
+
+/* Guest instructions decoded for the translators. This is also included by
+ * the C++ code of the second tier, so it only uses plain C types.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum {
+  OP_PCADDU12I, // rd = pc + imm
+  OP_LU12I,     // rd = imm
+  OP_ALU,       // rd = rj `fn' rk
+  OP_ALUI,      // rd = rj `fn' imm
+  OP_LOAD,      // rd = M[rj + imm], `len' bytes, sign extended if `sext'
+  OP_STORE,     // M[rj + imm] = rd, `len' bytes
+  OP_BRANCH,    // if (rj `fn' rd) goto pc + imm
+  OP_JUMP,      // rd = pc + 4 unless rd is 0, goto pc + imm
+  OP_JIRL,      // rd = pc + 4, goto rj + imm
+  OP_INTERP,    // run by the interpreter
+};
+
+enum {
+  FN_ADD, FN_SUB, FN_AND, FN_OR, FN_XOR, FN_NOR,
+  FN_SLT, FN_SLTU, FN_SLL, FN_SRL, FN_SRA, FN_MUL,
+  // conditions of branches, in the order of their opcodes
+  FN_EQ, FN_NE, FN_LT, FN_GE, FN_LTU, FN_GEU,
+};
+
+// idioms of two instructions translated as one
+enum {
+  FUSE_NONE,
+  FUSE_PCREL_LOAD,  // pcaddu12i rd + load with rj == rd
+  FUSE_PCREL_STORE, // pcaddu12i rd + store with rj == rd
+  FUSE_CONST,       // lu12i.w/pcaddu12i rd + an immediate operation with rj == rd
+  FUSE_CMP_BRANCH,  // slt[u][i] rd + beq/bne comparing rd with $zero
+  NR_FUSE,
+};
+
+typedef struct {
+  uint32_t pc;
+  uint32_t inst;
+  int op, fn;
+  int rd, rj, rk;
+  uint32_t imm;
+  int len;
+  bool sext;
+  int fuse;     // FUSE_*, set on the second instruction of a fused pair
+  uint32_t base; // the value of rj known from the first one
+} Inst;
+
+static inline bool inst_is_jump(const Inst *in) {
+  return in->op == OP_BRANCH || in->op == OP_JUMP || in->op == OP_JIRL;
+}
+
+// the guest registers used by an instruction translated natively, return their number
+static inline int inst_regs(const Inst *in, int *regs) {
+  int n = 0;
+  switch (in->op) {
+    case OP_ALU: regs[n ++] = in->rk; // fall through
+    case OP_ALUI: case OP_LOAD: case OP_STORE: case OP_BRANCH: case OP_JIRL:
+      regs[n ++] = in->rj; // fall through
+    case OP_PCADDU12I: case OP_LU12I: case OP_JUMP: regs[n ++] = in->rd; break;
+  }
+  return n;
+}
+
+#endif
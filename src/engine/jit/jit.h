@@ -0,0 +1,120 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <isa.h>
+#include <stddef.h>
+#include "x86.h"
+#include "inst.h"
+
+/* Register usage of the translated code:
+ *   rbx      &cpu, other globals are addressed relative to it
+ *   rbp      host address of guest physical address 0
+ *   r12-r15  guest registers allocated for the running block
+ *   others   scratch, clobbered by calls to helpers
+ */
+#define REG_CPU  RBX
+#define REG_MEM  RBP
+
+// displacement of a global relative to `cpu'
+#define CPU_REL(x) ((int32_t)((intptr_t)&(x) - (intptr_t)&cpu))
+
+#define JIT_PAGE_SHIFT 12
+#define JIT_LINE_SHIFT 6
+
+typedef struct Edge {
+  uint8_t *patch;     // the rel32 of a jump chained to a block
+  struct Edge *next;
+} Edge;
+
+typedef struct Block {
+  vaddr_t pc;
+  int ninst;
+  uint8_t *code;      // entry, checks and takes the budget
+  uint8_t *dead_exit; // the entry is patched to jump here once invalidated
+  Edge *chain_in;     // the jumps chained to the entry
+  struct Block *hash_next, *page_next;
+#ifdef CONFIG_JIT_TIER2
+  int id;             // index of the entry counter
+  uint8_t *checks;    // the entry after the counter
+  uint8_t *chain_to;  // where the jumps chained to the block go
+  void (*tier2)();    // the region compiled by LLVM, entered instead of `code'
+  vaddr_t tier2_start, tier2_end; // the guest code of the region, once requested
+#endif
+} Block;
+
+// returned by the entry of a hot block, with cpu.pc set to the block
+#define JIT_HOT ((uint8_t *)1)
+
+// indirect branch target cache, looked up by dynamic exits
+#define JIT_IBTC_SIZE 1024
+typedef struct {
+  vaddr_t pc;
+  uint8_t *code;
+} IBTCEntry;
+
+/* return address stack, a call pushes the IBTC entry of its return
+ * address, and a return jumps to the popped one if it is for its target
+ */
+#define JIT_RAS_SIZE 16
+
+extern int64_t jit_budget;    // guest instructions which may still run
+extern bool jit_exit_req;     // set by helpers to leave the running block
+extern bool jit_stop;         // set with jit_exit_req to leave the code cache
+extern uint8_t *jit_epilogue; // returns to jit_exec() with rax as the value
+extern uint8_t *jit_indirect; // continues at cpu.pc if it is in the IBTC
+extern IBTCEntry jit_ibtc[];
+extern IBTCEntry jit_ras[];
+extern uint32_t jit_ras_top; // byte offset of the top entry
+extern uint8_t jit_code_line[]; // whether a line of pmem holds translated code
+extern uint32_t jit_block_count[]; // entries left before a block gets hot
+
+// helpers called by the translated code
+word_t jit_helper_load(vaddr_t addr, int len, bool sext);
+void jit_helper_store(vaddr_t addr, word_t data, int len);
+void jit_helper_interp();
+void jit_check_stop();
+bool jit_runnable();
+
+// the translated block at `pc', or NULL
+Block* jit_lookup(vaddr_t pc);
+// translate the block at b->pc to x86_p, return false if nothing is translated
+bool jit_translate(Block *b);
+void jit_decode(Inst *in, vaddr_t pc, uint32_t inst);
+void jit_fuse_statistic();
+void jit_invalidate(paddr_t addr, size_t len);
+// copy the stencil of an instruction to x86_p, return false if there is none
+bool jit_emit_stencil(uint32_t inst, vaddr_t pc);
+void jit_stencil_statistic();
+
+#ifdef CONFIG_JIT_TIER2
+typedef struct T2Job {
+  Block *block;
+  uint64_t generation;  // of the code cache when requested
+  int ninst, entry;      // insts[entry] is the block
+  Inst insts[CONFIG_JIT_TIER2_MAX_INST];
+  void (*code)();       // NULL if the region can not be compiled
+  struct T2Job *next;
+} T2Job;
+
+void jit_skip_counter(Block *b);
+void tier2_request(Block *b, uint64_t generation);
+T2Job* tier2_done();
+void tier2_statistic();
+#endif
+
+#endif
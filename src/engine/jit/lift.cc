@@ -0,0 +1,414 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Lift a region of guest instructions to LLVM IR and compile it with ORC.
+ * The region may have loops, and leaves it at branches to the code outside.
+ * The semantics follow the first tier: guest registers live in allocas,
+ * which are promoted to SSA values and written back at exits and around
+ * calls to the interpreter. The budget is charged at the first instruction
+ * of every segment, and the rest of the segment is refunded at early exits.
+ * Loads and stores to pmem are inline, with the same helpers as slow paths.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/TargetSelect.h"
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#include <map>
+#include <vector>
+#include <string>
+#include "tier2.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+static std::unique_ptr<LLJIT> jit;
+static T2Env env;
+static int nr_region = 0;
+
+namespace {
+
+class Lifter {
+  LLVMContext &C;
+  IRBuilder<> B;
+  Function *F;
+  const Inst *insts;
+  int n, entry;
+  std::map<uint32_t, int> idx;   // pc -> index in insts
+  std::vector<BasicBlock *> bb;
+  std::vector<int> refund;       // budget refunded when leaving after an instruction
+  AllocaInst *gpr[32] = {};      // NULL if the register is not used natively
+
+  Type *i8() { return B.getInt8Ty(); }
+  Type *i32() { return B.getInt32Ty(); }
+  Type *i64() { return B.getInt64Ty(); }
+
+  MDNode *likely() { return MDBuilder(C).createBranchWeights(1000, 1); }
+
+  Value *ptr(uintptr_t addr, Type *ty) {
+    return B.CreateIntToPtr(B.getInt64(addr), ty->getPointerTo());
+  }
+
+  Value *get(int r) {
+    if (r == 0) return B.getInt32(0);
+    return B.CreateLoad(i32(), gpr[r]);
+  }
+
+  void set(int r, Value *v) {
+    if (r != 0) B.CreateStore(v, gpr[r]);
+  }
+
+  void writeback() {
+    for (int r = 1; r < 32; r ++) {
+      if (gpr[r]) B.CreateStore(B.CreateLoad(i32(), gpr[r]), ptr(env.gpr + r * 4, i32()));
+    }
+  }
+
+  void reload() {
+    for (int r = 1; r < 32; r ++) {
+      if (gpr[r]) B.CreateStore(B.CreateLoad(i32(), ptr(env.gpr + r * 4, i32())), gpr[r]);
+    }
+  }
+
+  void set_pc(uint32_t pc) { B.CreateStore(B.getInt32(pc), ptr(env.pc, i32())); }
+
+  Value *call(uintptr_t fn, Type *ret, ArrayRef<Value *> args) {
+    std::vector<Type *> types(args.size(), i32());
+    FunctionType *ft = FunctionType::get(ret, types, false);
+    return B.CreateCall(ft, B.CreateIntToPtr(B.getInt64(fn), ft->getPointerTo()), args);
+  }
+
+  // leave with nothing of the current segment executed
+  void exit_to(uint32_t pc) {
+    writeback();
+    set_pc(pc);
+    B.CreateRetVoid();
+  }
+
+  // leave with cpu.pc already set
+  void exit_dynamic(int refund) {
+    writeback();
+    if (refund > 0) refund_budget(refund);
+    B.CreateRetVoid();
+  }
+
+  // leave if a helper asks to, after the instruction `i'
+  void check_exit(int i) {
+    BasicBlock *out = BasicBlock::Create(C, "exit", F);
+    BasicBlock *cont = BasicBlock::Create(C, "cont", F);
+    Value *req = B.CreateLoad(i8(), ptr(env.exit_req, i8()));
+    B.CreateCondBr(B.CreateICmpNE(req, B.getInt8(0)), out, cont);
+    B.SetInsertPoint(out);
+    exit_dynamic(refund[i]);
+    B.SetInsertPoint(cont);
+  }
+
+  // take the budget of the segment started by the instruction `i', or leave
+  // if an interrupt is pending, which may be raised by a signal handler
+  void charge(int i, int len) {
+    BasicBlock *out = BasicBlock::Create(C, "no_budget", F);
+    BasicBlock *cont = BasicBlock::Create(C, "cont", F);
+    Value *p = ptr(env.budget, i64());
+    Value *budget = B.CreateLoad(i64(), p);
+    Value *intr = B.CreateLoad(i32(), ptr(env.intr, i32()), true);
+    Value *stop = B.CreateOr(B.CreateICmpSLT(budget, B.getInt64(len)), B.CreateICmpNE(intr, B.getInt32(0)));
+    B.CreateCondBr(stop, out, cont);
+    B.SetInsertPoint(out);
+    exit_to(insts[i].pc);
+    B.SetInsertPoint(cont);
+    B.CreateStore(B.CreateSub(budget, B.getInt64(len)), p);
+  }
+
+  Value *host_addr(Value *addr, int len) {
+    Value *base = B.CreateIntToPtr(B.getInt64(env.mem), i8()->getPointerTo());
+    Value *p = B.CreateGEP(i8(), base, B.CreateZExt(addr, i64()));
+    return B.CreateBitCast(p, B.getIntNTy(len * 8)->getPointerTo());
+  }
+
+  // whether the access is in pmem and aligned, a misaligned one raises ALE in the helper
+  Value *fast_access(Value *addr, int len) {
+    Value *off = B.CreateSub(addr, B.getInt32(env.mbase));
+    Value *ok = B.CreateICmpULE(off, B.getInt32(env.msize - len));
+    if (len == 1) return ok;
+    Value *aligned = B.CreateICmpEQ(B.CreateAnd(addr, B.getInt32(len - 1)), B.getInt32(0));
+    return B.CreateAnd(ok, aligned);
+  }
+
+  void lift_load(int i) {
+    const Inst *in = &insts[i];
+    Value *addr = B.CreateAdd(get(in->rj), B.getInt32(in->imm));
+    BasicBlock *fast = BasicBlock::Create(C, "load_fast", F);
+    BasicBlock *slow = BasicBlock::Create(C, "load_slow", F);
+    BasicBlock *join = BasicBlock::Create(C, "load_join", F);
+    B.CreateCondBr(fast_access(addr, in->len), fast, slow, likely());
+
+    B.SetInsertPoint(fast);
+    Value *v = B.CreateAlignedLoad(B.getIntNTy(in->len * 8), host_addr(addr, in->len), MaybeAlign(1));
+    v = in->sext ? B.CreateSExt(v, i32()) : B.CreateZExt(v, i32());
+    BasicBlock *fast_end = B.GetInsertBlock();
+    B.CreateBr(join);
+
+    // the timer compares the registers around its reads to detect polling
+    B.SetInsertPoint(slow);
+    set_pc(in->pc);
+    writeback();
+    Value *w = call(env.helper_load, i32(), { addr, B.getInt32(in->len), B.getInt32(in->sext) });
+    check_exit(i);
+    BasicBlock *slow_end = B.GetInsertBlock();
+    B.CreateBr(join);
+
+    B.SetInsertPoint(join);
+    PHINode *phi = B.CreatePHI(i32(), 2);
+    phi->addIncoming(v, fast_end);
+    phi->addIncoming(w, slow_end);
+    set(in->rd, phi);
+  }
+
+  void lift_store(int i) {
+    const Inst *in = &insts[i];
+    Value *addr = B.CreateAdd(get(in->rj), B.getInt32(in->imm));
+    Value *data = get(in->rd);
+    BasicBlock *line = BasicBlock::Create(C, "store_line", F);
+    BasicBlock *fast = BasicBlock::Create(C, "store_fast", F);
+    BasicBlock *slow = BasicBlock::Create(C, "store_slow", F);
+    BasicBlock *join = BasicBlock::Create(C, "store_join", F);
+    B.CreateCondBr(fast_access(addr, in->len), line, slow, likely());
+
+    // writes to lines with translated code go to the helper
+    B.SetInsertPoint(line);
+    Value *l = B.CreateLShr(B.CreateSub(addr, B.getInt32(env.mbase)), env.line_shift);
+    Value *lp = B.CreateGEP(i8(), B.CreateIntToPtr(B.getInt64(env.code_line), i8()->getPointerTo()),
+        B.CreateZExt(l, i64()));
+    Value *code = B.CreateLoad(i8(), lp);
+    B.CreateCondBr(B.CreateICmpEQ(code, B.getInt8(0)), fast, slow, likely());
+
+    B.SetInsertPoint(fast);
+    B.CreateAlignedStore(B.CreateTrunc(data, B.getIntNTy(in->len * 8)), host_addr(addr, in->len), MaybeAlign(1));
+    B.CreateBr(join);
+
+    B.SetInsertPoint(slow);
+    set_pc(in->pc);
+    call(env.helper_store, B.getVoidTy(), { addr, data, B.getInt32(in->len) });
+    check_exit(i);
+    B.CreateBr(join);
+
+    B.SetInsertPoint(join);
+  }
+
+  // add `n' to the budget
+  void refund_budget(int64_t n) {
+    Value *budget = ptr(env.budget, i64());
+    B.CreateStore(B.CreateAdd(B.CreateLoad(i64(), budget), B.getInt64(n)), budget);
+  }
+
+  void lift_interp(int i) {
+    writeback();
+    set_pc(insts[i].pc);
+    // the instructions of the segment not run yet are not counted by the helper
+    refund_budget(refund[i] + 1);
+    call(env.helper_interp, B.getVoidTy(), {});
+    refund_budget(-(refund[i] + 1));
+    reload();
+    check_exit(i);
+  }
+
+  Value *compute(int fn, Value *a, Value *b) {
+    switch (fn) {
+      case FN_ADD: return B.CreateAdd(a, b);
+      case FN_SUB: return B.CreateSub(a, b);
+      case FN_AND: return B.CreateAnd(a, b);
+      case FN_OR:  return B.CreateOr(a, b);
+      case FN_XOR: return B.CreateXor(a, b);
+      case FN_NOR: return B.CreateNot(B.CreateOr(a, b));
+      case FN_SLT: return B.CreateZExt(B.CreateICmpSLT(a, b), i32());
+      case FN_SLTU: return B.CreateZExt(B.CreateICmpULT(a, b), i32());
+      case FN_SLL: return B.CreateShl(a, B.CreateAnd(b, 0x1f));
+      case FN_SRL: return B.CreateLShr(a, B.CreateAnd(b, 0x1f));
+      case FN_SRA: return B.CreateAShr(a, B.CreateAnd(b, 0x1f));
+      case FN_MUL: return B.CreateMul(a, b);
+      case FN_EQ:  return B.CreateICmpEQ(a, b);
+      case FN_NE:  return B.CreateICmpNE(a, b);
+      case FN_LT:  return B.CreateICmpSLT(a, b);
+      case FN_GE:  return B.CreateICmpSGE(a, b);
+      case FN_LTU: return B.CreateICmpULT(a, b);
+      default:     return B.CreateICmpUGE(a, b);
+    }
+  }
+
+  // a new block leaving at the instruction `i' jumping to itself, see cpu_spin()
+  BasicBlock *spin(int i) {
+    BasicBlock *out = BasicBlock::Create(C, "spin", F);
+    BasicBlock *save = B.GetInsertBlock();
+    B.SetInsertPoint(out);
+    set_pc(insts[i].pc);
+    call(env.helper_spin, B.getVoidTy(), {});
+    exit_dynamic(refund[i]);
+    B.SetInsertPoint(save);
+    return out;
+  }
+
+  // the block of the instruction at `pc', or a new block leaving the region to it
+  BasicBlock *target(uint32_t pc) {
+    auto it = idx.find(pc);
+    if (it != idx.end()) return bb[it->second];
+    BasicBlock *out = BasicBlock::Create(C, "out", F);
+    BasicBlock *save = B.GetInsertBlock();
+    B.SetInsertPoint(out);
+    exit_to(pc);
+    B.SetInsertPoint(save);
+    return out;
+  }
+
+  void lift(int i) {
+    const Inst *in = &insts[i];
+    switch (in->op) {
+      case OP_PCADDU12I: set(in->rd, B.getInt32(in->pc + in->imm)); break;
+      case OP_LU12I: set(in->rd, B.getInt32(in->imm)); break;
+      case OP_ALU:  set(in->rd, compute(in->fn, get(in->rj), get(in->rk))); break;
+      case OP_ALUI: set(in->rd, compute(in->fn, get(in->rj), B.getInt32(in->imm))); break;
+      case OP_LOAD:  lift_load(i); break;
+      case OP_STORE: lift_store(i); break;
+      case OP_BRANCH: {
+        Value *cond = compute(in->fn, get(in->rj), get(in->rd));
+        B.CreateCondBr(cond, in->imm == 0 ? spin(i) : target(in->pc + in->imm), target(in->pc + 4));
+        return;
+      }
+      case OP_JUMP:
+        set(in->rd, B.getInt32(in->pc + 4));
+        B.CreateBr(in->imm == 0 ? spin(i) : target(in->pc + in->imm));
+        return;
+      case OP_JIRL: {
+        Value *next = B.CreateAdd(get(in->rj), B.getInt32(in->imm));
+        set(in->rd, B.getInt32(in->pc + 4));
+        B.CreateStore(next, ptr(env.pc, i32()));
+        exit_dynamic(refund[i]);
+        return;
+      }
+      default: lift_interp(i); break;
+    }
+    // fall through to the next instruction
+    B.CreateBr(target(in->pc + 4));
+  }
+
+public:
+  Lifter(LLVMContext &C, Function *F, const Inst *insts, int n, int entry)
+    : C(C), B(C), F(F), insts(insts), n(n), entry(entry) {}
+
+  void run() {
+    for (int i = 0; i < n; i ++) idx[insts[i].pc] = i;
+
+    // split the region to segments, each ends where control may come from elsewhere
+    std::vector<bool> target(n, false);
+    target[entry] = true;
+    for (int i = 0; i < n; i ++) {
+      auto it = idx.find(insts[i].pc + insts[i].imm);
+      if ((insts[i].op == OP_BRANCH || insts[i].op == OP_JUMP) && it != idx.end()) target[it->second] = true;
+    }
+    std::vector<int> seg(n, 0);
+    refund.assign(n, 0);
+    for (int i = 0, start = 0; i < n; i ++) {
+      bool leader = (i == 0 || target[i] || insts[i].pc - 4 != insts[i - 1].pc ||
+          inst_is_jump(&insts[i - 1]) || i - start == env.max_seg);
+      if (leader) start = i;
+      seg[start] ++;
+      for (int k = start; k <= i; k ++) refund[k] = seg[start] - (k - start + 1);
+    }
+
+    BasicBlock *head = BasicBlock::Create(C, "entry", F);
+    for (int i = 0; i < n; i ++) bb.push_back(BasicBlock::Create(C, "inst", F));
+
+    B.SetInsertPoint(head);
+    for (int i = 0; i < n; i ++) {
+      int regs[3];
+      int nr = inst_regs(&insts[i], regs);
+      for (int k = 0; k < nr; k ++) {
+        int r = regs[k];
+        if (r != 0 && gpr[r] == NULL) gpr[r] = B.CreateAlloca(i32());
+      }
+    }
+    reload();
+    B.CreateBr(bb[entry]);
+
+    for (int i = 0; i < n; i ++) {
+      B.SetInsertPoint(bb[i]);
+      if (seg[i] > 0) charge(i, seg[i]);
+      lift(i);
+    }
+  }
+};
+
+} // namespace
+
+extern "C" bool tier2_init_llvm(const T2Env *e) {
+  env = *e;
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  auto j = LLJITBuilder().create();
+  if (!j) {
+    consumeError(j.takeError());
+    return false;
+  }
+  jit = std::move(*j);
+  return true;
+}
+
+extern "C" T2Code tier2_compile(const Inst *insts, int n, int entry) {
+  auto ctx = std::make_unique<LLVMContext>();
+  auto mod = std::make_unique<Module>("region", *ctx);
+  mod->setDataLayout(jit->getDataLayout());
+  mod->setTargetTriple(jit->getTargetTriple().str());
+
+  std::string name = "region" + std::to_string(nr_region ++);
+  FunctionType *ft = FunctionType::get(Type::getVoidTy(*ctx), false);
+  Function *f = Function::Create(ft, Function::ExternalLinkage, name, mod.get());
+  f->addFnAttr(Attribute::NoUnwind);
+  Lifter(*ctx, f, insts, n, entry).run();
+  if (verifyFunction(*f, &errs())) return NULL;
+
+  LoopAnalysisManager lam;
+  FunctionAnalysisManager fam;
+  CGSCCAnalysisManager cgam;
+  ModuleAnalysisManager mam;
+  PassBuilder pb;
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+  pb.buildPerModuleDefaultPipeline(OptimizationLevel::O2).run(*mod, mam);
+
+  if (auto err = jit->addIRModule(ThreadSafeModule(std::move(mod), std::move(ctx)))) {
+    consumeError(std::move(err));
+    return NULL;
+  }
+  auto sym = jit->lookup(name);
+  if (!sym) {
+    consumeError(sym.takeError());
+    return NULL;
+  }
+  return (T2Code)sym->getAddress();
+}
@@ -0,0 +1,50 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "jit.h"
+#include "stencil.h"
+
+int isa_instpat_idx(uint32_t inst);
+
+static uint64_t nr_copy = 0;
+
+/* A stencil is compiled as a function, so its copy is called in line and
+ * returns to a jump over it:
+ *     call 1f; jmp 2f; 1: <stencil>; 2:
+ * Return false if the instruction has no usable stencil.
+ */
+bool jit_emit_stencil(uint32_t inst, vaddr_t pc) {
+  int k = isa_instpat_idx(inst);
+  if (k < 0 || k >= jit_nr_stencil || jit_stencils[k].code == NULL) return false;
+  const Stencil *st = &jit_stencils[k];
+  x86_call(x86_p + 10);
+  uint8_t *skip = x86_jmp(x86_p);
+  uint8_t *code = x86_p;
+  memcpy(code, st->code, st->size);
+  for (const StencilReloc *r = st->reloc; r->offset != 0; r ++) {
+    uint64_t v = (r->hole == HOLE_PC ? pc : r->hole == HOLE_INST ? inst : r->value) + r->addend;
+    memcpy(code + r->offset, &v, 8);
+  }
+  x86_p += st->size;
+  x86_patch(skip, x86_p);
+  nr_copy ++;
+  return true;
+}
+
+void jit_stencil_statistic() {
+  int usable = 0;
+  for (int k = 0; k < jit_nr_stencil; k ++) usable += (jit_stencils[k].code != NULL);
+  Log("JIT stencils: %d of %d usable, %" PRIu64 " copied", usable, jit_nr_stencil, nr_copy);
+}
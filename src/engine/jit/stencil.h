@@ -0,0 +1,74 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __JIT_STENCIL_H__
+#define __JIT_STENCIL_H__
+
+/* Copy-and-patch stencils. The instruction list of the guest ISA is
+ * compiled once more with __STENCIL__ defined, where every entry becomes a
+ * function running its body for the instruction word and pc in the holes
+ * _JIT_INST and _JIT_PC. tools/gen-stencil extracts their machine code and
+ * relocations into the tables below.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum { HOLE_PC, HOLE_INST };
+
+typedef struct {
+  uint32_t offset;   // in the code, of a 64-bit absolute address
+  int hole;          // HOLE_*, or -1 for `value'
+  uintptr_t value;
+  int64_t addend;
+} StencilReloc;      // terminated by offset 0
+
+typedef struct {
+  const uint8_t *code; // NULL if the stencil can not be used
+  int size;
+  const StencilReloc *reloc;
+} Stencil;
+
+extern const Stencil jit_stencils[];
+extern const int jit_nr_stencil, jit_stencil_max_size;
+
+#ifdef __STENCIL__
+extern char _JIT_PC[], _JIT_INST[];
+extern bool jit_exit_req;
+void jit_check_stop();
+void cpu_spin();
+
+/* The body sees the same variables as in decode_exec(). A stencil is called
+ * with the registers written back, and leaves the block if the control flow
+ * is changed. STENCIL_END(s) is provided by the ISA.
+ */
+#define STENCIL(pattern, name, type, ... /* execute body */ ) \
+  void concat(stencil_, __COUNTER__)() { \
+    Decode __s = { .pc = (uintptr_t)_JIT_PC, .isa.inst.val = (uintptr_t)_JIT_INST }, *s = &__s; \
+    s->snpc = s->pc + 4; \
+    s->dnpc = s->snpc; \
+    int rd = 0; \
+    word_t src1 = 0, src2 = 0, imm = 0; \
+    decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+    __VA_ARGS__ ; \
+    STENCIL_END(s); \
+    cpu.pc = s->dnpc; \
+    if (s->dnpc != s->snpc) jit_exit_req = true; \
+    if (s->dnpc == s->pc) cpu_spin(); \
+    jit_check_stop(); \
+  }
+#endif
+
+#endif
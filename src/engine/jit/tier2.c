@@ -0,0 +1,192 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The second tier. A hot block requests the region of guest code entered
+ * at it to be compiled by LLVM. The region is decoded on the main thread,
+ * and LLVM is initialized and the region compiled on a background thread,
+ * so the guest keeps running in the first tier meanwhile. When the host
+ * has no spare core, the thread waits until the guest has run long enough
+ * for LLVM to pay off. Finished regions are handed back through a list
+ * which the dispatcher polls, and installed on the main thread.
+ */
+
+#include <unistd.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <pthread.h>
+#include "jit.h"
+#include "tier2.h"
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static T2Job *todo = NULL, *done = NULL; // protected by `lock'
+static int nr_done = 0;                  // read by the dispatcher without the lock
+static bool broken = false;              // LLVM can not be initialized, set by the compile thread
+static T2Env env;
+
+static bool started = false;             // whether the compile thread is created
+static uint64_t start_us;                // CPU time of NEMU when the thread is created
+static uint64_t nr_request = 0;
+
+static uint64_t cpu_time_us(clockid_t clk) {
+  struct timespec t;
+  clock_gettime(clk, &t);
+  return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
+/* Without a spare core, whatever the thread runs is taken from the guest,
+ * at least a scheduler tick each time. Keep it under 1/CPU_SHARE of the CPU
+ * time NEMU has used since the thread is created, so short runs are not
+ * slowed down by LLVM.
+ */
+#define CPU_SHARE 16
+#define TICK_US 4000
+
+static void throttle() {
+  if (sysconf(_SC_NPROCESSORS_ONLN) > 1) return;
+  while (true) {
+    uint64_t self = cpu_time_us(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t rest = cpu_time_us(CLOCK_PROCESS_CPUTIME_ID) - start_us - self;
+    uint64_t need = (self + TICK_US) * CPU_SHARE;
+    if (rest >= need) return;
+    usleep(need - rest);
+  }
+}
+
+static void* compile_thread(void *arg) {
+  throttle();
+  if (!tier2_init_llvm(&env)) {
+    Log("Can not initialize LLVM, regions are not compiled");
+    __atomic_store_n(&broken, true, __ATOMIC_RELAXED);
+  }
+  while (true) {
+    pthread_mutex_lock(&lock);
+    while (todo == NULL) pthread_cond_wait(&cond, &lock);
+    T2Job *job = todo;
+    todo = job->next;
+    pthread_mutex_unlock(&lock);
+
+    throttle();
+    job->code = (__atomic_load_n(&broken, __ATOMIC_RELAXED) ? NULL :
+        tier2_compile(job->insts, job->ninst, job->entry));
+
+    pthread_mutex_lock(&lock);
+    job->next = done;
+    done = job;
+    __atomic_add_fetch(&nr_done, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+static void init_tier2() {
+  env = (T2Env) {
+    .gpr = (uintptr_t)&cpu.gpr[0], .pc = (uintptr_t)&cpu.pc,
+    .mem = (uintptr_t)guest_to_host(CONFIG_MBASE) - CONFIG_MBASE,
+    .mbase = CONFIG_MBASE, .msize = CONFIG_MSIZE,
+    .budget = (uintptr_t)&jit_budget, .exit_req = (uintptr_t)&jit_exit_req,
+    .code_line = (uintptr_t)jit_code_line, .line_shift = JIT_LINE_SHIFT,
+    .intr = (uintptr_t)&cpu.intr,
+    .max_seg = CONFIG_JIT_MAX_BLOCK_INST,
+    .helper_load = (uintptr_t)jit_helper_load, .helper_store = (uintptr_t)jit_helper_store,
+    .helper_interp = (uintptr_t)jit_helper_interp, .helper_spin = (uintptr_t)cpu_spin,
+  };
+  Assert(sizeof(cpu.gpr[0]) == 4 && sizeof(cpu.intr) == 4 && sizeof(jit_exit_req) == 1, "unexpected layout of the CPU state");
+  start_us = cpu_time_us(CLOCK_PROCESS_CPUTIME_ID);
+  int ret = pthread_create(&thread, NULL, compile_thread, NULL);
+  Assert(ret == 0, "Can not create the compile thread");
+  pthread_detach(thread);
+  started = true;
+}
+
+/* The region is the code reached from the hot block by falling through and
+ * by direct branches, in the page of the block, so the loops branching
+ * back before the block are in. It is decoded from guest memory here, in
+ * the order of the addresses, and the words are kept to find out whether
+ * they are changed before the region is installed. The blocks in it, and
+ * the ones translated later in its range, stop counting their entries, so
+ * a loop is compiled once, not once per block, and runs without the
+ * counters until the region is installed.
+ */
+void tier2_request(Block *b, uint64_t generation) {
+  if (!started) init_tier2();
+  if (__atomic_load_n(&broken, __ATOMIC_RELAXED)) return;
+
+  T2Job *job = malloc(sizeof(T2Job));
+  assert(job);
+  job->block = b;
+  job->generation = generation;
+  job->ninst = 0;
+
+  // decode the reached instructions in the order of the search
+  static Inst page[1 << (JIT_PAGE_SHIFT - 2)];
+  static bool reached[1 << (JIT_PAGE_SHIFT - 2)];
+  vaddr_t page_start = b->pc & ~(vaddr_t)((1 << JIT_PAGE_SHIFT) - 1);
+  vaddr_t page_end = page_start + (1 << JIT_PAGE_SHIFT);
+  memset(reached, 0, sizeof(reached));
+  vaddr_t todo_pc[CONFIG_JIT_TIER2_MAX_INST];
+  int nr_todo = 0, n = 0;
+  todo_pc[nr_todo ++] = b->pc;
+  while (nr_todo > 0 && n < CONFIG_JIT_TIER2_MAX_INST) {
+    vaddr_t pc = todo_pc[-- nr_todo];
+    while (pc >= page_start && pc < page_end && in_pmem(pc) && n < CONFIG_JIT_TIER2_MAX_INST) {
+      int k = (pc & ((1 << JIT_PAGE_SHIFT) - 1)) >> 2;
+      if (reached[k]) break;
+      reached[k] = true;
+      n ++;
+      Inst *in = &page[k];
+      jit_decode(in, pc, paddr_read(pc, 4));
+      if (in->op == OP_BRANCH && nr_todo < CONFIG_JIT_TIER2_MAX_INST) todo_pc[nr_todo ++] = pc + in->imm;
+      if (in->op == OP_JUMP) pc += in->imm;
+      else if (in->op == OP_JIRL) break;
+      else pc += 4;
+    }
+  }
+  for (int k = 0; k < ARRLEN(page); k ++) {
+    if (!reached[k]) continue;
+    if (job->ninst == 0) b->tier2_start = page[k].pc;
+    b->tier2_end = page[k].pc + 4;
+    if (page[k].pc == b->pc) job->entry = job->ninst;
+    Block *p = jit_lookup(page[k].pc);
+    if (p != NULL) jit_skip_counter(p);
+    job->insts[job->ninst ++] = page[k];
+  }
+  nr_request ++;
+
+  pthread_mutex_lock(&lock);
+  job->next = todo;
+  todo = job;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+// return the list of compiled regions, the caller frees them
+T2Job* tier2_done() {
+  if (__atomic_load_n(&nr_done, __ATOMIC_ACQUIRE) == 0) return NULL;
+  pthread_mutex_lock(&lock);
+  T2Job *list = done;
+  done = NULL;
+  __atomic_store_n(&nr_done, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&lock);
+  return list;
+}
+
+void tier2_statistic() {
+  clockid_t clk;
+  uint64_t us = (started && pthread_getcpuclockid(thread, &clk) == 0 ? cpu_time_us(clk) : 0);
+  Log("JIT tier 2: %" PRIu64 " regions requested, %" PRIu64 " us spent in LLVM",
+      nr_request, us);
+}
@@ -0,0 +1,52 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __JIT_TIER2_H__
+#define __JIT_TIER2_H__
+
+/* Interface between the second tier driver in C and the LLVM compiler in
+ * C++. The compiled code knows the emulator state by the host addresses in
+ * T2Env only.
+ */
+
+#include "inst.h"
+
+typedef struct {
+  uintptr_t gpr, pc;   // &cpu.gpr[0], &cpu.pc
+  uintptr_t mem;       // host address of guest physical address 0
+  uint32_t mbase, msize;
+  uintptr_t budget, exit_req, code_line;
+  uintptr_t intr;      // &cpu.intr, a segment is not entered while it is not 0
+  int line_shift;
+  int max_seg;         // maximum guest instructions charged to the budget at once
+  uintptr_t helper_load, helper_store, helper_interp, helper_spin;
+} T2Env;
+
+typedef void (*T2Code)();
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// called once before any region is compiled
+bool tier2_init_llvm(const T2Env *env);
+// compile the region `insts[0..n)' entered at insts[entry], return NULL on failure
+T2Code tier2_compile(const Inst *insts, int n, int entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,559 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Translate a block of LoongArch32R instructions to x86-64. A block ends
+ * at a branch, at the end of a guest page, or when it is long enough. The most used
+ * guest registers of a block are kept in host registers while it runs.
+ * Loads and stores to pmem are done inline, and fall back to a helper for
+ * MMIO, for misaligned addresses, which raise ALE there, and for writes
+ * to translated code. Instructions which are not
+ * translated are run by a copy of their stencil, or by the interpreter,
+ * and the block is left if they change the control flow. Calls push on a
+ * return address stack, which returns look up before the IBTC.
+ */
+
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include "jit.h"
+
+#define NR_HOST_REG 4
+static const int host_regs[NR_HOST_REG] = { R12, R13, R14, R15 };
+
+typedef struct {
+  bool store;
+  int idx;            // index of the instruction in the block
+  uint8_t *jcc[3];    // the branches to the slow path
+  uint8_t *resume;
+} SlowPath;
+
+static Inst insts[CONFIG_JIT_MAX_BLOCK_INST];
+static SlowPath slow[CONFIG_JIT_MAX_BLOCK_INST];
+static int nr_slow = 0;
+static int host_reg[32]; // the host register of a guest register, or -1
+static int ninst = 0;
+static vaddr_t block_pc = 0;
+static uint64_t nr_fuse[NR_FUSE] = {};
+
+#define GPR_OFS(i) ((int32_t)offsetof(CPU_state, gpr[i]))
+#define PC_OFS     ((int32_t)offsetof(CPU_state, pc))
+#define PC(i)      (block_pc + (i) * 4)
+
+// ------------------------ helpers called by the translated code ------------------------
+
+/* Leave the code cache when NEMU stops, an interrupt is pending or mapped
+ * address translation is turned on. Loads do not check interrupts, since
+ * their result is written after the helper returns.
+ */
+void jit_check_stop() {
+  if (nemu_state.state != NEMU_RUNNING || isa_query_intr() != INTR_EMPTY || !jit_runnable()) {
+    jit_exit_req = jit_stop = true;
+  }
+}
+
+// take the exception raised by the access at cpu.pc, the block is left before rd is written
+static bool helper_exc() {
+  if (likely(cpu.exc == EXC_NONE)) return false;
+  cpu.pc = isa_raise_intr(cpu.exc, cpu.pc);
+  jit_exit_req = true;
+  jit_check_stop();
+  return true;
+}
+
+word_t jit_helper_load(vaddr_t addr, int len, bool sext) {
+  word_t data = vaddr_read(addr, len);
+  if (helper_exc()) return 0;
+  if (nemu_state.state != NEMU_RUNNING) jit_exit_req = jit_stop = true;
+  if (!sext) return data;
+  return (len == 1 ? (word_t)(int8_t)data : len == 2 ? (word_t)(int16_t)data : data);
+}
+
+void jit_helper_store(vaddr_t addr, word_t data, int len) {
+  vaddr_t pc = cpu.pc;
+  vaddr_write(addr, len, data);
+  if (helper_exc()) return;
+  jit_check_stop();
+  // resume after the store if it modifies translated code
+  if (jit_exit_req && cpu.pc == pc) cpu.pc = pc + 4;
+}
+
+void jit_helper_interp() {
+  Decode s;
+  s.pc = s.snpc = cpu.pc;
+  isa_exec_once(&s);
+  cpu.pc = s.dnpc;
+  if (cpu.pc != s.snpc) jit_exit_req = true;
+  if (cpu.pc == s.pc) cpu_spin();
+  jit_check_stop();
+}
+
+// ------------------------ decode ------------------------
+
+void jit_decode(Inst *in, vaddr_t pc, uint32_t i) {
+  in->pc = pc;
+  in->inst = i;
+  in->rd = BITS(i, 4, 0);
+  in->rj = BITS(i, 9, 5);
+  in->rk = BITS(i, 14, 10);
+  in->op = OP_INTERP;
+  in->fuse = FUSE_NONE;
+  switch (i >> 25) {
+    case 0x0a: in->op = OP_LU12I;     in->imm = SEXT(BITS(i, 24, 5), 20) << 12; return;
+    case 0x0e: in->op = OP_PCADDU12I; in->imm = SEXT(BITS(i, 24, 5), 20) << 12; return;
+  }
+  switch (i >> 26) {
+    case 0x13: in->op = OP_JIRL; in->imm = SEXT(BITS(i, 25, 10), 16) << 2; return;
+    case 0x14: case 0x15: // b, bl
+      in->op = OP_JUMP;
+      in->rd = ((i >> 26) == 0x15 ? 1 : 0);
+      in->imm = SEXT((BITS(i, 9, 0) << 16) | BITS(i, 25, 10), 26) << 2;
+      return;
+    case 0x16: case 0x17: case 0x18: case 0x19: case 0x1a: case 0x1b:
+      in->op = OP_BRANCH;
+      in->fn = FN_EQ + (i >> 26) - 0x16;
+      in->imm = SEXT(BITS(i, 25, 10), 16) << 2;
+      return;
+  }
+
+  static const int fn_2ri12[] = { [0x8] = FN_SLT, [0x9] = FN_SLTU, [0xa] = FN_ADD,
+    [0xd] = FN_AND, [0xe] = FN_OR, [0xf] = FN_XOR };
+  uint32_t op = i >> 22;
+  in->imm = SEXT(BITS(i, 21, 10), 12);
+  switch (op) {
+    case 0x008: case 0x009: case 0x00a: in->op = OP_ALUI; in->fn = fn_2ri12[op]; return;
+    case 0x00d: case 0x00e: case 0x00f: in->op = OP_ALUI; in->fn = fn_2ri12[op]; in->imm = BITS(i, 21, 10); return;
+    case 0x0a0: in->op = OP_LOAD;  in->len = 1; in->sext = true;  return; // ld.b
+    case 0x0a1: in->op = OP_LOAD;  in->len = 2; in->sext = true;  return; // ld.h
+    case 0x0a2: in->op = OP_LOAD;  in->len = 4; in->sext = false; return; // ld.w
+    case 0x0a8: in->op = OP_LOAD;  in->len = 1; in->sext = false; return; // ld.bu
+    case 0x0a9: in->op = OP_LOAD;  in->len = 2; in->sext = false; return; // ld.hu
+    case 0x0a4: in->op = OP_STORE; in->len = 1; return;                   // st.b
+    case 0x0a5: in->op = OP_STORE; in->len = 2; return;                   // st.h
+    case 0x0a6: in->op = OP_STORE; in->len = 4; return;                   // st.w
+  }
+
+  static const int fn_3r[] = { [0x20] = FN_ADD, [0x22] = FN_SUB, [0x24] = FN_SLT, [0x25] = FN_SLTU,
+    [0x28] = FN_NOR, [0x29] = FN_AND, [0x2a] = FN_OR, [0x2b] = FN_XOR,
+    [0x2e] = FN_SLL, [0x2f] = FN_SRL, [0x30] = FN_SRA, [0x38] = FN_MUL };
+  op = i >> 15;
+  switch (op) {
+    case 0x20: case 0x22: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2a: case 0x2b:
+    case 0x2e: case 0x2f: case 0x30: case 0x38:
+      in->op = OP_ALU; in->fn = fn_3r[op]; return;
+    case 0x81: in->op = OP_ALUI; in->fn = FN_SLL; in->imm = in->rk; return; // slli.w
+    case 0x89: in->op = OP_ALUI; in->fn = FN_SRL; in->imm = in->rk; return; // srli.w
+    case 0x91: in->op = OP_ALUI; in->fn = FN_SRA; in->imm = in->rk; return; // srai.w
+  }
+}
+
+static uint32_t fold(int fn, uint32_t a, uint32_t b) {
+  switch (fn) {
+    case FN_ADD: return a + b;
+    case FN_SUB: return a - b;
+    case FN_AND: return a & b;
+    case FN_OR:  return a | b;
+    case FN_XOR: return a ^ b;
+    case FN_NOR: return ~(a | b);
+    case FN_SLT: return (int32_t)a < (int32_t)b;
+    case FN_SLTU: return a < b;
+    case FN_SLL: return a << (b & 0x1f);
+    case FN_SRL: return a >> (b & 0x1f);
+    case FN_SRA: return (int32_t)a >> (b & 0x1f);
+    case FN_MUL: return a * b;
+    default: panic("fn = %d can not be folded", fn);
+  }
+}
+
+/* Find the idioms emitted by guest compilers for what takes two
+ * instructions. The first one is still translated as it is, so its result
+ * is in place if the second one raises an exception. The second one is
+ * translated knowing the value of its source register, or the flags left
+ * by the first one.
+ */
+static void fuse() {
+  for (int i = 1; i < ninst; i ++) {
+    Inst *prev = &insts[i - 1], *in = &insts[i];
+    if (prev->rd == 0) continue;
+    if (prev->op == OP_PCADDU12I || prev->op == OP_LU12I) {
+      uint32_t base = prev->imm + (prev->op == OP_PCADDU12I ? prev->pc : 0);
+      if (in->rj != prev->rd) continue;
+      if (in->op == OP_ALUI) {
+        in->fuse = FUSE_CONST;
+      } else if ((in->op == OP_LOAD || in->op == OP_STORE) && prev->op == OP_PCADDU12I) {
+        // fused accesses do not check their address at runtime
+        uint32_t addr = base + in->imm;
+        if (!in_pmem(addr) || !in_pmem(addr + in->len - 1) || (addr & (in->len - 1))) continue;
+        in->fuse = (in->op == OP_LOAD ? FUSE_PCREL_LOAD : FUSE_PCREL_STORE);
+      } else continue;
+      in->base = base;
+      nr_fuse[in->fuse] ++;
+    } else if ((prev->op == OP_ALU || prev->op == OP_ALUI) && prev->fuse == FUSE_NONE &&
+        (prev->fn == FN_SLT || prev->fn == FN_SLTU) &&
+        in->op == OP_BRANCH && (in->fn == FN_EQ || in->fn == FN_NE) &&
+        ((in->rj == prev->rd && in->rd == 0) || (in->rd == prev->rd && in->rj == 0))) {
+      in->fuse = FUSE_CMP_BRANCH;
+      nr_fuse[in->fuse] ++;
+    }
+  }
+}
+
+void jit_fuse_statistic() {
+  uint64_t total = 0;
+  for (int k = 0; k < NR_FUSE; k ++) total += nr_fuse[k];
+  Log("JIT fusion: %" PRIu64 " pairs fused, %" PRIu64 " pc-relative loads, %" PRIu64 " pc-relative stores, "
+      "%" PRIu64 " constants, %" PRIu64 " compare and branch",
+      total, nr_fuse[FUSE_PCREL_LOAD], nr_fuse[FUSE_PCREL_STORE], nr_fuse[FUSE_CONST], nr_fuse[FUSE_CMP_BRANCH]);
+}
+
+// ------------------------ registers ------------------------
+
+static void alloc_regs() {
+  int use[32] = {};
+  for (int i = 0; i < ninst; i ++) {
+    int regs[3];
+    int n = inst_regs(&insts[i], regs);
+    for (int k = 0; k < n; k ++) use[regs[k]] ++;
+  }
+  for (int r = 0; r < 32; r ++) host_reg[r] = -1;
+  use[0] = 0;
+  for (int k = 0; k < NR_HOST_REG; k ++) {
+    int best = 0;
+    for (int r = 1; r < 32; r ++) if (use[r] > use[best]) best = r;
+    if (use[best] < 2) break;
+    host_reg[best] = host_regs[k];
+    use[best] = 0;
+  }
+}
+
+static void get_gpr(int hr, int gr) {
+  if (gr == 0) x86_alu_rr(ALU_XOR, hr, hr);
+  else if (host_reg[gr] >= 0) x86_mov_rr(hr, host_reg[gr]);
+  else x86_load(hr, REG_CPU, GPR_OFS(gr));
+}
+
+static void set_gpr(int gr, int hr) {
+  if (gr == 0) return;
+  if (host_reg[gr] >= 0) x86_mov_rr(host_reg[gr], hr);
+  else x86_store(REG_CPU, GPR_OFS(gr), hr);
+}
+
+static void set_gpr_i(int gr, uint32_t imm) {
+  if (gr == 0) return;
+  if (host_reg[gr] >= 0) x86_mov_ri(host_reg[gr], imm);
+  else x86_store_i(REG_CPU, GPR_OFS(gr), imm);
+}
+
+// the allocated registers are loaded at the entry and written back at exits
+static void load_regs() {
+  for (int r = 1; r < 32; r ++) if (host_reg[r] >= 0) x86_load(host_reg[r], REG_CPU, GPR_OFS(r));
+}
+
+static void writeback_regs() {
+  for (int r = 1; r < 32; r ++) if (host_reg[r] >= 0) x86_store(REG_CPU, GPR_OFS(r), host_reg[r]);
+}
+
+// ------------------------ exits ------------------------
+
+static void call_helper(void *fn) {
+  x86_mov_ri64(RAX, (uintptr_t)fn);
+  x86_call_r(RAX);
+}
+
+// leave with cpu.pc already set after `executed' instructions of the block
+static void emit_exit_dynamic(int executed) {
+  writeback_regs();
+  if (executed < ninst) x86_alu_mi64(ALU_ADD, REG_CPU, CPU_REL(jit_budget), ninst - executed);
+  x86_jmp(jit_indirect);
+}
+
+/* Leave by a return to cpu.pc in eax after `executed' instructions of the
+ * block. The entry on top of the return address stack is popped, and
+ * jumped to if it is for cpu.pc, or the IBTC is looked up as usual. Like a
+ * chained jump, it does not check jit_stop, which makes the block leave by
+ * jit_indirect before.
+ */
+static void emit_exit_return(int executed) {
+  writeback_regs();
+  if (executed < ninst) x86_alu_mi64(ALU_ADD, REG_CPU, CPU_REL(jit_budget), ninst - executed);
+  x86_load(RCX, REG_CPU, CPU_REL(jit_ras_top));
+  x86_lea(RDX, RCX, -(int32_t)sizeof(IBTCEntry));
+  x86_alu_ri(ALU_AND, RDX, sizeof(IBTCEntry) * JIT_RAS_SIZE - 1);
+  x86_store(REG_CPU, CPU_REL(jit_ras_top), RDX);
+  x86_alu_rm_idx(ALU_CMP, RAX, REG_CPU, RCX, CPU_REL(jit_ras));
+  uint8_t *miss = x86_jcc(CC_NE, x86_p);
+  x86_jmp_m_idx(REG_CPU, RCX, CPU_REL(jit_ras[0].code));
+  x86_patch(miss, x86_p);
+  x86_jmp(jit_indirect);
+}
+
+// push the IBTC entry of the return address `ret' of a call on the return address stack
+static void emit_ras_push(vaddr_t ret) {
+  int32_t entry = CPU_REL(jit_ibtc[(ret >> 2) & (JIT_IBTC_SIZE - 1)]);
+  x86_load(RAX, REG_CPU, CPU_REL(jit_ras_top));
+  x86_alu_ri(ALU_ADD, RAX, sizeof(IBTCEntry));
+  x86_alu_ri(ALU_AND, RAX, sizeof(IBTCEntry) * JIT_RAS_SIZE - 1);
+  x86_store(REG_CPU, CPU_REL(jit_ras_top), RAX);
+  x86_load64(RCX, REG_CPU, entry);
+  x86_store64_idx(REG_CPU, RAX, CPU_REL(jit_ras), RCX);
+  x86_load64(RCX, REG_CPU, entry + 8);
+  x86_store64_idx(REG_CPU, RAX, CPU_REL(jit_ras) + 8, RCX);
+}
+
+// leave to `target' by a jump which can be chained to the next block
+static void emit_exit_direct(vaddr_t target) {
+  writeback_regs();
+  uint8_t *patch = x86_jmp(x86_p + 5);
+  x86_store_i(REG_CPU, PC_OFS, target);
+  x86_mov_ri64(RAX, (uintptr_t)patch);
+  x86_jmp(jit_epilogue);
+}
+
+// leave at the instruction `idx' jumping to itself, the time is skipped by the caller
+static void emit_exit_spin(int idx) {
+  x86_store_i(REG_CPU, PC_OFS, PC(idx));
+  call_helper(cpu_spin);
+  emit_exit_dynamic(idx + 1);
+}
+
+// leave if a helper asks to, after the instruction `idx'
+static void emit_check_exit(int idx) {
+  x86_cmp_mi8(REG_CPU, CPU_REL(jit_exit_req), 0);
+  uint8_t *skip = x86_jcc(CC_E, x86_p);
+  emit_exit_dynamic(idx + 1);
+  x86_patch(skip, x86_p);
+}
+
+// ------------------------ instructions ------------------------
+
+/* Compute the address to eax, and branch to the slow path if it is not in
+ * pmem or it is misaligned, so the helper raises ALE.
+ */
+static void emit_mem_fast(Inst *in, SlowPath *sp) {
+  sp->jcc[0] = sp->jcc[1] = sp->jcc[2] = NULL;
+  if (in->fuse != FUSE_NONE) {
+    // the address is known to be in pmem
+    x86_mov_ri(RAX, in->base + in->imm);
+    return;
+  }
+  get_gpr(RAX, in->rj);
+  if (in->imm != 0) x86_alu_ri(ALU_ADD, RAX, in->imm);
+  x86_mov_rr(RCX, RAX);
+  x86_alu_ri(ALU_SUB, RCX, CONFIG_MBASE);
+  x86_alu_ri(ALU_CMP, RCX, CONFIG_MSIZE - in->len);
+  sp->jcc[0] = x86_jcc(CC_A, x86_p);
+  if (in->len > 1) {
+    x86_test_ri(RAX, in->len - 1);
+    sp->jcc[2] = x86_jcc(CC_NE, x86_p);
+  }
+}
+
+static void emit_load(Inst *in, int idx) {
+  SlowPath *sp = &slow[nr_slow ++];
+  sp->store = false;
+  sp->idx = idx;
+  emit_mem_fast(in, sp);
+  x86_load_idx(RDX, REG_MEM, RAX, in->len, in->sext);
+  sp->resume = x86_p;
+  set_gpr(in->rd, RDX);
+}
+
+static void emit_store(Inst *in, int idx) {
+  SlowPath *sp = &slow[nr_slow ++];
+  sp->store = true;
+  sp->idx = idx;
+  emit_mem_fast(in, sp);
+  // writes to lines with translated code go to the helper
+  if (in->fuse != FUSE_NONE) {
+    x86_cmp_mi8(REG_CPU, CPU_REL(jit_code_line[(in->base + in->imm - CONFIG_MBASE) >> JIT_LINE_SHIFT]), 0);
+  } else {
+    x86_shift_ri(SFT_SHR, RCX, JIT_LINE_SHIFT);
+    x86_cmp_mi8_idx(REG_CPU, RCX, CPU_REL(jit_code_line), 0);
+  }
+  sp->jcc[1] = x86_jcc(CC_NE, x86_p);
+  get_gpr(RDX, in->rd);
+  x86_store_idx(REG_MEM, RAX, RDX, in->len);
+  sp->resume = x86_p;
+}
+
+static void emit_slow_path(SlowPath *sp) {
+  Inst *in = &insts[sp->idx];
+  if (sp->jcc[0] == NULL && sp->jcc[1] == NULL && sp->jcc[2] == NULL) return;
+  for (int k = 0; k < 3; k ++) if (sp->jcc[k]) x86_patch(sp->jcc[k], x86_p);
+  x86_store_i(REG_CPU, PC_OFS, PC(sp->idx));
+  x86_mov_rr(RDI, RAX);
+  if (sp->store) {
+    get_gpr(RSI, in->rd);
+    x86_mov_ri(RDX, in->len);
+    call_helper(jit_helper_store);
+  } else {
+    x86_mov_ri(RSI, in->len);
+    x86_mov_ri(RDX, in->sext);
+    call_helper(jit_helper_load);
+    x86_mov_rr(RDX, RAX);
+  }
+  emit_check_exit(sp->idx);
+  x86_jmp(sp->resume);
+}
+
+static void emit_interp(int idx) {
+  writeback_regs();
+  // give back the budget of the instructions not run yet, so jit_inflight() is exact
+  x86_alu_mi64(ALU_ADD, REG_CPU, CPU_REL(jit_budget), ninst - idx);
+  bool stencil = MUXDEF(CONFIG_JIT_STENCIL, jit_emit_stencil(insts[idx].inst, PC(idx)), false);
+  if (!stencil) {
+    x86_store_i(REG_CPU, PC_OFS, PC(idx));
+    call_helper(jit_helper_interp);
+  }
+  x86_alu_mi64(ALU_SUB, REG_CPU, CPU_REL(jit_budget), ninst - idx);
+  load_regs();
+  emit_check_exit(idx);
+}
+
+// eax = eax `fn' ecx, or eax `fn' imm if `use_imm'
+static void emit_fn(int fn, bool use_imm, uint32_t imm) {
+  static const int alu[] = { [FN_ADD] = ALU_ADD, [FN_SUB] = ALU_SUB, [FN_AND] = ALU_AND,
+    [FN_OR] = ALU_OR, [FN_XOR] = ALU_XOR, [FN_NOR] = ALU_OR, [FN_SLT] = ALU_CMP, [FN_SLTU] = ALU_CMP };
+  static const int sft[] = { [FN_SLL] = SFT_SHL, [FN_SRL] = SFT_SHR, [FN_SRA] = SFT_SAR };
+  switch (fn) {
+    case FN_SLL: case FN_SRL: case FN_SRA:
+      if (use_imm) x86_shift_ri(sft[fn], RAX, imm);
+      else x86_shift_rcl(sft[fn], RAX);
+      break;
+    case FN_MUL: x86_imul_rr(RAX, RCX); break;
+    default:
+      if (use_imm) x86_alu_ri(alu[fn], RAX, imm);
+      else x86_alu_rr(alu[fn], RAX, RCX);
+      if (fn == FN_NOR) x86_alu_ri(ALU_XOR, RAX, -1);
+      // the flags are kept for a fused branch
+      if (fn == FN_SLT || fn == FN_SLTU) x86_setcc(fn == FN_SLT ? CC_L : CC_B, RAX);
+      break;
+  }
+}
+
+static void emit_alu(Inst *in) {
+  if (in->rd == 0) return;
+  if (in->fuse == FUSE_CONST) { set_gpr_i(in->rd, fold(in->fn, in->base, in->imm)); return; }
+  get_gpr(RAX, in->rj);
+  if (in->op == OP_ALU) get_gpr(RCX, in->rk);
+  emit_fn(in->fn, in->op == OP_ALUI, in->imm);
+  set_gpr(in->rd, RAX);
+}
+
+// a conditional branch ends the block with two exits which can be chained
+static void emit_branch(Inst *in, int idx) {
+  static const int cc[] = { [FN_EQ] = CC_E, [FN_NE] = CC_NE, [FN_LT] = CC_L,
+    [FN_GE] = CC_GE, [FN_LTU] = CC_B, [FN_GEU] = CC_AE };
+  int c;
+  if (in->fuse == FUSE_CMP_BRANCH) {
+    // take the flags of the comparison right before
+    c = (insts[idx - 1].fn == FN_SLT ? CC_L : CC_B);
+    if (in->fn == FN_EQ) c ^= 1;
+  } else {
+    get_gpr(RAX, in->rj);
+    get_gpr(RCX, in->rd);
+    x86_alu_rr(ALU_CMP, RAX, RCX);
+    c = cc[in->fn];
+  }
+  uint8_t *taken = x86_jcc(c, x86_p);
+  emit_exit_direct(PC(idx) + 4);
+  x86_patch(taken, x86_p);
+  if (in->imm == 0) emit_exit_spin(idx);
+  else emit_exit_direct(PC(idx) + in->imm);
+}
+
+// calls link to $ra, and `jirl $zero, $ra, 0' returns
+static void emit_jirl(Inst *in, int idx) {
+  if (in->rd == 1) emit_ras_push(PC(idx) + 4);
+  get_gpr(RAX, in->rj);
+  if (in->imm != 0) x86_alu_ri(ALU_ADD, RAX, in->imm);
+  set_gpr_i(in->rd, PC(idx) + 4);
+  x86_store(REG_CPU, PC_OFS, RAX);
+  if (in->rd == 0 && in->rj == 1 && in->imm == 0) emit_exit_return(idx + 1);
+  else emit_exit_dynamic(idx + 1);
+}
+
+static void emit_inst(Inst *in, int idx) {
+  switch (in->op) {
+    case OP_PCADDU12I: set_gpr_i(in->rd, PC(idx) + in->imm); break;
+    case OP_LU12I: set_gpr_i(in->rd, in->imm); break;
+    case OP_ALU: case OP_ALUI: emit_alu(in); break;
+    case OP_LOAD:  emit_load(in, idx); break;
+    case OP_STORE: emit_store(in, idx); break;
+    case OP_BRANCH: emit_branch(in, idx); break;
+    case OP_JUMP:
+      if (in->rd == 1) emit_ras_push(PC(idx) + 4);
+      set_gpr_i(in->rd, PC(idx) + 4);
+      if (in->imm == 0) emit_exit_spin(idx);
+      else emit_exit_direct(PC(idx) + in->imm);
+      break;
+    case OP_JIRL: emit_jirl(in, idx); break;
+    default: emit_interp(idx); break;
+  }
+}
+
+// ------------------------ block ------------------------
+
+bool jit_translate(Block *b) {
+  block_pc = b->pc;
+  ninst = 0;
+  vaddr_t pc = b->pc;
+  do {
+    if (!in_pmem(pc)) break;
+    jit_decode(&insts[ninst], pc, paddr_read(pc, 4));
+    pc += 4;
+    ninst ++;
+    if (inst_is_jump(&insts[ninst - 1])) break;
+  } while (ninst < CONFIG_JIT_MAX_BLOCK_INST && (pc & ((1 << JIT_PAGE_SHIFT) - 1)) != 0);
+  if (ninst == 0) return false;
+  b->ninst = ninst;
+  fuse();
+  alloc_regs();
+  nr_slow = 0;
+
+  // take the budget, or leave before running anything if an interrupt is pending
+  b->code = x86_p;
+#ifdef CONFIG_JIT_TIER2
+  x86_alu_mi(ALU_SUB, REG_CPU, CPU_REL(jit_block_count[b->id]), 1);
+  uint8_t *hot = x86_jcc(CC_E, x86_p);
+  b->checks = x86_p;
+#endif
+  x86_alu_mi(ALU_CMP, REG_CPU, offsetof(CPU_state, intr), 0);
+  uint8_t *pending = x86_jcc(CC_NE, x86_p);
+  x86_alu_mi64(ALU_CMP, REG_CPU, CPU_REL(jit_budget), ninst);
+  uint8_t *no_budget = x86_jcc(CC_L, x86_p);
+  x86_alu_mi64(ALU_SUB, REG_CPU, CPU_REL(jit_budget), ninst);
+  load_regs();
+
+  for (int i = 0; i < ninst; i ++) emit_inst(&insts[i], i);
+  if (!inst_is_jump(&insts[ninst - 1])) emit_exit_direct(pc);
+
+  for (int i = 0; i < nr_slow; i ++) emit_slow_path(&slow[i]);
+
+  b->dead_exit = x86_p;
+  x86_patch(no_budget, x86_p);
+  x86_patch(pending, x86_p);
+  x86_store_i(REG_CPU, PC_OFS, b->pc);
+  x86_alu_rr(ALU_XOR, RAX, RAX);
+  x86_jmp(jit_epilogue);
+
+#ifdef CONFIG_JIT_TIER2
+  x86_patch(hot, x86_p);
+  x86_store_i(REG_CPU, PC_OFS, b->pc);
+  x86_mov_ri64(RAX, (uintptr_t)JIT_HOT);
+  x86_jmp(jit_epilogue);
+#endif
+  return true;
+}
@@ -0,0 +1,234 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __JIT_X86_H__
+#define __JIT_X86_H__
+
+/* A minimal x86-64 assembler. Only the forms used by the translator are
+ * provided. Operations are 32-bit unless their names end with 64, and
+ * memory operands are always [base + disp32] or [base + index + disp32].
+ */
+
+#include <common.h>
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+       CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+enum { SFT_SHL = 4, SFT_SHR = 5, SFT_SAR = 7 };
+
+extern uint8_t *x86_p; // where the next instruction is emitted
+
+static inline void x86_u8(uint8_t v) { *x86_p ++ = v; }
+static inline void x86_u32(uint32_t v) { memcpy(x86_p, &v, 4); x86_p += 4; }
+static inline void x86_u64(uint64_t v) { memcpy(x86_p, &v, 8); x86_p += 8; }
+
+static inline void x86_rex(int w, int reg, int index, int base, bool force) {
+  int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+  if (rex != 0x40 || force) x86_u8(rex);
+}
+
+// ModRM for [base + disp32]
+static inline void x86_modrm_mem(int reg, int base, int32_t disp) {
+  x86_u8(0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) x86_u8(0x24);
+  x86_u32(disp);
+}
+
+static inline void x86_modrm_reg(int reg, int rm) {
+  x86_u8(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static inline void x86_modrm_sib(int reg, int base, int index, int32_t disp) {
+  x86_u8(0x84 | ((reg & 7) << 3));
+  x86_u8(((index & 7) << 3) | (base & 7));
+  x86_u32(disp);
+}
+
+// op r32, r/m32
+static inline void x86_op_rr(uint8_t op, int dst, int src) {
+  x86_rex(0, src, 0, dst, false); x86_u8(op); x86_modrm_reg(src, dst);
+}
+
+static inline void x86_mov_rr(int dst, int src) { x86_op_rr(0x89, dst, src); }
+static inline void x86_alu_rr(int alu, int dst, int src) { x86_op_rr(alu * 8 + 1, dst, src); }
+static inline void x86_test_rr(int dst, int src) { x86_op_rr(0x85, dst, src); }
+
+static inline void x86_mov_ri(int dst, uint32_t imm) {
+  x86_rex(0, 0, 0, dst, false); x86_u8(0xb8 + (dst & 7)); x86_u32(imm);
+}
+
+static inline void x86_mov_ri64(int dst, uint64_t imm) {
+  x86_rex(1, 0, 0, dst, false); x86_u8(0xb8 + (dst & 7)); x86_u64(imm);
+}
+
+static inline void x86_alu_ri(int alu, int dst, int32_t imm) {
+  x86_rex(0, 0, 0, dst, false); x86_u8(0x81); x86_modrm_reg(alu, dst); x86_u32(imm);
+}
+
+static inline void x86_test_ri(int dst, int32_t imm) {
+  x86_rex(0, 0, 0, dst, false); x86_u8(0xf7); x86_modrm_reg(0, dst); x86_u32(imm);
+}
+
+static inline void x86_alu_ri64(int alu, int dst, int32_t imm) {
+  x86_rex(1, 0, 0, dst, false); x86_u8(0x81); x86_modrm_reg(alu, dst); x86_u32(imm);
+}
+
+static inline void x86_shift_ri(int sft, int dst, int imm) {
+  x86_rex(0, 0, 0, dst, false); x86_u8(0xc1); x86_modrm_reg(sft, dst); x86_u8(imm);
+}
+
+// shift by cl
+static inline void x86_shift_rcl(int sft, int dst) {
+  x86_rex(0, 0, 0, dst, false); x86_u8(0xd3); x86_modrm_reg(sft, dst);
+}
+
+static inline void x86_lea(int dst, int base, int32_t disp) {
+  x86_rex(0, dst, 0, base, false); x86_u8(0x8d); x86_modrm_mem(dst, base, disp);
+}
+
+static inline void x86_load(int dst, int base, int32_t disp) {
+  x86_rex(0, dst, 0, base, false); x86_u8(0x8b); x86_modrm_mem(dst, base, disp);
+}
+
+static inline void x86_load64(int dst, int base, int32_t disp) {
+  x86_rex(1, dst, 0, base, false); x86_u8(0x8b); x86_modrm_mem(dst, base, disp);
+}
+
+// mov qword [base + index + disp32], r64
+static inline void x86_store64_idx(int base, int index, int32_t disp, int src) {
+  x86_rex(1, src, index, base, false); x86_u8(0x89); x86_modrm_sib(src, base, index, disp);
+}
+
+static inline void x86_store(int base, int32_t disp, int src) {
+  x86_rex(0, src, 0, base, false); x86_u8(0x89); x86_modrm_mem(src, base, disp);
+}
+
+static inline void x86_store_i(int base, int32_t disp, uint32_t imm) {
+  x86_rex(0, 0, 0, base, false); x86_u8(0xc7); x86_modrm_mem(0, base, disp); x86_u32(imm);
+}
+
+// mov byte [base + disp32], imm8
+static inline void x86_store_i8(int base, int32_t disp, uint8_t imm) {
+  x86_rex(0, 0, 0, base, false); x86_u8(0xc6); x86_modrm_mem(0, base, disp); x86_u8(imm);
+}
+
+// op r32, [base + disp32]
+static inline void x86_alu_rm(int alu, int dst, int base, int32_t disp) {
+  x86_rex(0, dst, 0, base, false); x86_u8(alu * 8 + 3); x86_modrm_mem(dst, base, disp);
+}
+
+// op dword [base + disp32], imm32
+static inline void x86_alu_mi(int alu, int base, int32_t disp, int32_t imm) {
+  x86_rex(0, 0, 0, base, false); x86_u8(0x81); x86_modrm_mem(alu, base, disp); x86_u32(imm);
+}
+
+// op r32, [base + index + disp32]
+static inline void x86_alu_rm_idx(int alu, int dst, int base, int index, int32_t disp) {
+  x86_rex(0, dst, index, base, false); x86_u8(alu * 8 + 3); x86_modrm_sib(dst, base, index, disp);
+}
+
+// op qword [base + disp32], imm32
+static inline void x86_alu_mi64(int alu, int base, int32_t disp, int32_t imm) {
+  x86_rex(1, 0, 0, base, false); x86_u8(0x81); x86_modrm_mem(alu, base, disp); x86_u32(imm);
+}
+
+// cmp byte [base + index + disp32], imm8
+static inline void x86_cmp_mi8_idx(int base, int index, int32_t disp, uint8_t imm) {
+  x86_rex(0, 0, index, base, false); x86_u8(0x80); x86_modrm_sib(7, base, index, disp); x86_u8(imm);
+}
+
+// cmp byte [base + disp32], imm8
+static inline void x86_cmp_mi8(int base, int32_t disp, uint8_t imm) {
+  x86_rex(0, 0, 0, base, false); x86_u8(0x80); x86_modrm_mem(7, base, disp); x86_u8(imm);
+}
+
+/* Load `len' bytes from [base + index], zero or sign extended to 32 bits.
+ * `index' holds a zero extended 32-bit address.
+ */
+static inline void x86_load_idx(int dst, int base, int index, int len, bool sext) {
+  x86_rex(0, dst, index, base, false);
+  switch (len) {
+    case 1: x86_u8(0x0f); x86_u8(sext ? 0xbe : 0xb6); break;
+    case 2: x86_u8(0x0f); x86_u8(sext ? 0xbf : 0xb7); break;
+    default: x86_u8(0x8b); break;
+  }
+  x86_modrm_sib(dst, base, index, 0);
+}
+
+static inline void x86_store_idx(int base, int index, int src, int len) {
+  if (len == 2) x86_u8(0x66);
+  // a REX prefix selects sil/dil instead of dh/bh for byte registers
+  x86_rex(0, src, index, base, len == 1 && src >= RSP);
+  x86_u8(len == 1 ? 0x88 : 0x89);
+  x86_modrm_sib(src, base, index, 0);
+}
+
+// imul r32, r/m32
+static inline void x86_imul_rr(int dst, int src) {
+  x86_rex(0, dst, 0, src, false); x86_u8(0x0f); x86_u8(0xaf); x86_modrm_reg(dst, src);
+}
+
+// setcc r8, then zero extend it
+static inline void x86_setcc(int cc, int dst) {
+  x86_rex(0, 0, 0, dst, dst >= RSP); x86_u8(0x0f); x86_u8(0x90 + cc); x86_modrm_reg(0, dst);
+  x86_rex(0, dst, 0, dst, dst >= RSP); x86_u8(0x0f); x86_u8(0xb6); x86_modrm_reg(dst, dst);
+}
+
+static inline void x86_push(int r) { x86_rex(0, 0, 0, r, false); x86_u8(0x50 + (r & 7)); }
+static inline void x86_pop(int r) { x86_rex(0, 0, 0, r, false); x86_u8(0x58 + (r & 7)); }
+static inline void x86_ret() { x86_u8(0xc3); }
+
+static inline void x86_call_r(int r) {
+  x86_rex(0, 0, 0, r, false); x86_u8(0xff); x86_modrm_reg(2, r);
+}
+
+static inline void x86_jmp_r(int r) {
+  x86_rex(0, 0, 0, r, false); x86_u8(0xff); x86_modrm_reg(4, r);
+}
+
+// jmp qword [base + index + disp32]
+static inline void x86_jmp_m_idx(int base, int index, int32_t disp) {
+  x86_rex(0, 0, index, base, false); x86_u8(0xff); x86_modrm_sib(4, base, index, disp);
+}
+
+// emit a branch with rel32, and return the address of rel32 for patching
+static inline uint8_t* x86_jmp(uint8_t *target) {
+  x86_u8(0xe9);
+  uint8_t *rel = x86_p;
+  x86_u32(target - (rel + 4));
+  return rel;
+}
+
+static inline uint8_t* x86_call(uint8_t *target) {
+  x86_u8(0xe8);
+  uint8_t *rel = x86_p;
+  x86_u32(target - (rel + 4));
+  return rel;
+}
+
+static inline uint8_t* x86_jcc(int cc, uint8_t *target) {
+  x86_u8(0x0f); x86_u8(0x80 + cc);
+  uint8_t *rel = x86_p;
+  x86_u32(target - (rel + 4));
+  return rel;
+}
+
+static inline void x86_patch(uint8_t *rel, uint8_t *target) {
+  int32_t v = target - (rel + 4);
+  memcpy(rel, &v, 4);
+}
+
+#endif
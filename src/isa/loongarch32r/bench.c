@@ -0,0 +1,190 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+/* Built-in micro-kernels for `--kernel'. They are loaded at the reset vector
+ * in place of the built-in image and end with a good trap. The MMIO kernel
+ * polls the RTC at CONFIG_RTC_MMIO, so it only exists with a timer.
+ */
+
+// ALU loop: a dependent chain of add/xor/shift/logic operations
+static const uint32_t alu[] = {
+  0x14007a0c,  // lu12i.w $t0,0x3d0
+  0x03a4018c,  // ori $t0,$t0,0x900
+  0x0280000d,  // addi.w $t1,$zero,0
+  0x1400024e,  // lu12i.w $t2,0x12
+  0x038d15ce,  // ori $t2,$t2,0x345
+  0x001031ad,  // add.w $t1,$t1,$t0
+  0x0015b5ce,  // xor $t2,$t2,$t1
+  0x00408dcf,  // slli.w $t3,$t2,3
+  0x004495d0,  // srli.w $t4,$t2,5
+  0x001541ef,  // or $t3,$t3,$t4
+  0x00113dad,  // sub.w $t1,$t1,$t3
+  0x0014b9b1,  // and $t5,$t1,$t2
+  0x001045ce,  // add.w $t2,$t2,$t5
+  0x02bffd8c,  // addi.w $t0,$t0,-1
+  0x5fffdd80,  // bne $t0,$zero,alu
+  0x02800004,  // addi.w $a0,$zero,0
+  0x002a0000,  // break 0
+};
+
+// load/store streaming: copy a 2 MiB buffer 8 times
+static const uint32_t mem[] = {
+  0x1c000012,  // pcaddu12i $t6,0x0
+  0x14002013,  // lu12i.w $t7,0x100
+  0x00104e53,  // add.w $t7,$t6,$t7
+  0x14006014,  // lu12i.w $t8,0x300
+  0x00105254,  // add.w $t8,$t6,$t8
+  0x02802017,  // addi.w $s0,$zero,8
+  0x0280026c,  // addi.w $t0,$t7,0
+  0x0280028d,  // addi.w $t1,$t8,0
+  0x1400100e,  // lu12i.w $t2,0x80
+  0x2880018f,  // ld.w $t3,$t0,0
+  0x28801190,  // ld.w $t4,$t0,4
+  0x00105def,  // add.w $t3,$t3,$s0
+  0x298001af,  // st.w $t3,$t1,0
+  0x298011b0,  // st.w $t4,$t1,4
+  0x0280218c,  // addi.w $t0,$t0,8
+  0x028021ad,  // addi.w $t1,$t1,8
+  0x02bff9ce,  // addi.w $t2,$t2,-2
+  0x5fffe1c0,  // bne $t2,$zero,copy
+  0x02bffef7,  // addi.w $s0,$s0,-1
+  0x5fffcee0,  // bne $s0,$zero,pass
+  0x02800004,  // addi.w $a0,$zero,0
+  0x002a0000,  // break 0
+};
+
+// branch-heavy: data dependent branches on a xorshift sequence
+static const uint32_t branch[] = {
+  0x14003d0c,  // lu12i.w $t0,0x1e8
+  0x0392018c,  // ori $t0,$t0,0x480
+  0x144a8bed,  // lu12i.w $t1,0x2545f
+  0x039245ad,  // ori $t1,$t1,0x491
+  0x0280000e,  // addi.w $t2,$zero,0
+  0x0280000f,  // addi.w $t3,$zero,0
+  0x0040b5b0,  // slli.w $t4,$t1,13
+  0x0015c1ad,  // xor $t1,$t1,$t4
+  0x0044c5b0,  // srli.w $t4,$t1,17
+  0x0015c1ad,  // xor $t1,$t1,$t4
+  0x004095b0,  // slli.w $t4,$t1,5
+  0x0015c1ad,  // xor $t1,$t1,$t4
+  0x034005b0,  // andi $t4,$t1,0x1
+  0x58000e00,  // beq $t4,$zero,even
+  0x028005ce,  // addi.w $t2,$t2,1
+  0x50000800,  // b next
+  0x028005ef,  // addi.w $t3,$t3,1
+  0x034019b0,  // andi $t4,$t1,0x6
+  0x5c000a00,  // bne $t4,$zero,skip
+  0x02800dce,  // addi.w $t2,$t2,3
+  0x02bffd8c,  // addi.w $t0,$t0,-1
+  0x5fffc580,  // bne $t0,$zero,rnd
+  0x02800004,  // addi.w $a0,$zero,0
+  0x002a0000,  // break 0
+};
+
+#ifdef CONFIG_HAS_TIMER
+#define RTC_HI (((uint32_t)CONFIG_RTC_MMIO >> 12) & 0xfffff)
+#define RTC_LO ((uint32_t)CONFIG_RTC_MMIO & 0xfff)
+
+// MMIO-heavy: poll the RTC
+static const uint32_t mmio[] = {
+  0x14000013 | (RTC_HI << 5),   // lu12i.w $t7,%hi(RTC)
+  0x03800273 | (RTC_LO << 10),  // ori $t7,$t7,%lo(RTC)
+  0x14001e8c,  // lu12i.w $t0,0xf4
+  0x0389018c,  // ori $t0,$t0,0x240
+  0x0280000d,  // addi.w $t1,$zero,0
+  0x2880126e,  // ld.w $t2,$t7,4
+  0x2880026f,  // ld.w $t3,$t7,0
+  0x001039ad,  // add.w $t1,$t1,$t2
+  0x00103dad,  // add.w $t1,$t1,$t3
+  0x02bffd8c,  // addi.w $t0,$t0,-1
+  0x5fffed80,  // bne $t0,$zero,poll
+  0x02800004,  // addi.w $a0,$zero,0
+  0x002a0000,  // break 0
+};
+#endif
+
+// CoreMark-like mix: list walk, matrix-vector multiply and CRC16
+static const uint32_t mix[] = {
+  0x1c000012,  // pcaddu12i $t6,0x0
+  0x14000213,  // lu12i.w $t7,0x10
+  0x00104e53,  // add.w $t7,$t6,$t7
+  0x0280400c,  // addi.w $t0,$zero,16
+  0x1400020d,  // lu12i.w $t1,0x10
+  0x038021ad,  // ori $t1,$t1,0x8
+  0x0280026e,  // addi.w $t2,$t7,0
+  0x298001cd,  // st.w $t1,$t2,0
+  0x298011cc,  // st.w $t0,$t2,4
+  0x028021ad,  // addi.w $t1,$t1,8
+  0x028021ce,  // addi.w $t2,$t2,8
+  0x02bffd8c,  // addi.w $t0,$t0,-1
+  0x5fffed80,  // bne $t0,$zero,init_list
+  0x29bfe1c0,  // st.w $zero,$t2,-8
+  0x14000414,  // lu12i.w $t8,0x20
+  0x00105254,  // add.w $t8,$t6,$t8
+  0x0280800c,  // addi.w $t0,$zero,32
+  0x0280028e,  // addi.w $t2,$t8,0
+  0x298001cc,  // st.w $t0,$t2,0
+  0x028011ce,  // addi.w $t2,$t2,4
+  0x02bffd8c,  // addi.w $t0,$t0,-1
+  0x5ffff580,  // bne $t0,$zero,init_mat
+  0x14000157,  // lu12i.w $s0,0xa
+  0x038006f7,  // ori $s0,$s0,0x1
+  0x14000318,  // lu12i.w $s1,0x18
+  0x039a8318,  // ori $s1,$s1,0x6a0
+  0x140001f9,  // lu12i.w $s2,0xf
+  0x03bfff39,  // ori $s2,$s2,0xfff
+  0x0280026e,  // addi.w $t2,$t7,0
+  0x0280000d,  // addi.w $t1,$zero,0
+  0x288011cf,  // ld.w $t3,$t2,4
+  0x00103dad,  // add.w $t1,$t1,$t3
+  0x288001cf,  // ld.w $t3,$t2,0
+  0x00103e4e,  // add.w $t2,$t6,$t3
+  0x5ffff1e0,  // bne $t3,$zero,walk
+  0x0280028e,  // addi.w $t2,$t8,0
+  0x0280400c,  // addi.w $t0,$zero,16
+  0x288001cf,  // ld.w $t3,$t2,0
+  0x288101d0,  // ld.w $t4,$t2,64
+  0x001c41ef,  // mul.w $t3,$t3,$t4
+  0x00103dad,  // add.w $t1,$t1,$t3
+  0x028011ce,  // addi.w $t2,$t2,4
+  0x02bffd8c,  // addi.w $t0,$t0,-1
+  0x5fffe980,  // bne $t0,$zero,mat
+  0x0280200c,  // addi.w $t0,$zero,8
+  0x0015e5b0,  // xor $t4,$t1,$s2
+  0x03400610,  // andi $t4,$t4,0x1
+  0x004485ad,  // srli.w $t1,$t1,1
+  0x00448739,  // srli.w $s2,$s2,1
+  0x58000a00,  // beq $t4,$zero,crc_next
+  0x0015df39,  // xor $s2,$s2,$s0
+  0x02bffd8c,  // addi.w $t0,$t0,-1
+  0x5fffe580,  // bne $t0,$zero,crc
+  0x02bfff18,  // addi.w $s1,$s1,-1
+  0x5fff9b00,  // bne $s1,$zero,iter
+  0x02800004,  // addi.w $a0,$zero,0
+  0x002a0000,  // break 0
+};
+
+const BenchKernel isa_bench_kernel[] = {
+  { "alu"   , alu   , sizeof(alu)    },
+  { "mem"   , mem   , sizeof(mem)    },
+  { "branch", branch, sizeof(branch) },
+#ifdef CONFIG_HAS_TIMER
+  { "mmio"  , mmio  , sizeof(mmio)   },
+#endif
+  { "mix"   , mix   , sizeof(mix)    },
+};
+const int isa_nr_bench_kernel = ARRLEN(isa_bench_kernel);
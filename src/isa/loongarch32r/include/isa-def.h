@@ -21,8 +21,18 @@
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+  bool llbit;      // set by ll.w, sc.w only writes memory while it is set
+  word_t llval;    // loaded by ll.w, sc.w only writes memory while it still holds it
+  bool idle;       // waiting in `idle' for an interrupt
+  word_t csr[512]; // indexed by the CSR number, see local-include/csr.h
+  word_t intr;     // pending and enabled interrupts, kept by system/intr.c
+  uint64_t timer;  // the tick when the timer expires, see system/timer.c
+  word_t exc, badv; // the exception raised by the running instruction, or EXC_NONE
+  bool pg;         // in mapped address translation mode, kept by system/mmu.c
 } loongarch32r_CPU_state;
 
+#define EXC_NONE ((word_t)-1)
+
 // decode
 typedef struct {
   union {
@@ -30,6 +40,13 @@ typedef struct {
   } inst;
 } loongarch32r_ISADecodeInfo;
 
-#define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+// a misaligned access raises ALE, or ADEF if it is a fetch, in system/mmu.c
+int isa_mmu_misaligned(vaddr_t vaddr, int type);
+#define isa_mmu_check(vaddr, len, type) (((vaddr) & ((len) - 1)) ? isa_mmu_misaligned(vaddr, type) : \
+    cpu.pg ? MMU_TRANSLATE : MMU_DIRECT)
+// all interrupts are taken as INT, ESTAT tells which ones are pending
+#define isa_query_intr() (cpu.intr != 0 ? 0 : INTR_EMPTY)
+// other harts may write the reserved word while this one is parked
+#define isa_hart_switch() (cpu.llbit = false)
 
 #endif
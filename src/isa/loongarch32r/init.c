@@ -15,6 +15,9 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include "local-include/csr.h"
+
+void init_decode();
 
 // this is not consistent with uint8_t
 // but it is ok since we do not access the array directly
@@ -32,12 +35,21 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* Start in direct address translation mode at PLV0, with interrupts disabled. */
+  csr(CSR_CRMD) = CRMD_DA;
+  csr(CSR_ASID) = 10 << 16; // ASIDBITS
+  cpu.timer = UINT64_MAX;   // the timer is disabled
+  cpu.exc = EXC_NONE;
 }
 
 void init_isa() {
   /* Load built-in image. */
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
+  pmem_host_written(RESET_VECTOR, sizeof(img));
 
   /* Initialize this virtual computer system. */
   restart();
+
+  init_decode();
 }
@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include "local-include/reg.h"
+#include "local-include/csr.h"
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
@@ -23,24 +24,157 @@
 #define Mw vaddr_write
 
 enum {
-  TYPE_2RI12, TYPE_1RI20,
+  TYPE_3R, TYPE_2RI5, TYPE_2RI12, TYPE_2RI12U, TYPE_2RI14, TYPE_2RI16,
+  TYPE_1RI20, TYPE_I26, TYPE_CSR,
   TYPE_N, // none
 };
 
 #define src1R()  do { *src1 = R(rj); } while (0)
+#define src2R()  do { *src2 = R(rk); } while (0)
+#define src2D()  do { *src2 = R(*rd_); } while (0) // branches compare rj with rd
+#define uimm5()  do { *imm = BITS(i, 14, 10); } while (0)
 #define simm12() do { *imm = SEXT(BITS(i, 21, 10), 12); } while (0)
+#define uimm12() do { *imm = BITS(i, 21, 10); } while (0)
+#define simm14() do { *imm = SEXT(BITS(i, 23, 10), 14) << 2; } while (0)
+#define csrnum() do { *imm = BITS(i, 23, 10); } while (0)
+#define simm16() do { *imm = SEXT(BITS(i, 25, 10), 16) << 2; } while (0)
 #define simm20() do { *imm = SEXT(BITS(i, 24, 5), 20) << 12; } while (0)
+#define simm26() do { *imm = SEXT((BITS(i, 9, 0) << 16) | BITS(i, 25, 10), 26) << 2; } while (0)
 
 static void decode_operand(Decode *s, int *rd_, word_t *src1, word_t *src2, word_t *imm, int type) {
   uint32_t i = s->isa.inst.val;
   int rj = BITS(i, 9, 5);
+  int rk = BITS(i, 14, 10);
   *rd_ = BITS(i, 4, 0);
   switch (type) {
-    case TYPE_1RI20: simm20(); src1R(); break;
-    case TYPE_2RI12: simm12(); src1R(); break;
+    case TYPE_3R:     src1R(); src2R();  break;
+    case TYPE_2RI5:   src1R(); uimm5();  break;
+    case TYPE_2RI12:  src1R(); simm12(); break;
+    case TYPE_2RI12U: src1R(); uimm12(); break;
+    case TYPE_2RI14:  src1R(); simm14(); break;
+    case TYPE_2RI16:  src1R(); src2D(); simm16(); break;
+    case TYPE_1RI20:  simm20(); break;
+    case TYPE_I26:    simm26(); break;
+    case TYPE_CSR:    src1R(); csrnum(); break;
   }
 }
 
+// the privileged instructions raise IPE out of PLV0
+#define PRIV(...) do { \
+  if (csr(CSR_CRMD) & CRMD_PLV) raise_exc(EXC_IPE, 0); \
+  else { __VA_ARGS__; } \
+} while (0)
+
+// a load writes rd only if it raises no exception
+#define LOAD(val) do { \
+  word_t t = (val); \
+  if (cpu.exc == EXC_NONE) R(rd) = t; \
+} while (0)
+
+/* sc.w checks the alignment even if it does not write. It fails if another
+ * hart wrote another value to the word since ll.w.
+ */
+#define SC(addr) do { \
+  vaddr_t a = (addr); \
+  if (a & 3) raise_exc(EXC_ALE, a); \
+  else if (cpu.llbit && !vaddr_cas(a, 4, cpu.llval, R(rd))) cpu.llbit = false; \
+  if (cpu.exc == EXC_NONE) { R(rd) = cpu.llbit; cpu.llbit = false; } \
+} while (0)
+
+// division by zero and overflow are not defined by the ISA, they divide by 1 as QEMU does
+static inline word_t divisor(word_t a, word_t b, bool sign) {
+  return (b == 0 || (sign && a == 0x80000000u && b == (word_t)-1)) ? 1 : b;
+}
+
+/* The instructions. Every entry is a pattern matched by decode_exec(),
+ * and with the copy-and-patch JIT also a stencil, so its body is the only
+ * definition of the semantics of the instruction. An entry is only tried
+ * if no entry before it matches, so the more specific patterns come first.
+ * A body raises an exception with raise_exc(), and it is taken when the
+ * body returns.
+ */
+#define INSTPAT_LIST(f) \
+  f("0001010 ???????????????????? ?????"     , lu12i.w  , 1RI20 , R(rd) = imm) \
+  f("0001110 ???????????????????? ?????"     , pcaddu12i, 1RI20 , R(rd) = s->pc + imm) \
+  f("00000000000100000 ????? ????? ?????"    , add.w    , 3R    , R(rd) = src1 + src2) \
+  f("00000000000100010 ????? ????? ?????"    , sub.w    , 3R    , R(rd) = src1 - src2) \
+  f("00000000000100100 ????? ????? ?????"    , slt      , 3R    , R(rd) = (sword_t)src1 < (sword_t)src2) \
+  f("00000000000100101 ????? ????? ?????"    , sltu     , 3R    , R(rd) = src1 < src2) \
+  f("00000000000101000 ????? ????? ?????"    , nor      , 3R    , R(rd) = ~(src1 | src2)) \
+  f("00000000000101001 ????? ????? ?????"    , and      , 3R    , R(rd) = src1 & src2) \
+  f("00000000000101010 ????? ????? ?????"    , or       , 3R    , R(rd) = src1 | src2) \
+  f("00000000000101011 ????? ????? ?????"    , xor      , 3R    , R(rd) = src1 ^ src2) \
+  f("00000000000101110 ????? ????? ?????"    , sll.w    , 3R    , R(rd) = src1 << (src2 & 0x1f)) \
+  f("00000000000101111 ????? ????? ?????"    , srl.w    , 3R    , R(rd) = src1 >> (src2 & 0x1f)) \
+  f("00000000000110000 ????? ????? ?????"    , sra.w    , 3R    , R(rd) = (sword_t)src1 >> (src2 & 0x1f)) \
+  f("00000000000111000 ????? ????? ?????"    , mul.w    , 3R    , R(rd) = src1 * src2) \
+  f("00000000000111001 ????? ????? ?????"    , mulh.w   , 3R    , R(rd) = ((int64_t)(sword_t)src1 * (sword_t)src2) >> 32) \
+  f("00000000000111010 ????? ????? ?????"    , mulh.wu  , 3R    , R(rd) = ((uint64_t)src1 * src2) >> 32) \
+  f("00000000001000000 ????? ????? ?????"    , div.w    , 3R    , R(rd) = (sword_t)src1 / (sword_t)divisor(src1, src2, true)) \
+  f("00000000001000001 ????? ????? ?????"    , mod.w    , 3R    , R(rd) = (sword_t)src1 % (sword_t)divisor(src1, src2, true)) \
+  f("00000000001000010 ????? ????? ?????"    , div.wu   , 3R    , R(rd) = src1 / divisor(src1, src2, false)) \
+  f("00000000001000011 ????? ????? ?????"    , mod.wu   , 3R    , R(rd) = src1 % divisor(src1, src2, false)) \
+  f("00000000010000001 ????? ????? ?????"    , slli.w   , 2RI5  , R(rd) = src1 << imm) \
+  f("00000000010001001 ????? ????? ?????"    , srli.w   , 2RI5  , R(rd) = src1 >> imm) \
+  f("00000000010010001 ????? ????? ?????"    , srai.w   , 2RI5  , R(rd) = (sword_t)src1 >> imm) \
+  f("0000001000 ???????????? ????? ?????"    , slti     , 2RI12 , R(rd) = (sword_t)src1 < (sword_t)imm) \
+  f("0000001001 ???????????? ????? ?????"    , sltui    , 2RI12 , R(rd) = src1 < imm) \
+  f("0000001010 ???????????? ????? ?????"    , addi.w   , 2RI12 , R(rd) = src1 + imm) \
+  f("0000001101 ???????????? ????? ?????"    , andi     , 2RI12U, R(rd) = src1 & imm) \
+  f("0000001110 ???????????? ????? ?????"    , ori      , 2RI12U, R(rd) = src1 | imm) \
+  f("0000001111 ???????????? ????? ?????"    , xori     , 2RI12U, R(rd) = src1 ^ imm) \
+  \
+  f("0010100000 ???????????? ????? ?????"    , ld.b     , 2RI12 , LOAD(SEXT(Mr(src1 + imm, 1), 8))) \
+  f("0010100001 ???????????? ????? ?????"    , ld.h     , 2RI12 , LOAD(SEXT(Mr(src1 + imm, 2), 16))) \
+  f("0010100010 ???????????? ????? ?????"    , ld.w     , 2RI12 , LOAD(Mr(src1 + imm, 4))) \
+  f("0010101000 ???????????? ????? ?????"    , ld.bu    , 2RI12 , LOAD(Mr(src1 + imm, 1))) \
+  f("0010101001 ???????????? ????? ?????"    , ld.hu    , 2RI12 , LOAD(Mr(src1 + imm, 2))) \
+  f("0010100100 ???????????? ????? ?????"    , st.b     , 2RI12 , Mw(src1 + imm, 1, R(rd))) \
+  f("0010100101 ???????????? ????? ?????"    , st.h     , 2RI12 , Mw(src1 + imm, 2, R(rd))) \
+  f("0010100110 ???????????? ????? ?????"    , st.w     , 2RI12 , Mw(src1 + imm, 4, R(rd))) \
+  f("0010101011 ???????????? ????? ?????"    , preld    , 2RI12 , ) \
+  f("00100000 ?????????????? ????? ?????"    , ll.w     , 2RI14 , LOAD(cpu.llval = Mr(src1 + imm, 4)); cpu.llbit = (cpu.exc == EXC_NONE)) \
+  f("00100001 ?????????????? ????? ?????"    , sc.w     , 2RI14 , SC(src1 + imm)) \
+  f("00111000011100100 ???????????????"      , dbar     , N     , vaddr_fence()) \
+  f("00111000011100101 ???????????????"      , ibar     , N     , ) \
+  \
+  f("010011 ???????????????? ????? ?????"    , jirl     , 2RI16 , s->dnpc = src1 + imm; R(rd) = s->snpc) \
+  f("010100 ???????????????? ??????????"     , b        , I26   , s->dnpc = s->pc + imm) \
+  f("010101 ???????????????? ??????????"     , bl       , I26   , R(1) = s->snpc; s->dnpc = s->pc + imm) \
+  f("010110 ???????????????? ????? ?????"    , beq      , 2RI16 , if (src1 == src2) s->dnpc = s->pc + imm) \
+  f("010111 ???????????????? ????? ?????"    , bne      , 2RI16 , if (src1 != src2) s->dnpc = s->pc + imm) \
+  f("011000 ???????????????? ????? ?????"    , blt      , 2RI16 , if ((sword_t)src1 < (sword_t)src2) s->dnpc = s->pc + imm) \
+  f("011001 ???????????????? ????? ?????"    , bge      , 2RI16 , if ((sword_t)src1 >= (sword_t)src2) s->dnpc = s->pc + imm) \
+  f("011010 ???????????????? ????? ?????"    , bltu     , 2RI16 , if (src1 < src2) s->dnpc = s->pc + imm) \
+  f("011011 ???????????????? ????? ?????"    , bgeu     , 2RI16 , if (src1 >= src2) s->dnpc = s->pc + imm) \
+  \
+  f("00000100 ?????????????? 00000 ?????"    , csrrd    , CSR   , PRIV(R(rd) = csr_rw(imm, 0, 0))) \
+  f("00000100 ?????????????? 00001 ?????"    , csrwr    , CSR   , PRIV(R(rd) = csr_rw(imm, R(rd), -1))) \
+  f("00000100 ?????????????? ????? ?????"    , csrxchg  , CSR   , PRIV(R(rd) = csr_rw(imm, R(rd), src1))) \
+  f("0000011000 ???????????? ????? ?????"    , cacop    , N     , ) \
+  f("0000 0110 0100 1000 0010 1000 0000 0000", tlbsrch  , N     , PRIV(tlb_search())) \
+  f("0000 0110 0100 1000 0010 1100 0000 0000", tlbrd    , N     , PRIV(tlb_read())) \
+  f("0000 0110 0100 1000 0011 0000 0000 0000", tlbwr    , N     , PRIV(tlb_write(false))) \
+  f("0000 0110 0100 1000 0011 0100 0000 0000", tlbfill  , N     , PRIV(tlb_write(true))) \
+  f("0000 0110 0100 1000 0011 1000 0000 0000", ertn     , N     , PRIV(s->dnpc = ertn())) \
+  f("00000110010010001 ???????????????"      , idle     , N     , PRIV(if (isa_query_intr() == INTR_EMPTY) { s->dnpc = s->pc; cpu.idle = true; })) \
+  f("00000110010010011 ????? ????? ?????"    , invtlb   , 3R    , PRIV(if (!tlb_inv(rd, src1, src2)) raise_exc(EXC_INE, 0))) \
+  f("0000000000000000011000 00000 ?????"     , rdcntvl.w, N     , R(BITS(s->isa.inst.val, 4, 0)) = timer_counter()) \
+  f("0000000000000000011001 00000 ?????"     , rdcntvh.w, N     , R(BITS(s->isa.inst.val, 4, 0)) = timer_counter() >> 32) \
+  f("0000000000000000011000 ????? 00000"     , rdcntid.w, N     , R(BITS(s->isa.inst.val, 9, 5)) = csr(CSR_TID)) \
+  \
+  f("00000000001010110 ???????????????"      , syscall  , N     , raise_exc(EXC_SYS, 0)) \
+  f("00000000001010100 ???????????????"      , break    , N     , NEMUTRAP(s->pc, R(4))) /* R(4) is $a0 */ \
+  f("????????????????? ????? ????? ?????"    , inv      , N     , if (csr(CSR_EENTRY) == 0) INV(s->pc); else raise_exc(EXC_INE, 0))
+
+// indexed by inst[31:15], the first entry which may match the instruction
+static uint8_t instpat_first[1 << 17];
+
+void init_decode() {
+  static const char *patterns[] = { INSTPAT_LIST(INSTPAT_PATTERN) };
+  instpat_build_table(instpat_first, 0xffff8000, patterns, ARRLEN(patterns));
+}
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -50,15 +184,11 @@ static int decode_exec(Decode *s) {
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
   __VA_ARGS__ ; \
+  if (unlikely(cpu.exc != EXC_NONE)) s->dnpc = isa_raise_intr(cpu.exc, s->pc); \
 }
 
   INSTPAT_START();
-  INSTPAT("0001110 ????? ????? ????? ????? ?????" , pcaddu12i, 1RI20 , R(rd) = s->pc + imm);
-  INSTPAT("0010100010 ???????????? ????? ?????"   , ld.w     , 2RI12 , R(rd) = Mr(src1 + imm, 4));
-  INSTPAT("0010100110 ???????????? ????? ?????"   , st.w     , 2RI12 , Mw(src1 + imm, 4, R(rd)));
-
-  INSTPAT("0000 0000 0010 10100 ????? ????? ?????", break    , N     , NEMUTRAP(s->pc, R(4))); // R(4) is $a0
-  INSTPAT("????????????????? ????? ????? ?????"   , inv      , N     , INV(s->pc));
+  INSTPAT_SWITCH(instpat_first[INSTPAT_INST(s) >> 15], INSTPAT_LIST);
   INSTPAT_END();
 
   R(0) = 0; // reset $zero to 0
@@ -68,5 +198,33 @@ static int decode_exec(Decode *s) {
 
 int isa_exec_once(Decode *s) {
   s->isa.inst.val = inst_fetch(&s->snpc, 4);
+  if (unlikely(cpu.exc != EXC_NONE)) {
+    s->dnpc = isa_raise_intr(cpu.exc, s->pc);
+    return 0;
+  }
   return decode_exec(s);
 }
+
+#ifdef CONFIG_JIT_STENCIL
+// the index of the entry matching `inst' in the instruction list, which is also its stencil
+int isa_instpat_idx(uint32_t inst) {
+  Decode d = { .isa.inst.val = inst }, *s = &d;
+  int idx = -1;
+#undef INSTPAT_MATCH
+#define INSTPAT_MATCH(s, ...) return idx
+#define INSTPAT_IDX(...) idx ++; INSTPAT(__VA_ARGS__);
+  INSTPAT_START(idx);
+  INSTPAT_LIST(INSTPAT_IDX)
+  INSTPAT_END(idx);
+  return -1;
+}
+#endif
+
+#ifdef __STENCIL__
+#define STENCIL_END(s) do { \
+  R(0) = 0; \
+  if (unlikely(cpu.exc != EXC_NONE)) s->dnpc = isa_raise_intr(cpu.exc, s->pc); \
+} while (0)
+#include <stencil.h>
+INSTPAT_LIST(STENCIL)
+#endif
@@ -0,0 +1,99 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __LOONGARCH32R_CSR_H__
+#define __LOONGARCH32R_CSR_H__
+
+#include <isa.h>
+
+enum {
+  CSR_CRMD = 0x0, CSR_PRMD = 0x1, CSR_EUEN = 0x2, CSR_ECFG = 0x4,
+  CSR_ESTAT = 0x5, CSR_ERA = 0x6, CSR_BADV = 0x7, CSR_EENTRY = 0xc,
+  CSR_TLBIDX = 0x10, CSR_TLBEHI = 0x11, CSR_TLBELO0 = 0x12, CSR_TLBELO1 = 0x13,
+  CSR_ASID = 0x18, CSR_PGDL = 0x19, CSR_PGDH = 0x1a, CSR_PGD = 0x1b,
+  CSR_CPUID = 0x20,
+  CSR_SAVE0 = 0x30, CSR_SAVE1 = 0x31, CSR_SAVE2 = 0x32, CSR_SAVE3 = 0x33,
+  CSR_TID = 0x40, CSR_TCFG = 0x41, CSR_TVAL = 0x42, CSR_TICLR = 0x44,
+  CSR_LLBCTL = 0x60, CSR_TLBRENTRY = 0x88, CSR_CTAG = 0x98,
+  CSR_DMW0 = 0x180, CSR_DMW1 = 0x181,
+};
+
+#define csr(n) cpu.csr[n]
+
+// exception codes, in ESTAT.Ecode
+enum {
+  EXC_INT = 0x0, EXC_PIL = 0x1, EXC_PIS = 0x2, EXC_PIF = 0x3, EXC_PME = 0x4,
+  EXC_PPI = 0x7, EXC_ADE = 0x8, EXC_ALE = 0x9, EXC_SYS = 0xb, EXC_BRK = 0xc,
+  EXC_INE = 0xd, EXC_IPE = 0xe, EXC_FPD = 0xf, EXC_TLBR = 0x3f,
+};
+// with EsubCode above the 6 bits of Ecode
+#define EXC_ADEF EXC_ADE
+
+#define CRMD_PLV  0x3
+#define CRMD_IE   0x4
+#define CRMD_DA   0x8
+#define CRMD_PG   0x10
+#define PRMD_PPLV 0x3
+#define PRMD_PIE  0x4
+#define ECFG_LIE  0x1bff
+#define ECFG_VS(x) BITS(x, 18, 16)
+#define ESTAT_IS  0x1bff      // SWI 1:0, HWI 9:2, TI 11, IPI 12
+#define ESTAT_SWI 0x3
+#define ESTAT_HWI 0x3fc
+#define ESTAT_TI  (1u << 11)
+#define ESTAT_ECODE (0x7fffu << 16) // with EsubCode
+#define TLBIDX_NE (1u << 31)
+#define TLBIDX_PS(x) BITS(x, 29, 24)
+#define TLBELO_V  0x1
+#define TLBELO_D  0x2
+#define TLBELO_PLV(x) BITS(x, 3, 2)
+#define TLBELO_G  (1u << 6)
+#define TLBELO_PPN(x) BITS(x, 27, 8) // PALEN is 32, bits 31:28 are 0
+#define DMW_VSEG(x) BITS(x, 31, 29)
+#define DMW_PSEG(x) BITS(x, 27, 25)
+#define TCFG_EN   0x1
+#define TCFG_PERIODIC 0x2
+#define TICLR_CLR 0x1
+#define LLBCTL_ROLLB 0x1
+#define LLBCTL_WCLLB 0x2
+#define LLBCTL_KLO 0x4
+
+// raise an exception at the end of the running instruction, the first one is kept
+static inline void raise_exc(word_t code, word_t badv) {
+  if (cpu.exc == EXC_NONE) { cpu.exc = code; cpu.badv = badv; }
+}
+
+// the privileged instructions, in system/priv.c
+word_t csr_rw(uint32_t num, word_t data, word_t mask);
+vaddr_t ertn();
+
+// the TLB instructions, in system/mmu.c, invtlb returns false if `op' is not defined
+void tlb_search();
+void tlb_read();
+void tlb_write(bool fill);
+bool tlb_inv(int op, word_t asid, vaddr_t va);
+// recompute cpu.pg after CRMD is changed, in system/mmu.c
+void mmu_update();
+
+// recompute cpu.intr after ESTAT, ECFG or CRMD.IE is changed, in system/intr.c
+void intr_update();
+
+// the stable counter and the timer, in system/timer.c
+uint64_t timer_counter();
+word_t timer_tval();
+void timer_start();
+
+#endif
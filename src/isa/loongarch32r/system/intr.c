@@ -13,16 +13,54 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+/* Exceptions and interrupts. Whether an interrupt is to be taken is kept
+ * in cpu.intr, which is recomputed when ESTAT, ECFG or CRMD.IE changes,
+ * so checking it costs a load and a branch.
+ */
+
 #include <isa.h>
+#include "../local-include/csr.h"
+
+void intr_update() {
+  cpu.intr = (csr(CSR_CRMD) & CRMD_IE) ? (csr(CSR_ESTAT) & csr(CSR_ECFG) & ESTAT_IS) : 0;
+}
 
-word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+static inline bool tlb_exc(word_t code) {
+  return code == EXC_TLBR || (code >= EXC_PIL && code <= EXC_PME) || code == EXC_PPI;
+}
 
-  return 0;
+/* Enter the handler of exception `NO' raised by the instruction at `epc',
+ * return its address. `NO' is Ecode with EsubCode above it, and BADV is
+ * taken from cpu.badv for the exceptions of an address, which also sets
+ * TLBEHI for the exceptions of the TLB. TLBR is taken in direct address
+ * translation mode at TLBRENTRY.
+ */
+vaddr_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  word_t code = NO & 0x3f;
+  // an interrupt is vectored by its highest pending line
+  word_t vec = (code == EXC_INT && cpu.intr != 0 ? 64 + 31 - __builtin_clz(cpu.intr) : code);
+  if (code == EXC_ADE || code == EXC_ALE || tlb_exc(code)) csr(CSR_BADV) = cpu.badv;
+  if (tlb_exc(code)) csr(CSR_TLBEHI) = cpu.badv & ~0x1fffu;
+  cpu.exc = EXC_NONE;
+  csr(CSR_PRMD) = (csr(CSR_PRMD) & ~(PRMD_PPLV | PRMD_PIE)) | (csr(CSR_CRMD) & (CRMD_PLV | CRMD_IE));
+  csr(CSR_CRMD) &= ~(CRMD_PLV | CRMD_IE);
+  // `idle' is repeated while waiting, and left when the interrupt returns
+  csr(CSR_ERA) = (cpu.idle ? epc + 4 : epc);
+  cpu.idle = false;
+  csr(CSR_ESTAT) = (csr(CSR_ESTAT) & ~ESTAT_ECODE) | (NO << 16);
+  intr_update();
+  if (code == EXC_TLBR) {
+    csr(CSR_CRMD) = (csr(CSR_CRMD) & ~CRMD_PG) | CRMD_DA;
+    mmu_update();
+    return csr(CSR_TLBRENTRY);
+  }
+  int vs = ECFG_VS(csr(CSR_ECFG));
+  return csr(CSR_EENTRY) + (vs == 0 ? 0 : vec << (vs + 2));
 }
 
-word_t isa_query_intr() {
-  return INTR_EMPTY;
+// devices share HWI0
+void isa_dev_intr(bool level) {
+  if (level) csr(CSR_ESTAT) |= 1u << 2;
+  else csr(CSR_ESTAT) &= ~(1u << 2);
+  intr_update();
 }
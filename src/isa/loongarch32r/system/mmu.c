@@ -13,10 +13,151 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+/* Address translation. In direct address translation mode (CRMD.DA) the
+ * physical address is the virtual one. In mapped address translation mode
+ * (CRMD.PG) an address in a direct mapped window of the privilege level,
+ * DMW0 or DMW1, maps its top 3 bits, and the other ones are looked up in
+ * the TLB.
+ *
+ * The TLB is fully associative, every entry maps a pair of an even and an
+ * odd page of 4KB or 4MB, and is written by software only, with tlbwr at
+ * TLBIDX.Index or with tlbfill at an index taken in turn. A miss raises
+ * TLBR, which software refills. Every hart has its own TLB.
+ */
+
 #include <isa.h>
 #include <memory/paddr.h>
 #include <memory/vaddr.h>
+#include <cpu/cpu.h>
+#include "../local-include/csr.h"
+
+#define TLB_SIZE 32
+#define ASID_MASK 0x3ffu
+
+typedef struct {
+  bool e, g;
+  int ps;        // log2 of the page size
+  word_t asid;
+  vaddr_t vppn;  // bits 31:13 of the virtual address, as in TLBEHI
+  word_t elo[2]; // the even and the odd page, as in TLBELO0 and TLBELO1
+} TLBEntry;
+
+typedef struct {
+  TLBEntry e[TLB_SIZE];
+  int fill;      // the index written by the next tlbfill
+  int last;      // the entry matched last, which is tried first
+} TLB;
+
+static TLB tlbs[CONFIG_NR_HART] = {};
+#define tlb (&tlbs[MUXONE(CONFIG_NR_HART, 0, cpu_hart_id())])
+
+static inline bool va_match(TLBEntry *t, vaddr_t va) {
+  return ((va ^ t->vppn) >> (t->ps + 1)) == 0;
+}
+
+// the index of the entry mapping `va' in the address space `asid', or -1
+static inline bool entry_match(TLBEntry *t, vaddr_t va, word_t asid) {
+  return t->e && (t->g || t->asid == asid) && va_match(t, va);
+}
+
+static int tlb_match(vaddr_t va, word_t asid) {
+  TLB *c = tlb;
+  if (entry_match(&c->e[c->last], va, asid)) return c->last;
+  for (int i = 0; i < TLB_SIZE; i ++) {
+    if (entry_match(&c->e[i], va, asid)) return (c->last = i);
+  }
+  return -1;
+}
+
+void tlb_search() {
+  int i = tlb_match(csr(CSR_TLBEHI), csr(CSR_ASID) & ASID_MASK);
+  if (i < 0) csr(CSR_TLBIDX) |= TLBIDX_NE;
+  else csr(CSR_TLBIDX) = (csr(CSR_TLBIDX) & ~(TLBIDX_NE | 0xffffu)) | i;
+}
+
+void tlb_read() {
+  TLBEntry *t = &tlb->e[csr(CSR_TLBIDX) & (TLB_SIZE - 1)];
+  word_t idx = csr(CSR_TLBIDX) & ~(TLBIDX_NE | (0x3fu << 24));
+  if (!t->e) {
+    csr(CSR_TLBIDX) = idx | TLBIDX_NE;
+    csr(CSR_TLBEHI) = csr(CSR_TLBELO0) = csr(CSR_TLBELO1) = 0;
+    csr(CSR_ASID) &= ~ASID_MASK;
+    return;
+  }
+  csr(CSR_TLBIDX) = idx | ((word_t)t->ps << 24);
+  csr(CSR_TLBEHI) = t->vppn;
+  // G is kept once for both pages
+  csr(CSR_TLBELO0) = (t->elo[0] & ~TLBELO_G) | (t->g ? TLBELO_G : 0);
+  csr(CSR_TLBELO1) = (t->elo[1] & ~TLBELO_G) | (t->g ? TLBELO_G : 0);
+  csr(CSR_ASID) = (csr(CSR_ASID) & ~ASID_MASK) | t->asid;
+}
+
+// an entry written by the handler of TLBR is valid whatever TLBIDX.NE is
+void tlb_write(bool fill) {
+  TLB *c = tlb;
+  int i = (fill ? c->fill : csr(CSR_TLBIDX) & (TLB_SIZE - 1));
+  if (fill) c->fill = (c->fill + 1) % TLB_SIZE;
+  TLBEntry *t = &c->e[i];
+  t->e = BITS(csr(CSR_ESTAT), 21, 16) == EXC_TLBR || !(csr(CSR_TLBIDX) & TLBIDX_NE);
+  t->g = (csr(CSR_TLBELO0) & csr(CSR_TLBELO1) & TLBELO_G) != 0;
+  t->ps = TLBIDX_PS(csr(CSR_TLBIDX));
+  t->asid = csr(CSR_ASID) & ASID_MASK;
+  t->vppn = csr(CSR_TLBEHI);
+  t->elo[0] = csr(CSR_TLBELO0);
+  t->elo[1] = csr(CSR_TLBELO1);
+}
+
+// whether invtlb `op' clears the entry `t'
+static bool inv_match(int op, TLBEntry *t, word_t asid, vaddr_t va) {
+  switch (op) {
+    case 0: case 1: return true;
+    case 2: return t->g;
+    case 3: return !t->g;
+    case 4: return !t->g && t->asid == asid;
+    case 5: return !t->g && t->asid == asid && va_match(t, va);
+    default: return (t->g || t->asid == asid) && va_match(t, va);
+  }
+}
+
+bool tlb_inv(int op, word_t asid, vaddr_t va) {
+  if (op > 6) return false;
+  TLB *c = tlb;
+  for (int i = 0; i < TLB_SIZE; i ++) {
+    if (inv_match(op, &c->e[i], asid & ASID_MASK, va)) c->e[i].e = false;
+  }
+  return true;
+}
+
+int isa_mmu_misaligned(vaddr_t vaddr, int type) {
+  raise_exc(type == MEM_TYPE_IFETCH ? EXC_ADEF : EXC_ALE, vaddr);
+  return MMU_FAIL;
+}
+
+void mmu_update() {
+  cpu.pg = (csr(CSR_CRMD) & (CRMD_DA | CRMD_PG)) == CRMD_PG;
+}
 
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
-  return MEM_RET_FAIL;
+  int plv = csr(CSR_CRMD) & CRMD_PLV;
+  for (int k = 0; k < 2; k ++) {
+    // DMW.PLV0 is bit 0 and DMW.PLV3 is bit 3
+    word_t dmw = csr(CSR_DMW0 + k);
+    if ((dmw & (1u << plv)) && DMW_VSEG(dmw) == BITS(vaddr, 31, 29)) {
+      return ((DMW_PSEG(dmw) << 29) | (vaddr & 0x1ffff000u)) | MEM_RET_OK;
+    }
+  }
+
+  int i = tlb_match(vaddr, csr(CSR_ASID) & ASID_MASK);
+  if (i < 0) { raise_exc(EXC_TLBR, vaddr); return MEM_RET_FAIL; }
+  TLBEntry *t = &tlb->e[i];
+  word_t elo = t->elo[(vaddr >> t->ps) & 1];
+  static const word_t invalid[] = { [MEM_TYPE_IFETCH] = EXC_PIF, [MEM_TYPE_READ] = EXC_PIL, [MEM_TYPE_WRITE] = EXC_PIS };
+  word_t exc = EXC_NONE;
+  if (!(elo & TLBELO_V)) exc = invalid[type];
+  else if (plv > TLBELO_PLV(elo)) exc = EXC_PPI;
+  else if (type == MEM_TYPE_WRITE && !(elo & TLBELO_D)) exc = EXC_PME;
+  if (exc != EXC_NONE) { raise_exc(exc, vaddr); return MEM_RET_FAIL; }
+  paddr_t mask = ((paddr_t)1 << t->ps) - 1;
+  paddr_t pa = (((paddr_t)TLBELO_PPN(elo) << PAGE_SHIFT) & ~mask) | (vaddr & mask);
+  return (pa & ~(paddr_t)PAGE_MASK) | MEM_RET_OK;
 }
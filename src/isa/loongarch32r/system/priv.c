@@ -0,0 +1,88 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+/* The privileged instructions which are more than a line, but the TLB
+ * ones, which are in system/mmu.c.
+ */
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include "../local-include/csr.h"
+
+// the bits of each CSR written by software, a CSR not listed stays 0
+static const word_t csr_mask[ARRLEN(cpu.csr)] = {
+  [CSR_CRMD] = 0x1ff, [CSR_PRMD] = 0x7, [CSR_EUEN] = 0x1,
+  [CSR_ECFG] = 0x70000 | ECFG_LIE, [CSR_ESTAT] = ESTAT_SWI,
+  [CSR_ERA] = -1, [CSR_BADV] = -1, [CSR_EENTRY] = ~0x3fu,
+  [CSR_TLBIDX] = 0xbf00ffff, [CSR_TLBEHI] = ~0x1fffu,
+  [CSR_TLBELO0] = 0x0fffff7f, [CSR_TLBELO1] = 0x0fffff7f,
+  [CSR_ASID] = 0x3ff, [CSR_PGDL] = ~0xfffu, [CSR_PGDH] = ~0xfffu,
+  [CSR_SAVE0] = -1, [CSR_SAVE1] = -1, [CSR_SAVE2] = -1, [CSR_SAVE3] = -1,
+  [CSR_TID] = -1, [CSR_TCFG] = -1, [CSR_TICLR] = TICLR_CLR,
+  [CSR_LLBCTL] = LLBCTL_WCLLB | LLBCTL_KLO, [CSR_TLBRENTRY] = ~0x3fu,
+  [CSR_CTAG] = -1, [CSR_DMW0] = 0xee000039, [CSR_DMW1] = 0xee000039,
+};
+
+static word_t csr_read(uint32_t num) {
+  switch (num) {
+    case CSR_PGD: return csr(BITS(csr(CSR_BADV), 31, 31) ? CSR_PGDH : CSR_PGDL);
+    case CSR_CPUID: return cpu_hart_id();
+    case CSR_LLBCTL: return csr(CSR_LLBCTL) | (cpu.llbit ? LLBCTL_ROLLB : 0);
+    case CSR_TVAL: return timer_tval();
+    default: return csr(num);
+  }
+}
+
+/* Write the bits of `data' selected by `mask' to a CSR, return its old
+ * value. Bits which are not writable are kept, and the write-1-to-clear
+ * bits are never stored.
+ */
+word_t csr_rw(uint32_t num, word_t data, word_t mask) {
+  if (num >= ARRLEN(cpu.csr)) return 0;
+  word_t old = csr_read(num);
+  mask &= csr_mask[num];
+  if (mask == 0) return old;
+  data &= mask;
+  switch (num) {
+    case CSR_TICLR:
+      if (data & TICLR_CLR) csr(CSR_ESTAT) &= ~ESTAT_TI;
+      break;
+    case CSR_LLBCTL:
+      if (data & LLBCTL_WCLLB) cpu.llbit = false;
+      csr(num) = (csr(num) & ~LLBCTL_KLO) | (data & LLBCTL_KLO);
+      break;
+    case CSR_TCFG:
+      csr(num) = data;
+      timer_start();
+      break;
+    default:
+      csr(num) = (csr(num) & ~mask) | data;
+  }
+  intr_update();
+  mmu_update();
+  return old;
+}
+
+// return from an exception, the next pc is returned, mapped translation is back after TLBR
+vaddr_t ertn() {
+  csr(CSR_CRMD) = (csr(CSR_CRMD) & ~(CRMD_PLV | CRMD_IE)) | (csr(CSR_PRMD) & (PRMD_PPLV | PRMD_PIE));
+  if (BITS(csr(CSR_ESTAT), 21, 16) == EXC_TLBR) csr(CSR_CRMD) = (csr(CSR_CRMD) & ~CRMD_DA) | CRMD_PG;
+  mmu_update();
+  if (csr(CSR_LLBCTL) & LLBCTL_KLO) csr(CSR_LLBCTL) &= ~LLBCTL_KLO;
+  else cpu.llbit = false;
+  intr_update();
+  return csr(CSR_ERA);
+}
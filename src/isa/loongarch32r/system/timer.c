@@ -0,0 +1,71 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The stable counter and the timer run in virtual time. A tick is
+ * CONFIG_TIMER_RATIO guest instructions, so nothing is counted until they
+ * are read, and the timer only sets a deadline on the instruction count.
+ * TVAL is computed from the tick when the timer expires.
+ */
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include "../local-include/csr.h"
+
+#define NEVER UINT64_MAX
+
+static inline uint64_t ticks() {
+  return cpu_inst_count() / CONFIG_TIMER_RATIO;
+}
+
+// the initial value of the countdown
+static inline word_t timer_init() {
+  return csr(CSR_TCFG) & ~(TCFG_EN | TCFG_PERIODIC);
+}
+
+static void set_deadline() {
+  cpu_set_deadline(cpu.timer == NEVER ? NEVER : cpu.timer * CONFIG_TIMER_RATIO);
+}
+
+uint64_t timer_counter() {
+  return ticks();
+}
+
+word_t timer_tval() {
+  if (cpu.timer == NEVER) return 0;
+  uint64_t now = ticks();
+  return (cpu.timer > now ? cpu.timer - now : 0);
+}
+
+// called when TCFG is written
+void timer_start() {
+  cpu.timer = (csr(CSR_TCFG) & TCFG_EN) ? ticks() + timer_init() : NEVER;
+  set_deadline();
+}
+
+void isa_timer_update() {
+  uint64_t now = ticks();
+  if (cpu.timer <= now) {
+    csr(CSR_ESTAT) |= ESTAT_TI;
+    intr_update();
+    word_t period = timer_init();
+    if ((csr(CSR_TCFG) & TCFG_PERIODIC) && period != 0) {
+      // the periods passed while this hart was parked are not raised again
+      cpu.timer += (now - cpu.timer) / period * period + period;
+    } else {
+      cpu.timer = NEVER;
+    }
+  }
+  set_deadline();
+}
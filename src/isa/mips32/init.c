@@ -36,6 +36,7 @@ static void restart() {
 void init_isa() {
   /* Load built-in image. */
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
+  pmem_host_written(RESET_VECTOR, sizeof(img));
 
   /* Initialize this virtual computer system. */
   restart();
@@ -26,3 +26,9 @@ word_t isa_raise_intr(word_t NO, vaddr_t epc) {
 word_t isa_query_intr() {
   return INTR_EMPTY;
 }
+
+void isa_dev_intr(bool level) {
+}
+
+void isa_timer_update() {
+}
@@ -21,15 +21,30 @@
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+  struct {
+    word_t mstatus, medeleg, mideleg, mie, mip, mtvec, mcounteren, mscratch, mepc, mcause, mtval;
+    word_t stvec, scounteren, sscratch, sepc, scause, stval, satp;
+  } csr;           // sstatus, sie and sip are views of the machine CSRs, see local-include/csr.h
+  int priv;        // the privilege mode, PRV_*
+  bool idle;       // waiting in `wfi' for an interrupt
+  uint8_t vm;      // bit MEM_TYPE_* is set if the accesses of the type are translated
+  word_t intr;     // the cause of the interrupt to be taken, or 0, kept by system/intr.c
+  vaddr_t reserve; // the address reserved by lr, or -1
+  word_t reserve_val; // loaded by lr, sc only writes memory while it still holds it
+  word_t exc, tval; // the exception raised by the running instruction, or EXC_NONE
 } riscv32_CPU_state;
 
 // decode
 typedef struct {
   union {
     uint32_t val;
-  } inst;
+  } inst;          // as fetched, a compressed instruction in the low half
+  uint32_t inst32; // the instruction executed, a compressed one is expanded
 } riscv32_ISADecodeInfo;
 
-#define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+#define isa_mmu_check(vaddr, len, type) ((cpu.vm >> (type)) & 1 ? MMU_TRANSLATE : MMU_DIRECT)
+#define isa_query_intr() (cpu.intr != 0 ? cpu.intr : INTR_EMPTY)
+// other harts may write the reserved word while this one is parked
+#define isa_hart_switch() (cpu.reserve = (vaddr_t)-1)
 
 #endif
@@ -13,16 +13,66 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+/* Traps. The interrupt to be taken is kept in cpu.intr, which is
+ * recomputed when mstatus, mip, mie, mideleg or the privilege mode changes,
+ * so checking it costs a load and a branch.
+ */
+
 #include <isa.h>
+#include "../local-include/csr.h"
 
-word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+void intr_update() {
+  word_t pending = csr(mip) & csr(mie);
+  bool m_enabled = cpu.priv < PRV_M || (csr(mstatus) & MSTATUS_MIE);
+  bool s_enabled = cpu.priv < PRV_S || (cpu.priv == PRV_S && (csr(mstatus) & MSTATUS_SIE));
+  word_t m = (m_enabled ? pending & ~csr(mideleg) : 0);
+  word_t s = (s_enabled ? pending & csr(mideleg) : 0);
+  // those to M-mode first, each in the order of priority
+  word_t enabled = (m != 0 ? m : s);
+  static const int order[] = { IRQ_MEI, IRQ_MSI, IRQ_MTI, IRQ_SEI, IRQ_SSI, IRQ_STI };
+  cpu.intr = 0;
+  for (int i = 0; enabled != 0 && i < ARRLEN(order); i ++) {
+    if (enabled & (1u << order[i])) { cpu.intr = INTR_BIT | order[i]; break; }
+  }
+}
 
-  return 0;
+/* Enter the handler of trap `NO' at the instruction `epc', return its
+ * address. A trap goes to S-mode if it is delegated and not raised in
+ * M-mode. The value of mtval or stval is taken from cpu.tval.
+ */
+vaddr_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  bool intr = (NO & INTR_BIT) != 0;
+  word_t code = NO & ~INTR_BIT;
+  word_t tval = (intr ? 0 : cpu.tval);
+  // `wfi' is repeated while waiting, and left when the interrupt returns
+  if (cpu.idle) { epc += 4; cpu.idle = false; }
+  cpu.exc = EXC_NONE;
+  cpu.tval = 0;
+  cpu.reserve = (vaddr_t)-1;
+  word_t st = csr(mstatus), vec;
+  if (cpu.priv <= PRV_S && (((intr ? csr(mideleg) : csr(medeleg)) >> code) & 1)) {
+    csr(scause) = NO; csr(sepc) = epc; csr(stval) = tval;
+    st = (st & ~(MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP)) | ((st & MSTATUS_SIE) ? MSTATUS_SPIE : 0) |
+      (cpu.priv == PRV_S ? MSTATUS_SPP : 0);
+    cpu.priv = PRV_S;
+    vec = csr(stvec);
+  } else {
+    csr(mcause) = NO; csr(mepc) = epc; csr(mtval) = tval;
+    st = (st & ~(MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPP)) | ((st & MSTATUS_MIE) ? MSTATUS_MPIE : 0) |
+      ((word_t)cpu.priv << MSTATUS_MPP_SHIFT);
+    cpu.priv = PRV_M;
+    vec = csr(mtvec);
+  }
+  csr(mstatus) = st;
+  intr_update();
+  mmu_update();
+  // interrupts are vectored in the vectored mode
+  return (vec & ~(word_t)3) + ((vec & 1) && intr ? 4 * code : 0);
 }
 
-word_t isa_query_intr() {
-  return INTR_EMPTY;
+// devices share the supervisor external interrupt, there is no PLIC
+void isa_dev_intr(bool level) {
+  if (level) csr(mip) |= MIP_SEIP;
+  else csr(mip) &= ~MIP_SEIP;
+  intr_update();
 }
@@ -0,0 +1,169 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The CSRs and the privileged instructions which are more than a line.
+ * Physical memory protection is not implemented, its CSRs read as 0 and
+ * ignore writes, and so do the counters which are not listed.
+ */
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include "../local-include/csr.h"
+
+#define MISA ((1u << 30) | (1u << ('A' - 'A')) | (1u << ('C' - 'A')) | (1u << ('I' - 'A')) | \
+              (1u << ('M' - 'A')) | (1u << ('S' - 'A')) | (1u << ('U' - 'A')))
+
+// cycle, time and instret below M-mode are enabled by mcounteren, and below S-mode also by scounteren
+static bool counter_enabled(uint32_t num) {
+  word_t bit = 1u << (num & 0x1f);
+  if (cpu.priv < PRV_M && !(csr(mcounteren) & bit)) return false;
+  if (cpu.priv < PRV_S && !(csr(scounteren) & bit)) return false;
+  return true;
+}
+
+static bool csr_read(uint32_t num, word_t *val) {
+  switch (num) {
+    case CSR_SSTATUS:    *val = csr(mstatus) & SSTATUS_MASK; break;
+    case CSR_SIE:        *val = csr(mie) & csr(mideleg); break;
+    case CSR_STVEC:      *val = csr(stvec); break;
+    case CSR_SCOUNTEREN: *val = csr(scounteren); break;
+    case CSR_SSCRATCH:   *val = csr(sscratch); break;
+    case CSR_SEPC:       *val = csr(sepc); break;
+    case CSR_SCAUSE:     *val = csr(scause); break;
+    case CSR_STVAL:      *val = csr(stval); break;
+    case CSR_SIP:        *val = csr(mip) & csr(mideleg); break;
+    case CSR_SATP:
+      if (cpu.priv == PRV_S && (csr(mstatus) & MSTATUS_TVM)) return false;
+      *val = csr(satp);
+      break;
+    case CSR_MSTATUS:    *val = csr(mstatus); break;
+    case CSR_MISA:       *val = MISA; break;
+    case CSR_MEDELEG:    *val = csr(medeleg); break;
+    case CSR_MIDELEG:    *val = csr(mideleg); break;
+    case CSR_MIE:        *val = csr(mie); break;
+    case CSR_MTVEC:      *val = csr(mtvec); break;
+    case CSR_MCOUNTEREN: *val = csr(mcounteren); break;
+    case CSR_MSCRATCH:   *val = csr(mscratch); break;
+    case CSR_MEPC:       *val = csr(mepc); break;
+    case CSR_MCAUSE:     *val = csr(mcause); break;
+    case CSR_MTVAL:      *val = csr(mtval); break;
+    case CSR_MIP:        *val = csr(mip); break;
+    case CSR_MHARTID:    *val = cpu_hart_id(); break;
+    case CSR_MSTATUSH: case CSR_MCOUNTINHIBIT:
+    case CSR_MVENDORID: case CSR_MARCHID: case CSR_MIMPID: *val = 0; break;
+    // every instruction takes a cycle
+    case CSR_MCYCLE: case CSR_MINSTRET: *val = cpu_inst_count(); break;
+    case CSR_MCYCLEH: case CSR_MINSTRETH: *val = cpu_inst_count() >> 32; break;
+    case CSR_CYCLE: case CSR_INSTRET:
+      if (!counter_enabled(num)) return false;
+      *val = cpu_inst_count();
+      break;
+    case CSR_CYCLEH: case CSR_INSTRETH:
+      if (!counter_enabled(num)) return false;
+      *val = cpu_inst_count() >> 32;
+      break;
+    case CSR_TIME:
+      if (!counter_enabled(num)) return false;
+      *val = timer_time();
+      break;
+    case CSR_TIMEH:
+      if (!counter_enabled(num)) return false;
+      *val = timer_time() >> 32;
+      break;
+    default:
+      if (num >= CSR_PMPCFG0 && num < CSR_PMPADDR0 + 64) { *val = 0; break; }
+      return false;
+  }
+  return true;
+}
+
+static void mstatus_write(word_t val) {
+  // MPP is WARL, and the reserved mode 2 becomes U-mode
+  if (BITS(val, 12, 11) == 2) val &= ~MSTATUS_MPP;
+  csr(mstatus) = (csr(mstatus) & ~MSTATUS_MASK) | (val & MSTATUS_MASK);
+}
+
+static void csr_write(uint32_t num, word_t val) {
+  switch (num) {
+    case CSR_SSTATUS:    mstatus_write((csr(mstatus) & ~SSTATUS_MASK) | (val & SSTATUS_MASK)); break;
+    case CSR_SIE:        csr(mie) = (csr(mie) & ~csr(mideleg)) | (val & csr(mideleg)); break;
+    case CSR_STVEC:      csr(stvec) = val & ~(word_t)2; break;
+    case CSR_SCOUNTEREN: csr(scounteren) = val & 0x7; break;
+    case CSR_SSCRATCH:   csr(sscratch) = val; break;
+    case CSR_SEPC:       csr(sepc) = val & ~(word_t)1; break;
+    case CSR_SCAUSE:     csr(scause) = val; break;
+    case CSR_STVAL:      csr(stval) = val; break;
+    case CSR_SIP:        csr(mip) = (csr(mip) & ~(MIP_SSIP & csr(mideleg))) | (val & MIP_SSIP & csr(mideleg)); break;
+    case CSR_SATP:
+      // the write is ignored if the mode is not supported
+      if (SATP_VALID(val)) { csr(satp) = val; mmu_flush(0, true); }
+      break;
+    case CSR_MSTATUS:    mstatus_write(val); break;
+    case CSR_MEDELEG:    csr(medeleg) = val & MEDELEG_MASK; break;
+    case CSR_MIDELEG:    csr(mideleg) = val & MIP_S; break;
+    case CSR_MIE:        csr(mie) = val & (MIP_S | MIP_M); break;
+    case CSR_MTVEC:      csr(mtvec) = val & ~(word_t)2; break;
+    case CSR_MCOUNTEREN: csr(mcounteren) = val & 0x7; break;
+    case CSR_MSCRATCH:   csr(mscratch) = val; break;
+    case CSR_MEPC:       csr(mepc) = val & ~(word_t)1; break;
+    case CSR_MCAUSE:     csr(mcause) = val; break;
+    case CSR_MTVAL:      csr(mtval) = val; break;
+    // MSIP and MTIP follow the CLINT, MEIP is never raised
+    case CSR_MIP:        csr(mip) = (csr(mip) & ~MIP_S) | (val & MIP_S); break;
+    default: break;
+  }
+  intr_update();
+  mmu_update();
+}
+
+/* Read a CSR for a csr* instruction and return its value, and write the
+ * bits of `data' selected by `mask' to it if `wr' is set. An access which
+ * is not allowed raises an illegal instruction exception. The CSR number
+ * tells the lowest privilege mode in bits 9:8, and bits 11:10 are 3 for the
+ * read-only CSRs.
+ */
+word_t csr_rw(uint32_t num, word_t data, word_t mask, bool wr) {
+  word_t old = 0;
+  if (cpu.priv < BITS(num, 9, 8) || (wr && BITS(num, 11, 10) == 3) || !csr_read(num, &old)) {
+    raise_exc(EXC_II, 0);
+    return 0;
+  }
+  if (wr) csr_write(num, (old & ~mask) | (data & mask));
+  return old;
+}
+
+// return from a trap, the next pc is returned
+vaddr_t mret() {
+  word_t st = csr(mstatus);
+  int mpp = BITS(st, 12, 11);
+  st = (st & ~(MSTATUS_MIE | MSTATUS_MPP)) | MSTATUS_MPIE | ((st & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+  if (mpp != PRV_M) st &= ~MSTATUS_MPRV;
+  csr(mstatus) = st;
+  cpu.priv = mpp;
+  intr_update();
+  mmu_update();
+  return csr(mepc);
+}
+
+vaddr_t sret() {
+  word_t st = csr(mstatus);
+  int spp = (st & MSTATUS_SPP) ? PRV_S : PRV_U;
+  st = (st & ~(MSTATUS_SIE | MSTATUS_SPP | MSTATUS_MPRV)) | MSTATUS_SPIE | ((st & MSTATUS_SPIE) ? MSTATUS_SIE : 0);
+  csr(mstatus) = st;
+  cpu.priv = spp;
+  intr_update();
+  mmu_update();
+  return csr(sepc);
+}
@@ -0,0 +1,195 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+/* Built-in micro-kernels for `--kernel'. They are loaded at the reset vector
+ * in place of the built-in image and end with a good trap. The MMIO kernel
+ * polls the RTC at CONFIG_RTC_MMIO, so it only exists with a timer.
+ */
+
+// ALU loop: a dependent chain of add/xor/shift/logic operations
+static const uint32_t alu[] = {
+  0x003d12b7,  // lui t0, 977
+  0x9002829b,  // addiw t0, t0, -1792
+  0x00000313,  // li t1, 0
+  0x000123b7,  // lui t2, 18
+  0x3453839b,  // addiw t2, t2, 837
+  0x00530333,  // add t1, t1, t0
+  0x0063c3b3,  // xor t2, t2, t1
+  0x00339413,  // slli s0, t2, 3
+  0x0053d493,  // srli s1, t2, 5
+  0x00946433,  // or s0, s0, s1
+  0x40830333,  // sub t1, t1, s0
+  0x007375b3,  // and a1, t1, t2
+  0x00b383b3,  // add t2, t2, a1
+  0xfff28293,  // addi t0, t0, -1
+  0xfc029ee3,  // bnez t0, alu
+  0x00000513,  // li a0, 0
+  0x00100073,  // ebreak
+};
+
+// load/store streaming: copy a 2 MiB buffer 8 times
+static const uint32_t mem[] = {
+  0x00000617,  // auipc a2, 0
+  0x001006b7,  // lui a3, 256
+  0x00d606b3,  // add a3, a2, a3
+  0x00300737,  // lui a4, 768
+  0x00e60733,  // add a4, a2, a4
+  0x00800793,  // li a5, 8
+  0x00068293,  // mv t0, a3
+  0x00070313,  // mv t1, a4
+  0x000803b7,  // lui t2, 128
+  0x0002a403,  // lw s0, 0(t0)
+  0x0042a483,  // lw s1, 4(t0)
+  0x00f40433,  // add s0, s0, a5
+  0x00832023,  // sw s0, 0(t1)
+  0x00932223,  // sw s1, 4(t1)
+  0x00828293,  // addi t0, t0, 8
+  0x00830313,  // addi t1, t1, 8
+  0xffe38393,  // addi t2, t2, -2
+  0xfe0390e3,  // bnez t2, copy
+  0xfff78793,  // addi a5, a5, -1
+  0xfc0796e3,  // bnez a5, pass
+  0x00000513,  // li a0, 0
+  0x00100073,  // ebreak
+};
+
+// branch-heavy: data dependent branches on a xorshift sequence
+static const uint32_t branch[] = {
+  0x001e82b7,  // lui t0, 488
+  0x4802829b,  // addiw t0, t0, 1152
+  0x2545f337,  // lui t1, 152671
+  0x4913031b,  // addiw t1, t1, 1169
+  0x00000393,  // li t2, 0
+  0x00000413,  // li s0, 0
+  0x00d31493,  // slli s1, t1, 13
+  0x00934333,  // xor t1, t1, s1
+  0x01135493,  // srli s1, t1, 17
+  0x00934333,  // xor t1, t1, s1
+  0x00531493,  // slli s1, t1, 5
+  0x00934333,  // xor t1, t1, s1
+  0x00137493,  // andi s1, t1, 1
+  0x00048663,  // beqz s1, even
+  0x00138393,  // addi t2, t2, 1
+  0x0080006f,  // j next
+  0x00140413,  // addi s0, s0, 1
+  0x00637493,  // andi s1, t1, 6
+  0x00049463,  // bnez s1, skip
+  0x00338393,  // addi t2, t2, 3
+  0xfff28293,  // addi t0, t0, -1
+  0xfc0292e3,  // bnez t0, rnd
+  0x00000513,  // li a0, 0
+  0x00100073,  // ebreak
+};
+
+#ifdef CONFIG_HAS_TIMER
+static_assert((uint64_t)CONFIG_RTC_MMIO >> 32 == 0, "the mmio kernel only reaches an RTC below 4 GiB");
+// addi sign-extends %lo, which %hi makes up for, and the shifts clear
+// the upper half set by lui when bit 31 is 1
+#define RTC_HI ((((uint32_t)CONFIG_RTC_MMIO + 0x800) >> 12) & 0xfffff)
+#define RTC_LO ((uint32_t)CONFIG_RTC_MMIO & 0xfff)
+
+// MMIO-heavy: poll the RTC
+static const uint32_t mmio[] = {
+  0x000006b7 | (RTC_HI << 12),  // lui a3, %hi(RTC)
+  0x00068693 | (RTC_LO << 20),  // addi a3, a3, %lo(RTC)
+  0x02069693,  // slli a3, a3, 32
+  0x0206d693,  // srli a3, a3, 32
+  0x000f42b7,  // lui t0, 244
+  0x2402829b,  // addiw t0, t0, 576
+  0x00000313,  // li t1, 0
+  0x0046a383,  // lw t2, 4(a3)
+  0x0006a403,  // lw s0, 0(a3)
+  0x00730333,  // add t1, t1, t2
+  0x00830333,  // add t1, t1, s0
+  0xfff28293,  // addi t0, t0, -1
+  0xfe0296e3,  // bnez t0, poll
+  0x00000513,  // li a0, 0
+  0x00100073,  // ebreak
+};
+#endif
+
+// CoreMark-like mix: list walk, matrix-vector multiply and CRC16
+static const uint32_t mix[] = {
+  0x00000617,  // auipc a2, 0
+  0x000106b7,  // lui a3, 16
+  0x00d606b3,  // add a3, a2, a3
+  0x01000293,  // li t0, 16
+  0x00010337,  // lui t1, 16
+  0x0083031b,  // addiw t1, t1, 8
+  0x00068393,  // mv t2, a3
+  0x0063a023,  // sw t1, 0(t2)
+  0x0053a223,  // sw t0, 4(t2)
+  0x00830313,  // addi t1, t1, 8
+  0x00838393,  // addi t2, t2, 8
+  0xfff28293,  // addi t0, t0, -1
+  0xfe0296e3,  // bnez t0, init_list
+  0xfe03ac23,  // sw zero, -8(t2)
+  0x00020737,  // lui a4, 32
+  0x00e60733,  // add a4, a2, a4
+  0x02000293,  // li t0, 32
+  0x00070393,  // mv t2, a4
+  0x0053a023,  // sw t0, 0(t2)
+  0x00438393,  // addi t2, t2, 4
+  0xfff28293,  // addi t0, t0, -1
+  0xfe029ae3,  // bnez t0, init_mat
+  0x0000a7b7,  // lui a5, 10
+  0x0017879b,  // addiw a5, a5, 1
+  0x00018837,  // lui a6, 24
+  0x6a08081b,  // addiw a6, a6, 1696
+  0x000108b7,  // lui a7, 16
+  0xfff8889b,  // addiw a7, a7, -1
+  0x00068393,  // mv t2, a3
+  0x00000313,  // li t1, 0
+  0x0043a403,  // lw s0, 4(t2)
+  0x00830333,  // add t1, t1, s0
+  0x0003a403,  // lw s0, 0(t2)
+  0x008603b3,  // add t2, a2, s0
+  0xfe0418e3,  // bnez s0, walk
+  0x00070393,  // mv t2, a4
+  0x01000293,  // li t0, 16
+  0x0003a403,  // lw s0, 0(t2)
+  0x0403a483,  // lw s1, 64(t2)
+  0x02940433,  // <unknown>
+  0x00830333,  // add t1, t1, s0
+  0x00438393,  // addi t2, t2, 4
+  0xfff28293,  // addi t0, t0, -1
+  0xfe0294e3,  // bnez t0, mat
+  0x00800293,  // li t0, 8
+  0x011344b3,  // xor s1, t1, a7
+  0x0014f493,  // andi s1, s1, 1
+  0x00135313,  // srli t1, t1, 1
+  0x0018d893,  // srli a7, a7, 1
+  0x00048463,  // beqz s1, crc_next
+  0x00f8c8b3,  // xor a7, a7, a5
+  0xfff28293,  // addi t0, t0, -1
+  0xfe0292e3,  // bnez t0, crc
+  0xfff80813,  // addi a6, a6, -1
+  0xf8081ce3,  // bnez a6, iter
+  0x00000513,  // li a0, 0
+  0x00100073,  // ebreak
+};
+
+const BenchKernel isa_bench_kernel[] = {
+  { "alu"   , alu   , sizeof(alu)    },
+  { "mem"   , mem   , sizeof(mem)    },
+  { "branch", branch, sizeof(branch) },
+#ifdef CONFIG_HAS_TIMER
+  { "mmio"  , mmio  , sizeof(mmio)   },
+#endif
+  { "mix"   , mix   , sizeof(mix)    },
+};
+const int isa_nr_bench_kernel = ARRLEN(isa_bench_kernel);
@@ -15,6 +15,9 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include "local-include/csr.h"
+
+void init_decode();
 
 // this is not consistent with uint8_t
 // but it is ok since we do not access the array directly
@@ -32,12 +35,23 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* Start in M-mode with interrupts disabled and the translation off. */
+  cpu.priv = PRV_M;
+  csr(mstatus) = MSTATUS_XL64;
+  cpu.exc = EXC_NONE;
+  cpu.reserve = (vaddr_t)-1;
+  intr_update();
+  mmu_update();
 }
 
 void init_isa() {
   /* Load built-in image. */
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
+  pmem_host_written(RESET_VECTOR, sizeof(img));
 
   /* Initialize this virtual computer system. */
   restart();
+
+  init_decode();
 }
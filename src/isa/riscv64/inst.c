@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include "local-include/reg.h"
+#include "local-include/csr.h"
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
@@ -23,8 +24,10 @@
 #define Mw vaddr_write
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
-  TYPE_N, // none
+  TYPE_R, TYPE_I, TYPE_S, TYPE_B, TYPE_U, TYPE_J,
+  TYPE_SH,  // shift by an immediate
+  TYPE_CSR, // the CSR number in imm, and the field rs1 in src2 for the immediate forms
+  TYPE_N,   // none
 };
 
 #define src1R() do { *src1 = R(rs1); } while (0)
@@ -32,37 +35,219 @@ enum {
 #define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
 #define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define immB() do { *imm = (SEXT(BITS(i, 31, 31), 1) << 12) | (BITS(i, 7, 7) << 11) | \
+                           (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1); } while(0)
+#define immJ() do { *imm = (SEXT(BITS(i, 31, 31), 1) << 20) | (BITS(i, 19, 12) << 12) | \
+                           (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1); } while(0)
 
 static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
-  uint32_t i = s->isa.inst.val;
+  uint32_t i = s->isa.inst32;
   int rs1 = BITS(i, 19, 15);
   int rs2 = BITS(i, 24, 20);
   *rd     = BITS(i, 11, 7);
   switch (type) {
-    case TYPE_I: src1R();          immI(); break;
-    case TYPE_U:                   immU(); break;
-    case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_R:   src1R(); src2R();         break;
+    case TYPE_I:   src1R();          immI(); break;
+    case TYPE_S:   src1R(); src2R(); immS(); break;
+    case TYPE_B:   src1R(); src2R(); immB(); break;
+    case TYPE_U:                     immU(); break;
+    case TYPE_J:                     immJ(); break;
+    case TYPE_SH:  src1R(); *imm = BITS(i, 25, 20); break;
+    case TYPE_CSR: src1R(); *imm = BITS(i, 31, 20); *src2 = rs1; break;
   }
 }
 
+// division by zero and overflow do not trap, the results are given by the ISA
+static inline word_t div_s(sword_t a, sword_t b) { return (b == 0 ? -1 : b == -1 ? -(word_t)a : a / b); }
+static inline word_t rem_s(sword_t a, sword_t b) { return (b == 0 ? a : b == -1 ? 0 : a % b); }
+static inline word_t div_u(word_t a, word_t b)   { return (b == 0 ? -1 : a / b); }
+static inline word_t rem_u(word_t a, word_t b)   { return (b == 0 ? a : a % b); }
+
+// the read of an AMO faults as a store, and so does a misaligned AMO
+static word_t amo_read(vaddr_t addr, int len) {
+  if (addr & (len - 1)) { raise_exc(EXC_SAF, addr); return 0; }
+  word_t data = Mr(addr, len);
+  if (cpu.exc == EXC_LPF) cpu.exc = EXC_SPF;
+  else if (cpu.exc == EXC_LAF) cpu.exc = EXC_SAF;
+  return (len == 4 ? SEXT(data, 32) : data);
+}
+
+/* Write `op' of the old value `t' and the operand `b' to the `len' bytes
+ * at src1, and the old value to rd. A word is sign-extended in both. It is
+ * done again if another hart wrote the bytes in between.
+ */
+#define AMO(len, op) do { \
+  word_t t, b = (len == 4 ? SEXT(src2, 32) : src2); \
+  do t = amo_read(src1, len); \
+  while (cpu.exc == EXC_NONE && !vaddr_cas(src1, len, t, op)); \
+  if (cpu.exc == EXC_NONE) R(rd) = t; \
+} while (0)
+
+#define LR(len) do { \
+  if (src1 & (len - 1)) raise_exc(EXC_LAF, src1); \
+  else { R(rd) = cpu.reserve_val = (len == 4 ? SEXT(Mr(src1, 4), 32) : Mr(src1, 8)); cpu.reserve = src1; } \
+} while (0)
+
+#define SC(len) do { \
+  if (src1 & (len - 1)) raise_exc(EXC_SAF, src1); \
+  else if (cpu.reserve == src1 && vaddr_cas(src1, len, cpu.reserve_val, src2)) R(rd) = 0; \
+  else if (cpu.exc == EXC_NONE) R(rd) = 1; \
+  cpu.reserve = (vaddr_t)-1; \
+} while (0)
+
+/* A privileged instruction is illegal below mode `prv', and in S-mode if
+ * one of the bits `trap' of mstatus (TVM, TW or TSR) is set.
+ */
+#define PRIV(prv, trap, ...) do { \
+  if (cpu.priv < (prv) || (cpu.priv == PRV_S && (csr(mstatus) & (trap)))) raise_exc(EXC_II, 0); \
+  else { __VA_ARGS__; } \
+} while (0)
+
+/* The instructions, a compressed one is expanded before it is decoded. An
+ * entry is only tried if no entry before it matches, so the more specific
+ * patterns come first. A body raises an exception with raise_exc(), and it
+ * is taken when the body returns.
+ */
+#define INSTPAT_LIST(f) \
+  f("??????? ????? ????? ??? ????? 01101 11", lui    , U  , R(rd) = imm) \
+  f("??????? ????? ????? ??? ????? 00101 11", auipc  , U  , R(rd) = s->pc + imm) \
+  f("??????? ????? ????? ??? ????? 11011 11", jal    , J  , R(rd) = s->snpc; s->dnpc = s->pc + imm) \
+  f("??????? ????? ????? 000 ????? 11001 11", jalr   , I  , s->dnpc = (src1 + imm) & ~(word_t)1; R(rd) = s->snpc) \
+  f("??????? ????? ????? 000 ????? 11000 11", beq    , B  , if (src1 == src2) s->dnpc = s->pc + imm) \
+  f("??????? ????? ????? 001 ????? 11000 11", bne    , B  , if (src1 != src2) s->dnpc = s->pc + imm) \
+  f("??????? ????? ????? 100 ????? 11000 11", blt    , B  , if ((sword_t)src1 < (sword_t)src2) s->dnpc = s->pc + imm) \
+  f("??????? ????? ????? 101 ????? 11000 11", bge    , B  , if ((sword_t)src1 >= (sword_t)src2) s->dnpc = s->pc + imm) \
+  f("??????? ????? ????? 110 ????? 11000 11", bltu   , B  , if (src1 < src2) s->dnpc = s->pc + imm) \
+  f("??????? ????? ????? 111 ????? 11000 11", bgeu   , B  , if (src1 >= src2) s->dnpc = s->pc + imm) \
+  \
+  f("??????? ????? ????? 000 ????? 00000 11", lb     , I  , R(rd) = SEXT(Mr(src1 + imm, 1), 8)) \
+  f("??????? ????? ????? 001 ????? 00000 11", lh     , I  , R(rd) = SEXT(Mr(src1 + imm, 2), 16)) \
+  f("??????? ????? ????? 010 ????? 00000 11", lw     , I  , R(rd) = SEXT(Mr(src1 + imm, 4), 32)) \
+  f("??????? ????? ????? 011 ????? 00000 11", ld     , I  , R(rd) = Mr(src1 + imm, 8)) \
+  f("??????? ????? ????? 100 ????? 00000 11", lbu    , I  , R(rd) = Mr(src1 + imm, 1)) \
+  f("??????? ????? ????? 101 ????? 00000 11", lhu    , I  , R(rd) = Mr(src1 + imm, 2)) \
+  f("??????? ????? ????? 110 ????? 00000 11", lwu    , I  , R(rd) = Mr(src1 + imm, 4)) \
+  f("??????? ????? ????? 000 ????? 01000 11", sb     , S  , Mw(src1 + imm, 1, src2)) \
+  f("??????? ????? ????? 001 ????? 01000 11", sh     , S  , Mw(src1 + imm, 2, src2)) \
+  f("??????? ????? ????? 010 ????? 01000 11", sw     , S  , Mw(src1 + imm, 4, src2)) \
+  f("??????? ????? ????? 011 ????? 01000 11", sd     , S  , Mw(src1 + imm, 8, src2)) \
+  \
+  f("??????? ????? ????? 000 ????? 00100 11", addi   , I  , R(rd) = src1 + imm) \
+  f("??????? ????? ????? 010 ????? 00100 11", slti   , I  , R(rd) = (sword_t)src1 < (sword_t)imm) \
+  f("??????? ????? ????? 011 ????? 00100 11", sltiu  , I  , R(rd) = src1 < imm) \
+  f("??????? ????? ????? 100 ????? 00100 11", xori   , I  , R(rd) = src1 ^ imm) \
+  f("??????? ????? ????? 110 ????? 00100 11", ori    , I  , R(rd) = src1 | imm) \
+  f("??????? ????? ????? 111 ????? 00100 11", andi   , I  , R(rd) = src1 & imm) \
+  f("000000? ????? ????? 001 ????? 00100 11", slli   , SH , R(rd) = src1 << imm) \
+  f("000000? ????? ????? 101 ????? 00100 11", srli   , SH , R(rd) = src1 >> imm) \
+  f("010000? ????? ????? 101 ????? 00100 11", srai   , SH , R(rd) = (sword_t)src1 >> imm) \
+  f("0000000 ????? ????? 000 ????? 01100 11", add    , R  , R(rd) = src1 + src2) \
+  f("0100000 ????? ????? 000 ????? 01100 11", sub    , R  , R(rd) = src1 - src2) \
+  f("0000000 ????? ????? 001 ????? 01100 11", sll    , R  , R(rd) = src1 << (src2 & 0x3f)) \
+  f("0000000 ????? ????? 010 ????? 01100 11", slt    , R  , R(rd) = (sword_t)src1 < (sword_t)src2) \
+  f("0000000 ????? ????? 011 ????? 01100 11", sltu   , R  , R(rd) = src1 < src2) \
+  f("0000000 ????? ????? 100 ????? 01100 11", xor    , R  , R(rd) = src1 ^ src2) \
+  f("0000000 ????? ????? 101 ????? 01100 11", srl    , R  , R(rd) = src1 >> (src2 & 0x3f)) \
+  f("0100000 ????? ????? 101 ????? 01100 11", sra    , R  , R(rd) = (sword_t)src1 >> (src2 & 0x3f)) \
+  f("0000000 ????? ????? 110 ????? 01100 11", or     , R  , R(rd) = src1 | src2) \
+  f("0000000 ????? ????? 111 ????? 01100 11", and    , R  , R(rd) = src1 & src2) \
+  f("??????? ????? ????? 000 ????? 00110 11", addiw  , I  , R(rd) = SEXT(src1 + imm, 32)) \
+  f("0000000 ????? ????? 001 ????? 00110 11", slliw  , SH , R(rd) = SEXT(src1 << imm, 32)) \
+  f("0000000 ????? ????? 101 ????? 00110 11", srliw  , SH , R(rd) = SEXT((uint32_t)src1 >> imm, 32)) \
+  f("0100000 ????? ????? 101 ????? 00110 11", sraiw  , SH , R(rd) = SEXT((int32_t)src1 >> imm, 32)) \
+  f("0000000 ????? ????? 000 ????? 01110 11", addw   , R  , R(rd) = SEXT(src1 + src2, 32)) \
+  f("0100000 ????? ????? 000 ????? 01110 11", subw   , R  , R(rd) = SEXT(src1 - src2, 32)) \
+  f("0000000 ????? ????? 001 ????? 01110 11", sllw   , R  , R(rd) = SEXT(src1 << (src2 & 0x1f), 32)) \
+  f("0000000 ????? ????? 101 ????? 01110 11", srlw   , R  , R(rd) = SEXT((uint32_t)src1 >> (src2 & 0x1f), 32)) \
+  f("0100000 ????? ????? 101 ????? 01110 11", sraw   , R  , R(rd) = SEXT((int32_t)src1 >> (src2 & 0x1f), 32)) \
+  \
+  f("0000001 ????? ????? 000 ????? 01100 11", mul    , R  , R(rd) = src1 * src2) \
+  f("0000001 ????? ????? 001 ????? 01100 11", mulh   , R  , R(rd) = ((__int128)(sword_t)src1 * (sword_t)src2) >> 64) \
+  f("0000001 ????? ????? 010 ????? 01100 11", mulhsu , R  , R(rd) = ((__int128)(sword_t)src1 * (unsigned __int128)src2) >> 64) \
+  f("0000001 ????? ????? 011 ????? 01100 11", mulhu  , R  , R(rd) = ((unsigned __int128)src1 * src2) >> 64) \
+  f("0000001 ????? ????? 100 ????? 01100 11", div    , R  , R(rd) = div_s(src1, src2)) \
+  f("0000001 ????? ????? 101 ????? 01100 11", divu   , R  , R(rd) = div_u(src1, src2)) \
+  f("0000001 ????? ????? 110 ????? 01100 11", rem    , R  , R(rd) = rem_s(src1, src2)) \
+  f("0000001 ????? ????? 111 ????? 01100 11", remu   , R  , R(rd) = rem_u(src1, src2)) \
+  f("0000001 ????? ????? 000 ????? 01110 11", mulw   , R  , R(rd) = SEXT(src1 * src2, 32)) \
+  f("0000001 ????? ????? 100 ????? 01110 11", divw   , R  , R(rd) = SEXT(div_s((int32_t)src1, (int32_t)src2), 32)) \
+  f("0000001 ????? ????? 101 ????? 01110 11", divuw  , R  , R(rd) = SEXT(div_u((uint32_t)src1, (uint32_t)src2), 32)) \
+  f("0000001 ????? ????? 110 ????? 01110 11", remw   , R  , R(rd) = SEXT(rem_s((int32_t)src1, (int32_t)src2), 32)) \
+  f("0000001 ????? ????? 111 ????? 01110 11", remuw  , R  , R(rd) = SEXT(rem_u((uint32_t)src1, (uint32_t)src2), 32)) \
+  \
+  f("00010?? 00000 ????? 010 ????? 01011 11", lr.w   , R  , LR(4)) \
+  f("00011?? ????? ????? 010 ????? 01011 11", sc.w   , R  , SC(4)) \
+  f("00001?? ????? ????? 010 ????? 01011 11", amoswap.w, R, AMO(4, b)) \
+  f("00000?? ????? ????? 010 ????? 01011 11", amoadd.w , R, AMO(4, t + b)) \
+  f("00100?? ????? ????? 010 ????? 01011 11", amoxor.w , R, AMO(4, t ^ b)) \
+  f("01100?? ????? ????? 010 ????? 01011 11", amoand.w , R, AMO(4, t & b)) \
+  f("01000?? ????? ????? 010 ????? 01011 11", amoor.w  , R, AMO(4, t | b)) \
+  f("10000?? ????? ????? 010 ????? 01011 11", amomin.w , R, AMO(4, (sword_t)t < (sword_t)b ? t : b)) \
+  f("10100?? ????? ????? 010 ????? 01011 11", amomax.w , R, AMO(4, (sword_t)t > (sword_t)b ? t : b)) \
+  f("11000?? ????? ????? 010 ????? 01011 11", amominu.w, R, AMO(4, t < b ? t : b)) \
+  f("11100?? ????? ????? 010 ????? 01011 11", amomaxu.w, R, AMO(4, t > b ? t : b)) \
+  f("00010?? 00000 ????? 011 ????? 01011 11", lr.d   , R  , LR(8)) \
+  f("00011?? ????? ????? 011 ????? 01011 11", sc.d   , R  , SC(8)) \
+  f("00001?? ????? ????? 011 ????? 01011 11", amoswap.d, R, AMO(8, b)) \
+  f("00000?? ????? ????? 011 ????? 01011 11", amoadd.d , R, AMO(8, t + b)) \
+  f("00100?? ????? ????? 011 ????? 01011 11", amoxor.d , R, AMO(8, t ^ b)) \
+  f("01100?? ????? ????? 011 ????? 01011 11", amoand.d , R, AMO(8, t & b)) \
+  f("01000?? ????? ????? 011 ????? 01011 11", amoor.d  , R, AMO(8, t | b)) \
+  f("10000?? ????? ????? 011 ????? 01011 11", amomin.d , R, AMO(8, (sword_t)t < (sword_t)b ? t : b)) \
+  f("10100?? ????? ????? 011 ????? 01011 11", amomax.d , R, AMO(8, (sword_t)t > (sword_t)b ? t : b)) \
+  f("11000?? ????? ????? 011 ????? 01011 11", amominu.d, R, AMO(8, t < b ? t : b)) \
+  f("11100?? ????? ????? 011 ????? 01011 11", amomaxu.d, R, AMO(8, t > b ? t : b)) \
+  \
+  f("??????? ????? ????? 000 ????? 00011 11", fence  , N  , vaddr_fence()) \
+  f("??????? ????? ????? 001 ????? 00011 11", fence.i, N  , ) \
+  f("0000000 00000 00000 000 00000 11100 11", ecall  , N  , raise_exc(EXC_ECALL_U + cpu.priv, 0)) \
+  f("0000000 00001 00000 000 00000 11100 11", ebreak , N  , \
+      if (cpu.priv == PRV_M) NEMUTRAP(s->pc, R(10)); /* R(10) is $a0 */ \
+      else raise_exc(EXC_BP, s->pc)) \
+  f("0001000 00010 00000 000 00000 11100 11", sret   , N  , PRIV(PRV_S, MSTATUS_TSR, s->dnpc = sret())) \
+  f("0011000 00010 00000 000 00000 11100 11", mret   , N  , PRIV(PRV_M, 0, s->dnpc = mret())) \
+  f("0001000 00101 00000 000 00000 11100 11", wfi    , N  , PRIV(PRV_S, MSTATUS_TW, \
+      cpu.idle = (csr(mip) & csr(mie)) == 0; if (cpu.idle) s->dnpc = s->pc)) \
+  f("0001001 ????? ????? 000 00000 11100 11", sfence.vma, R, PRIV(PRV_S, MSTATUS_TVM, \
+      mmu_flush(src1, BITS(s->isa.inst32, 19, 15) == 0))) \
+  f("??????? ????? ????? 001 ????? 11100 11", csrrw  , CSR, R(rd) = csr_rw(imm, src1, -1, true)) \
+  f("??????? ????? ????? 010 ????? 11100 11", csrrs  , CSR, R(rd) = csr_rw(imm, -1, src1, src2 != 0)) \
+  f("??????? ????? ????? 011 ????? 11100 11", csrrc  , CSR, R(rd) = csr_rw(imm, 0, src1, src2 != 0)) \
+  f("??????? ????? ????? 101 ????? 11100 11", csrrwi , CSR, R(rd) = csr_rw(imm, src2, -1, true)) \
+  f("??????? ????? ????? 110 ????? 11100 11", csrrsi , CSR, R(rd) = csr_rw(imm, -1, src2, src2 != 0)) \
+  f("??????? ????? ????? 111 ????? 11100 11", csrrci , CSR, R(rd) = csr_rw(imm, 0, src2, src2 != 0)) \
+  /* without a trap handler, there is no one to report an illegal instruction but NEMU */ \
+  f("??????? ????? ????? ??? ????? ????? ??", inv    , N  , \
+      if (csr(mtvec) == 0) INV(s->pc); else raise_exc(EXC_II, 0))
+
+// indexed by inst[14:12] and inst[6:2], the first entry which may match the instruction
+static uint8_t instpat_first[1 << 8];
+
+extern uint32_t rvc_table[1 << 16];
+void init_rvc();
+
+void init_decode() {
+  static const char *patterns[] = { INSTPAT_LIST(INSTPAT_PATTERN) };
+  instpat_build_table(instpat_first, 0x707c, patterns, ARRLEN(patterns));
+  init_rvc();
+}
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
   s->dnpc = s->snpc;
 
-#define INSTPAT_INST(s) ((s)->isa.inst.val)
+  // an instruction raising an exception does not write rd
+#define INSTPAT_INST(s) ((s)->isa.inst32)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  word_t old = R(rd); \
   __VA_ARGS__ ; \
+  if (unlikely(cpu.exc != EXC_NONE)) { R(rd) = old; s->dnpc = isa_raise_intr(cpu.exc, s->pc); } \
 }
 
   INSTPAT_START();
-  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm);
-  INSTPAT("??????? ????? ????? 011 ????? 00000 11", ld     , I, R(rd) = Mr(src1 + imm, 8));
-  INSTPAT("??????? ????? ????? 011 ????? 01000 11", sd     , S, Mw(src1 + imm, 8, src2));
-
-  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
-  INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
+  INSTPAT_SWITCH(instpat_first[(BITS(INSTPAT_INST(s), 14, 12) << 5) | BITS(INSTPAT_INST(s), 6, 2)], INSTPAT_LIST);
   INSTPAT_END();
 
   R(0) = 0; // reset $zero to 0
@@ -70,7 +255,27 @@ static int decode_exec(Decode *s) {
   return 0;
 }
 
+/* An instruction is fetched as a word unless it may end the page, since
+ * the next page may fault. Then it is fetched in halves, and the second
+ * one only if the first one is not a compressed instruction.
+ */
 int isa_exec_once(Decode *s) {
-  s->isa.inst.val = inst_fetch(&s->snpc, 4);
+  uint32_t inst;
+  if (likely((s->pc & PAGE_MASK) != PAGE_SIZE - 2)) inst = inst_fetch(&s->snpc, 4);
+  else {
+    inst = inst_fetch(&s->snpc, 2);
+    if (BITS(inst, 1, 0) == 3 && cpu.exc == EXC_NONE) inst |= inst_fetch(&s->snpc, 2) << 16;
+  }
+  if (BITS(inst, 1, 0) == 3) s->isa.inst32 = inst;
+  else {
+    inst &= 0xffff;
+    s->snpc = s->pc + 2;
+    s->isa.inst32 = rvc_table[inst];
+  }
+  s->isa.inst.val = inst;
+  if (unlikely(cpu.exc != EXC_NONE)) {
+    s->dnpc = isa_raise_intr(cpu.exc, s->pc);
+    return 0;
+  }
   return decode_exec(s);
 }
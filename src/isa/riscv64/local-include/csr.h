@@ -0,0 +1,106 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __RISCV64_CSR_H__
+#define __RISCV64_CSR_H__
+
+#include <isa.h>
+
+enum {
+  CSR_SSTATUS = 0x100, CSR_SIE = 0x104, CSR_STVEC = 0x105, CSR_SCOUNTEREN = 0x106,
+  CSR_SSCRATCH = 0x140, CSR_SEPC = 0x141, CSR_SCAUSE = 0x142, CSR_STVAL = 0x143,
+  CSR_SIP = 0x144, CSR_SATP = 0x180,
+  CSR_MSTATUS = 0x300, CSR_MISA = 0x301, CSR_MEDELEG = 0x302, CSR_MIDELEG = 0x303,
+  CSR_MIE = 0x304, CSR_MTVEC = 0x305, CSR_MCOUNTEREN = 0x306, CSR_MCOUNTINHIBIT = 0x320,
+  CSR_MSCRATCH = 0x340, CSR_MEPC = 0x341, CSR_MCAUSE = 0x342, CSR_MTVAL = 0x343,
+  CSR_MIP = 0x344, CSR_PMPCFG0 = 0x3a0, CSR_PMPADDR0 = 0x3b0,
+  CSR_MCYCLE = 0xb00, CSR_MINSTRET = 0xb02,
+  CSR_CYCLE = 0xc00, CSR_TIME = 0xc01, CSR_INSTRET = 0xc02,
+  CSR_MVENDORID = 0xf11, CSR_MARCHID = 0xf12, CSR_MIMPID = 0xf13, CSR_MHARTID = 0xf14,
+};
+
+#define csr(name) cpu.csr.name
+
+enum { PRV_U = 0, PRV_S = 1, PRV_M = 3 };
+
+// exception causes
+enum {
+  EXC_IAF = 1, EXC_II = 2, EXC_BP = 3, EXC_LAF = 5, EXC_SAF = 7,
+  EXC_ECALL_U = 8, EXC_ECALL_S = 9, EXC_ECALL_M = 11,
+  EXC_IPF = 12, EXC_LPF = 13, EXC_SPF = 15,
+};
+#define EXC_NONE ((word_t)-1)
+
+// interrupts, the cause is INTR_BIT | IRQ_*
+enum { IRQ_SSI = 1, IRQ_MSI = 3, IRQ_STI = 5, IRQ_MTI = 7, IRQ_SEI = 9, IRQ_MEI = 11 };
+#define INTR_BIT ((word_t)1 << 63)
+
+#define MSTATUS_SIE  (1ull << 1)
+#define MSTATUS_MIE  (1ull << 3)
+#define MSTATUS_SPIE (1ull << 5)
+#define MSTATUS_MPIE (1ull << 7)
+#define MSTATUS_SPP  (1ull << 8)
+#define MSTATUS_MPP  (3ull << 11)
+#define MSTATUS_MPRV (1ull << 17)
+#define MSTATUS_SUM  (1ull << 18)
+#define MSTATUS_MXR  (1ull << 19)
+#define MSTATUS_TVM  (1ull << 20)
+#define MSTATUS_TW   (1ull << 21)
+#define MSTATUS_TSR  (1ull << 22)
+#define MSTATUS_UXL  (3ull << 32)
+#define MSTATUS_SXL  (3ull << 34)
+#define MSTATUS_XL64 ((2ull << 32) | (2ull << 34)) // UXL and SXL are read-only, both are 64
+#define SSTATUS_MASK (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR)
+#define MSTATUS_MASK (SSTATUS_MASK | MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPP | MSTATUS_MPRV | \
+                      MSTATUS_TVM | MSTATUS_TW | MSTATUS_TSR)
+#define MSTATUS_MPP_SHIFT 11
+
+#define MIP_SSIP (1ull << IRQ_SSI)
+#define MIP_MSIP (1ull << IRQ_MSI)
+#define MIP_STIP (1ull << IRQ_STI)
+#define MIP_MTIP (1ull << IRQ_MTI)
+#define MIP_SEIP (1ull << IRQ_SEI)
+#define MIP_MEIP (1ull << IRQ_MEI)
+#define MIP_S    (MIP_SSIP | MIP_STIP | MIP_SEIP)
+#define MIP_M    (MIP_MSIP | MIP_MTIP | MIP_MEIP)
+#define MEDELEG_MASK 0xb3ffull // all but ecall from M-mode and the reserved ones
+
+#define SATP_MODE  (0xfull << 60)
+#define SATP_PPN   0xfffffffffffull
+#define SATP_VALID(x) ((x) >> 60 == 0 || (x) >> 60 == 8) // Bare or Sv39
+
+// raise an exception at the end of the running instruction, the first one is kept
+static inline void raise_exc(word_t cause, word_t tval) {
+  if (cpu.exc == EXC_NONE) { cpu.exc = cause; cpu.tval = tval; }
+}
+
+// the privileged instructions, in system/priv.c
+word_t csr_rw(uint32_t num, word_t data, word_t mask, bool wr);
+vaddr_t mret();
+vaddr_t sret();
+
+// recompute cpu.intr after mstatus, mip, mie, mideleg or the privilege mode is changed, in system/intr.c
+void intr_update();
+
+// recompute cpu.vm after satp, mstatus or the privilege mode is changed, in system/mmu.c
+void mmu_update();
+// flush the caches of the translations of `vaddr', or of all addresses if `all' is set
+void mmu_flush(vaddr_t vaddr, bool all);
+
+// the timer and the counters, in system/timer.c
+uint64_t timer_time();
+
+#endif
@@ -0,0 +1,135 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Compressed instructions are expanded to the 32-bit instructions they
+ * stand for once, when the decoder is initialized, into a table indexed by
+ * the 16-bit encoding. Fetching one costs a lookup, and the table is never
+ * stale when the code is written. An illegal compressed instruction, and
+ * one of the F and D extensions, is expanded to 0, which is invalid too.
+ */
+
+#include <common.h>
+
+uint32_t rvc_table[1 << 16];
+
+enum {
+  OP_LOAD = 0x03, OP_IMM = 0x13, OP_IMM32 = 0x1b, OP_STORE = 0x23, OP_OP = 0x33, OP_LUI = 0x37,
+  OP_OP32 = 0x3b, OP_BRANCH = 0x63, OP_JALR = 0x67, OP_JAL = 0x6f,
+};
+#define EBREAK 0x00100073
+
+static uint32_t r_type(int f7, int rs2, int rs1, int f3, int rd, int op) {
+  return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+
+static uint32_t i_type(int32_t imm, int rs1, int f3, int rd, int op) {
+  return (BITS(imm, 11, 0) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+
+static uint32_t s_type(int32_t imm, int rs2, int rs1, int f3) {
+  return (BITS(imm, 11, 5) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (BITS(imm, 4, 0) << 7) | OP_STORE;
+}
+
+static uint32_t b_type(int32_t imm, int rs1, int f3) {
+  return (BITS(imm, 12, 12) << 31) | (BITS(imm, 10, 5) << 25) | (rs1 << 15) | (f3 << 12) |
+    (BITS(imm, 4, 1) << 8) | (BITS(imm, 11, 11) << 7) | OP_BRANCH;
+}
+
+static uint32_t j_type(int32_t imm, int rd) {
+  return (BITS(imm, 20, 20) << 31) | (BITS(imm, 10, 1) << 21) | (BITS(imm, 11, 11) << 20) |
+    (BITS(imm, 19, 12) << 12) | (rd << 7) | OP_JAL;
+}
+
+#define Q(quadrant, funct3) (((quadrant) << 3) | (funct3))
+
+static uint32_t expand(uint32_t c) {
+  int rd = BITS(c, 11, 7), rs2 = BITS(c, 6, 2);
+  int rd_ = 8 + BITS(c, 4, 2), rs1_ = 8 + BITS(c, 9, 7); // the 3-bit register fields
+  int32_t imm6 = SEXT((BITS(c, 12, 12) << 5) | BITS(c, 6, 2), 6);
+  int shamt = (BITS(c, 12, 12) << 5) | BITS(c, 6, 2);
+  int32_t w_off = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+  int32_t d_off = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 5) << 6);
+  int32_t j_off = SEXT((BITS(c, 12, 12) << 11) | (BITS(c, 11, 11) << 4) | (BITS(c, 10, 9) << 8) |
+      (BITS(c, 8, 8) << 10) | (BITS(c, 7, 7) << 6) | (BITS(c, 6, 6) << 7) | (BITS(c, 5, 3) << 1) |
+      (BITS(c, 2, 2) << 5), 12);
+  int32_t b_off = SEXT((BITS(c, 12, 12) << 8) | (BITS(c, 11, 10) << 3) | (BITS(c, 6, 5) << 6) |
+      (BITS(c, 4, 3) << 1) | (BITS(c, 2, 2) << 5), 9);
+
+  switch (Q(BITS(c, 1, 0), BITS(c, 15, 13))) {
+    case Q(0, 0): { // c.addi4spn
+      int32_t imm = (BITS(c, 12, 11) << 4) | (BITS(c, 10, 7) << 6) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 3);
+      return (imm == 0 ? 0 : i_type(imm, 2, 0, rd_, OP_IMM));
+    }
+    case Q(0, 2): return i_type(w_off, rs1_, 2, rd_, OP_LOAD); // c.lw
+    case Q(0, 3): return i_type(d_off, rs1_, 3, rd_, OP_LOAD); // c.ld
+    case Q(0, 6): return s_type(w_off, rd_, rs1_, 2);          // c.sw
+    case Q(0, 7): return s_type(d_off, rd_, rs1_, 3);          // c.sd
+
+    case Q(1, 0): return i_type(imm6, rd, 0, rd, OP_IMM);      // c.addi
+    case Q(1, 1): return (rd == 0 ? 0 : i_type(imm6, rd, 0, rd, OP_IMM32)); // c.addiw
+    case Q(1, 2): return i_type(imm6, 0, 0, rd, OP_IMM);       // c.li
+    case Q(1, 3):
+      if (rd == 2) { // c.addi16sp
+        int32_t imm = SEXT((BITS(c, 12, 12) << 9) | (BITS(c, 4, 3) << 7) | (BITS(c, 5, 5) << 6) |
+            (BITS(c, 2, 2) << 5) | (BITS(c, 6, 6) << 4), 10);
+        return (imm == 0 ? 0 : i_type(imm, 2, 0, 2, OP_IMM));
+      }
+      return (imm6 == 0 ? 0 : ((uint32_t)imm6 << 12) | (rd << 7) | OP_LUI); // c.lui
+    case Q(1, 4):
+      switch (BITS(c, 11, 10)) {
+        case 0: return i_type(shamt, rs1_, 5, rs1_, OP_IMM);         // c.srli
+        case 1: return i_type(0x400 | shamt, rs1_, 5, rs1_, OP_IMM); // c.srai
+        case 2: return i_type(imm6, rs1_, 7, rs1_, OP_IMM);          // c.andi
+        default: {
+          // c.sub, c.xor, c.or, c.and, and c.subw, c.addw
+          static const int funct3[] = { 0, 4, 6, 7 };
+          int k = BITS(c, 6, 5);
+          if (BITS(c, 12, 12)) return (k < 2 ? r_type(k == 0 ? 0x20 : 0, rd_, rs1_, 0, rs1_, OP_OP32) : 0);
+          return r_type(k == 0 ? 0x20 : 0, rd_, rs1_, funct3[k], rs1_, OP_OP);
+        }
+      }
+    case Q(1, 5): return j_type(j_off, 0);                     // c.j
+    case Q(1, 6): return b_type(b_off, rs1_, 0);               // c.beqz
+    case Q(1, 7): return b_type(b_off, rs1_, 1);               // c.bnez
+
+    case Q(2, 0): return i_type(shamt, rd, 1, rd, OP_IMM);     // c.slli
+    case Q(2, 2): { // c.lwsp
+      int32_t imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 4) << 2) | (BITS(c, 3, 2) << 6);
+      return (rd == 0 ? 0 : i_type(imm, 2, 2, rd, OP_LOAD));
+    }
+    case Q(2, 3): { // c.ldsp
+      int32_t imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 5) << 3) | (BITS(c, 4, 2) << 6);
+      return (rd == 0 ? 0 : i_type(imm, 2, 3, rd, OP_LOAD));
+    }
+    case Q(2, 4):
+      if (BITS(c, 12, 12) == 0) {
+        if (rs2 == 0) return (rd == 0 ? 0 : i_type(0, rd, 0, 0, OP_JALR)); // c.jr
+        return r_type(0, rs2, 0, 0, rd, OP_OP);                            // c.mv
+      }
+      if (rs2 == 0) return (rd == 0 ? EBREAK : i_type(0, rd, 0, 1, OP_JALR)); // c.ebreak, c.jalr
+      return r_type(0, rs2, rd, 0, rd, OP_OP);                                // c.add
+    case Q(2, 6): // c.swsp
+      return s_type((BITS(c, 12, 9) << 2) | (BITS(c, 8, 7) << 6), rs2, 2, 2);
+    case Q(2, 7): // c.sdsp
+      return s_type((BITS(c, 12, 10) << 3) | (BITS(c, 9, 7) << 6), rs2, 2, 3);
+    default: return 0;
+  }
+}
+
+void init_rvc() {
+  for (uint32_t c = 0; c < ARRLEN(rvc_table); c ++) {
+    rvc_table[c] = (BITS(c, 1, 0) == 3 ? 0 : expand(c));
+  }
+}
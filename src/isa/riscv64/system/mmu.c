@@ -13,10 +13,148 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+/* Sv39 translation. Translations are cached in a direct-mapped TLB, and
+ * the non-leaf PTEs of the walks in a page walk cache of every level, so a
+ * TLB miss only reads the leaf PTE when its page table is walked to
+ * recently. The walker sets A and D. Neither cache knows ASIDs, so both
+ * are flushed when satp is written. Every hart has its own caches, which
+ * like the ones of real harts only see the page tables changed by other
+ * harts after an sfence.vma.
+ * Permissions are checked against the cached PTE, and the privilege mode,
+ * SUM and MXR may change without a flush.
+ */
+
 #include <isa.h>
-#include <memory/vaddr.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <cpu/cpu.h>
+#include "../local-include/csr.h"
 
-paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
+#define LEVELS   3
+#define VPN_BITS 9
+#define PTE_SIZE 8
+#define VA_BITS  39
+#define VPN(vaddr, level) BITS((vaddr) >> PAGE_SHIFT, ((level) + 1) * VPN_BITS - 1, (level) * VPN_BITS)
+#define PTE_PPN(pte) ((paddr_t)BITS(pte, 53, 10) << PAGE_SHIFT)
+// the virtual address above a page table of `level', which tells it
+#define TABLE_TAG(vaddr, level) ((vaddr) >> (PAGE_SHIFT + ((level) + 1) * VPN_BITS))
+
+enum { PTE_V = 0x1, PTE_R = 0x2, PTE_W = 0x4, PTE_X = 0x8, PTE_U = 0x10, PTE_A = 0x40, PTE_D = 0x80 };
+
+#define TLB_SIZE 256
+#define PWC_SIZE 64
+
+typedef struct {
+  vaddr_t vpn;
+  paddr_t page;
+  word_t pte;
+  uint32_t gen;
+} TLBEntry;
+
+typedef struct {
+  vaddr_t tag;
+  paddr_t table;
+  uint32_t gen;
+} PWCEntry;
+
+typedef struct {
+  TLBEntry tlb[TLB_SIZE];
+  PWCEntry pwc[LEVELS - 1][PWC_SIZE]; // pwc[l] holds the page tables of level l
+  // the entries of an older generation are flushed
+  uint32_t tlb_gen, pwc_gen;
+  bool tlb_super; // the TLB holds pages of a superpage
+} MMUCache;
+
+static MMUCache mmu_cache[CONFIG_NR_HART] = { [0 ... CONFIG_NR_HART - 1] = { .tlb_gen = 1, .pwc_gen = 1 } };
+#define mc (&mmu_cache[MUXONE(CONFIG_NR_HART, 0, cpu_hart_id())])
+
+void mmu_update() {
+  bool on = (csr(satp) & SATP_MODE) != 0;
+  int data_priv = (cpu.priv == PRV_M && (csr(mstatus) & MSTATUS_MPRV) ? BITS(csr(mstatus), 12, 11) : cpu.priv);
+  cpu.vm = (on && cpu.priv < PRV_M ? 1 << MEM_TYPE_IFETCH : 0) |
+           (on && data_priv < PRV_M ? (1 << MEM_TYPE_READ) | (1 << MEM_TYPE_WRITE) : 0);
+}
+
+/* sfence.vma orders the leaf PTEs of `vaddr' unless `all' is set, but
+ * non-leaf PTEs may be changed before it too, and the page walk cache is
+ * always flushed. The leaf PTE of a superpage is cached in the entries of
+ * all its pages, which are not tracked, so the whole TLB is flushed then.
+ */
+void mmu_flush(vaddr_t vaddr, bool all) {
+  MMUCache *c = mc;
+  c->pwc_gen ++;
+  if (all || c->tlb_super) { c->tlb_gen ++; c->tlb_super = false; }
+  else c->tlb[(vaddr >> PAGE_SHIFT) % TLB_SIZE].gen = 0;
+}
+
+static bool allowed(word_t pte, int type) {
+  int priv = cpu.priv;
+  if (type != MEM_TYPE_IFETCH && priv == PRV_M && (csr(mstatus) & MSTATUS_MPRV)) priv = BITS(csr(mstatus), 12, 11);
+  if (pte & PTE_U) {
+    if (priv == PRV_S && (type == MEM_TYPE_IFETCH || !(csr(mstatus) & MSTATUS_SUM))) return false;
+  } else if (priv == PRV_U) {
+    return false;
+  }
+  switch (type) {
+    case MEM_TYPE_IFETCH: return pte & PTE_X;
+    case MEM_TYPE_READ: return (pte & PTE_R) || ((csr(mstatus) & MSTATUS_MXR) && (pte & PTE_X));
+    default: return pte & PTE_W;
+  }
+}
+
+static paddr_t fault(vaddr_t vaddr, int type, bool access) {
+  static const word_t page_fault[] = { EXC_IPF, EXC_LPF, EXC_SPF };
+  static const word_t access_fault[] = { EXC_IAF, EXC_LAF, EXC_SAF };
+  raise_exc(access ? access_fault[type] : page_fault[type], vaddr);
   return MEM_RET_FAIL;
 }
+
+static paddr_t walk(vaddr_t vaddr, int type) {
+  MMUCache *c = mc;
+  // the bits above the virtual address are copies of its top bit
+  if ((sword_t)vaddr >> (VA_BITS - 1) != 0 && (sword_t)vaddr >> (VA_BITS - 1) != -1) return fault(vaddr, type, false);
+  int level = LEVELS - 1;
+  paddr_t table = (paddr_t)(csr(satp) & SATP_PPN) << PAGE_SHIFT;
+  // start from the deepest page table walked to recently
+  for (int l = 0; l < LEVELS - 1; l ++) {
+    PWCEntry *e = &c->pwc[l][TABLE_TAG(vaddr, l) % PWC_SIZE];
+    if (e->gen == c->pwc_gen && e->tag == TABLE_TAG(vaddr, l)) { level = l; table = e->table; break; }
+  }
+  paddr_t pte_addr;
+  word_t pte;
+  while (true) {
+    pte_addr = table + VPN(vaddr, level) * PTE_SIZE;
+    if (!in_pmem(pte_addr)) return fault(vaddr, type, true);
+    pte = paddr_read(pte_addr, PTE_SIZE);
+    // the bits above the PPN are reserved
+    if (!(pte & PTE_V) || ((pte & PTE_W) && !(pte & PTE_R)) || (pte >> 54) != 0) return fault(vaddr, type, false);
+    if (pte & (PTE_R | PTE_X)) break;
+    if (level == 0) return fault(vaddr, type, false);
+    level --;
+    table = PTE_PPN(pte);
+    c->pwc[level][TABLE_TAG(vaddr, level) % PWC_SIZE] = (PWCEntry){ .tag = TABLE_TAG(vaddr, level), .table = table, .gen = c->pwc_gen };
+  }
+  // a superpage is aligned to its size
+  word_t low = BITMASK(level * VPN_BITS);
+  if ((BITS(pte, 53, 10) & low) != 0 || !allowed(pte, type)) return fault(vaddr, type, false);
+  word_t ad = PTE_A | (type == MEM_TYPE_WRITE ? PTE_D : 0);
+  if ((pte & ad) != ad) {
+    pte |= ad;
+    paddr_write(pte_addr, PTE_SIZE, pte);
+  }
+  paddr_t page = PTE_PPN(pte) | ((paddr_t)((vaddr >> PAGE_SHIFT) & low) << PAGE_SHIFT);
+  if (level > 0) c->tlb_super = true;
+  c->tlb[(vaddr >> PAGE_SHIFT) % TLB_SIZE] = (TLBEntry){ .vpn = vaddr >> PAGE_SHIFT, .page = page, .pte = pte, .gen = c->tlb_gen };
+  return page | MEM_RET_OK;
+}
+
+paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
+  MMUCache *c = mc;
+  TLBEntry *e = &c->tlb[(vaddr >> PAGE_SHIFT) % TLB_SIZE];
+  // a write through a clean PTE walks again to set D
+  if (likely(e->gen == c->tlb_gen && e->vpn == vaddr >> PAGE_SHIFT && allowed(e->pte, type) &&
+      (type != MEM_TYPE_WRITE || (e->pte & PTE_D)))) {
+    return e->page | MEM_RET_OK;
+  }
+  return walk(vaddr, type);
+}
@@ -0,0 +1,44 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The time runs in virtual time. A tick is CONFIG_TIMER_RATIO guest
+ * instructions, and the timer of the CLINT only sets a deadline on the
+ * instruction count. MTIP and MSIP of the running hart are updated from
+ * the CLINT here, also when another hart is switched in.
+ */
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include "../local-include/csr.h"
+
+#ifdef CONFIG_HAS_CLINT
+uint64_t clint_mtimecmp(int hart);
+bool clint_msip(int hart);
+#endif
+
+uint64_t timer_time() {
+  return cpu_inst_count() / CONFIG_TIMER_RATIO;
+}
+
+void isa_timer_update() {
+#ifdef CONFIG_HAS_CLINT
+  int hart = cpu_hart_id();
+  uint64_t cmp = clint_mtimecmp(hart);
+  bool expired = timer_time() >= cmp;
+  csr(mip) = (csr(mip) & ~(MIP_MTIP | MIP_MSIP)) | (expired ? MIP_MTIP : 0) | (clint_msip(hart) ? MIP_MSIP : 0);
+  intr_update();
+  cpu_set_deadline(expired || cmp > UINT64_MAX / CONFIG_TIMER_RATIO ? UINT64_MAX : cmp * CONFIG_TIMER_RATIO);
+#endif
+}
@@ -20,6 +20,10 @@
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
+#elif defined(CONFIG_PMEM_MMAP)
+#include <sys/mman.h>
+#include <unistd.h>
+static uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
@@ -32,8 +36,25 @@ static word_t pmem_read(paddr_t addr, int len) {
   return ret;
 }
 
+#ifdef CONFIG_ENGINE_JIT
+#include <jit.h>
+#define JIT_LINE(addr) jit_code_line[((addr) - CONFIG_MBASE) >> JIT_LINE_SHIFT]
+#endif
+
 static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
+  // the translated code of the written bytes is no longer valid
+  IFDEF(CONFIG_ENGINE_JIT, if (unlikely(JIT_LINE(addr) | JIT_LINE(addr + len - 1))) jit_invalidate(addr, len));
+}
+
+static bool pmem_cas(paddr_t addr, int len, word_t old, word_t data) {
+  if (!host_cas(guest_to_host(addr), len, old, data)) return false;
+  IFDEF(CONFIG_ENGINE_JIT, if (unlikely(JIT_LINE(addr) | JIT_LINE(addr + len - 1))) jit_invalidate(addr, len));
+  return true;
+}
+
+void pmem_host_written(paddr_t addr, size_t len) {
+  IFDEF(CONFIG_ENGINE_JIT, if (len > 0) jit_invalidate(addr, len));
 }
 
 static void out_of_bound(paddr_t addr) {
@@ -45,6 +66,10 @@ void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP)
+  pmem = mmap(NULL, CONFIG_MSIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  assert(pmem != MAP_FAILED);
 #endif
 #ifdef CONFIG_MEM_RANDOM
   uint32_t *p = (uint32_t *)pmem;
@@ -56,6 +81,20 @@ void init_mem() {
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
+bool pmem_map_file(paddr_t addr, size_t len, int fd, size_t offset) {
+#ifdef CONFIG_PMEM_MMAP
+  size_t pgsize = sysconf(_SC_PAGESIZE);
+  uint8_t *haddr = guest_to_host(addr);
+  if (((uintptr_t)haddr | len | offset) & (pgsize - 1)) return false;
+  if (!in_pmem(addr) || !in_pmem(addr + len - 1)) return false;
+  // guest writes go to private copies of the pages, never to the file
+  void *p = mmap(haddr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset);
+  return p != MAP_FAILED;
+#else
+  return false;
+#endif
+}
+
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
@@ -68,3 +107,15 @@ void paddr_write(paddr_t addr, int len, word_t data) {
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
+
+/* Write `data' to the aligned `len' bytes at `addr' if they hold `old',
+ * atomically with the accesses of the other harts, and return whether they
+ * are written. A device is not compared, since reading it again may have
+ * side effects, and the write is done under the lock of the devices.
+ */
+bool paddr_cas(paddr_t addr, int len, word_t old, word_t data) {
+  if (likely(in_pmem(addr))) return pmem_cas(addr, len, old, data);
+  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return true);
+  out_of_bound(addr);
+  return false;
+}
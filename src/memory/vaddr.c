@@ -15,15 +15,83 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+/* isa_mmu_translate() returns the physical page of a virtual address with
+ * MEM_RET_OK in the page offset, or MEM_RET_FAIL after the ISA raises the
+ * fault, and then the access is dropped and a read returns 0. An access
+ * crossing a page is done byte by byte, once both pages are translated.
+ */
+static bool translate(vaddr_t addr, int len, int type, paddr_t *paddr) {
+  paddr_t pg = isa_mmu_translate(addr, len, type);
+  if ((pg & PAGE_MASK) != MEM_RET_OK) return false;
+  *paddr = (pg & ~(paddr_t)PAGE_MASK) | (addr & PAGE_MASK);
+  return true;
+}
+
+// the bytes before the next page, or `len' if the access does not cross it
+static inline int first_part(vaddr_t addr, int len) {
+  int left = PAGE_SIZE - (addr & PAGE_MASK);
+  return (len < left ? len : left);
+}
+
+static word_t translated_read(vaddr_t addr, int len, int type) {
+  paddr_t pa, pb;
+  int la = first_part(addr, len);
+  if (likely(la == len)) return translate(addr, len, type, &pa) ? paddr_read(pa, len) : 0;
+  if (!translate(addr, la, type, &pa) || !translate(addr + la, len - la, type, &pb)) return 0;
+  word_t data = 0;
+  for (int i = 0; i < len; i ++) {
+    data |= (word_t)paddr_read(i < la ? pa + i : pb + (i - la), 1) << (i * 8);
+  }
+  return data;
+}
+
+static void translated_write(vaddr_t addr, int len, word_t data) {
+  paddr_t pa, pb;
+  int la = first_part(addr, len);
+  if (likely(la == len)) {
+    if (translate(addr, len, MEM_TYPE_WRITE, &pa)) paddr_write(pa, len, data);
+    return;
+  }
+  if (!translate(addr, la, MEM_TYPE_WRITE, &pa) || !translate(addr + la, len - la, MEM_TYPE_WRITE, &pb)) return;
+  for (int i = 0; i < len; i ++) {
+    paddr_write(i < la ? pa + i : pb + (i - la), 1, data >> (i * 8));
+  }
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  switch (isa_mmu_check(addr, len, MEM_TYPE_IFETCH)) {
+    case MMU_DIRECT: return paddr_read(addr, len);
+    case MMU_TRANSLATE: return translated_read(addr, len, MEM_TYPE_IFETCH);
+    default: return 0;
+  }
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  switch (isa_mmu_check(addr, len, MEM_TYPE_READ)) {
+    case MMU_DIRECT: return paddr_read(addr, len);
+    case MMU_TRANSLATE: return translated_read(addr, len, MEM_TYPE_READ);
+    default: return 0;
+  }
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  switch (isa_mmu_check(addr, len, MEM_TYPE_WRITE)) {
+    case MMU_DIRECT: paddr_write(addr, len, data); break;
+    case MMU_TRANSLATE: translated_write(addr, len, data); break;
+    default: break;
+  }
+}
+
+/* An aligned access does not cross a page. Like a write, it raises the
+ * fault of a store if it can not be written.
+ */
+bool vaddr_cas(vaddr_t addr, int len, word_t old, word_t data) {
+  paddr_t pa;
+  switch (isa_mmu_check(addr, len, MEM_TYPE_WRITE)) {
+    case MMU_DIRECT: return paddr_cas(addr, len, old, data);
+    case MMU_TRANSLATE: return translate(addr, len, MEM_TYPE_WRITE, &pa) && paddr_cas(pa, len, old, data);
+    default: return false;
+  }
 }
@@ -0,0 +1,183 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Host-side micro-benchmarks of the hot paths of NEMU. This file replaces
+ * nemu-main.c and is linked with the other objects of the emulator, see
+ * `make microbench'.
+ */
+
+#include <isa.h>
+#include <cpu/decode.h>
+#include <memory/paddr.h>
+#include <device/map.h>
+#include <device/mmio.h>
+#include <time.h>
+
+void init_rand();
+void init_log(const char *log_file);
+void init_mem();
+void init_device();
+
+// Instructions implemented by every decoder, taken from the built-in images.
+// The first one only writes a register, the second one loads from the image.
+#define INST_ALU  MUXDEF(CONFIG_ISA_loongarch32r, 0x1c00000c /* pcaddu12i $t0,0 */, \
+                  MUXDEF(CONFIG_ISA_riscv64,      0x00000297 /* auipc t0,0 */, \
+                  MUXDEF(CONFIG_ISA_riscv32,      0x800002b7 /* lui t0,0x80000 */, \
+                                                  0x3c048000 /* lui a0,0x8000 */)))
+#define INST_LOAD MUXDEF(CONFIG_ISA_loongarch32r, 0x28804184 /* ld.w $a0,$t0,16 */, \
+                  MUXDEF(CONFIG_ISA_riscv64,      0x0102b503 /* ld a0,16(t0) */, \
+                  MUXDEF(CONFIG_ISA_riscv32,      0x0002a503 /* lw a0,0(t0) */, \
+                                                  0x8c820000 /* lw v0,0(a0) */)))
+
+#define STREAM_LEN 4096   // instructions
+#define MEM_AREA   0x10000
+#define MMIO_ADDR  0xa8000000
+#define NR_ROUND   11
+#define MIN_ROUND_NS 20000000
+
+static volatile word_t sink = 0;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void make_stream(bool with_load) {
+  uint32_t *p = (uint32_t *)guest_to_host(RESET_VECTOR);
+  for (int i = 0; i < STREAM_LEN; i ++) {
+    p[i] = (with_load && (i & 1) ? INST_LOAD : INST_ALU);
+  }
+  pmem_host_written(RESET_VECTOR, STREAM_LEN * sizeof(p[0]));
+}
+
+static void exec_stream(uint64_t n) {
+  Decode s;
+  vaddr_t pc = RESET_VECTOR;
+  for (uint64_t i = 0; i < n; i ++) {
+    s.pc = s.snpc = pc;
+    isa_exec_once(&s);
+    pc = (s.snpc == RESET_VECTOR + STREAM_LEN * 4 ? RESET_VECTOR : s.snpc);
+  }
+}
+
+static void prepare_alu()   { make_stream(false); }
+static void prepare_mixed() { make_stream(true); }
+
+#define PADDR_BENCH(len) \
+  static void concat(bench_read, len)(uint64_t n) { \
+    word_t sum = 0; \
+    for (uint64_t i = 0; i < n; i ++) { \
+      sum += paddr_read(RESET_VECTOR + ((i * 64) & (MEM_AREA - 1)), len); \
+    } \
+    sink = sum; \
+  } \
+  static void concat(bench_write, len)(uint64_t n) { \
+    for (uint64_t i = 0; i < n; i ++) { \
+      paddr_write(RESET_VECTOR + ((i * 64) & (MEM_AREA - 1)), len, i); \
+    } \
+  }
+
+PADDR_BENCH(1)
+PADDR_BENCH(2)
+PADDR_BENCH(4)
+IFDEF(CONFIG_ISA64, PADDR_BENCH(8))
+
+#ifdef CONFIG_DEVICE
+static void bench_mmio_read(uint64_t n) {
+  word_t sum = 0;
+  for (uint64_t i = 0; i < n; i ++) {
+    sum += mmio_read(MMIO_ADDR + (i & 4), 4);
+  }
+  sink = sum;
+}
+#endif
+
+static void bench_get_time(uint64_t n) {
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i < n; i ++) {
+    sum += get_time();
+  }
+  sink = sum;
+}
+
+static struct {
+  const char *name;
+  void (*prepare)();
+  void (*run)(uint64_t n);
+} table [] = {
+  { "isa_exec_once (alu stream)"  , prepare_alu  , exec_stream },
+  { "isa_exec_once (mixed stream)", prepare_mixed, exec_stream },
+  { "paddr_read (len = 1)"        , NULL, bench_read1 },
+  { "paddr_read (len = 2)"        , NULL, bench_read2 },
+  { "paddr_read (len = 4)"        , NULL, bench_read4 },
+  IFDEF(CONFIG_ISA64, { "paddr_read (len = 8)", NULL, bench_read8 },)
+  { "paddr_write (len = 1)"       , NULL, bench_write1 },
+  { "paddr_write (len = 2)"       , NULL, bench_write2 },
+  { "paddr_write (len = 4)"       , NULL, bench_write4 },
+  IFDEF(CONFIG_ISA64, { "paddr_write (len = 8)", NULL, bench_write8 },)
+  IFDEF(CONFIG_DEVICE, { "mmio_read (last map)", NULL, bench_mmio_read },)
+  { "get_time"                    , NULL, bench_get_time },
+};
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void run_bench(int i) {
+  if (table[i].prepare) table[i].prepare();
+
+  // warm up, and find the number of operations to make a round long enough
+  uint64_t n = 1000;
+  for (;;) {
+    uint64_t t0 = now_ns();
+    table[i].run(n);
+    if (now_ns() - t0 >= MIN_ROUND_NS) break;
+    n *= 2;
+  }
+
+  double ns[NR_ROUND], sum = 0, sum2 = 0;
+  for (int r = 0; r < NR_ROUND; r ++) {
+    uint64_t t0 = now_ns();
+    table[i].run(n);
+    ns[r] = (double)(now_ns() - t0) / n;
+    sum += ns[r];
+    sum2 += ns[r] * ns[r];
+  }
+  qsort(ns, NR_ROUND, sizeof(ns[0]), cmp_double);
+  double mean = sum / NR_ROUND;
+  double var = sum2 / NR_ROUND - mean * mean;
+  printf("%-30s %10.2f %10.2f %10.2f %10.3f %12" PRIu64 "\n", table[i].name,
+      ns[0], ns[NR_ROUND / 2], mean, (var > 0 ? __builtin_sqrt(var) : 0), n);
+}
+
+int main(int argc, char *argv[]) {
+  init_rand();
+  init_log("/dev/null");
+  init_mem();
+  init_isa();
+  IFDEF(CONFIG_DEVICE, init_device());
+  IFDEF(CONFIG_DEVICE, add_mmio_map("microbench", MMIO_ADDR, new_space(8), 8, NULL));
+
+  printf("%-30s %10s %10s %10s %10s %12s\n", "ns/op", "min", "median", "mean", "stddev", "ops/round");
+  for (int i = 0; i < ARRLEN(table); i ++) {
+    // run only the benchmarks whose names contain one of the arguments
+    bool selected = (argc <= 1);
+    for (int j = 1; j < argc; j ++) selected |= (strstr(table[i].name, argv[j]) != NULL);
+    if (selected) run_bench(i);
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Run every image of a batch list in a pool of forked workers. The parent
+ * initializes memory, the ISA and the disassembler once and maps all images
+ * before forking, so the workers share them copy-on-write. Each job only
+ * initializes the devices, loads its image and runs in batch mode.
+ */
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+void init_log(const char *log_file);
+void init_device();
+void init_cpu();
+void sdb_set_batch_mode();
+void engine_start();
+int is_exit_status_bad();
+uint8_t* map_image(const char *file, bool populate, int *fd, size_t *size);
+long load_image(const char *file, int fd, const uint8_t *buf, size_t size);
+
+typedef struct {
+  char *file;
+  int fd;
+  uint8_t *buf;
+  size_t size;
+} Image;
+
+typedef struct {
+  int bad;
+  int state;
+  uint32_t halt_ret;
+  uint64_t nr_inst;
+} Result;
+
+typedef struct {
+  int img; // index into `imgs', which may be moved by realloc()
+  pid_t pid;
+  int pipe_fd;
+  uint64_t start, time; // unit: us
+  int wstatus;
+  bool has_result;
+  Result res;
+} Job;
+
+static Image *imgs = NULL;
+static int nr_img = 0;
+static Job *jobs = NULL;
+static int nr_job = 0;
+
+static int find_image(const char *file) {
+  for (int i = 0; i < nr_img; i ++) {
+    if (strcmp(imgs[i].file, file) == 0) return i;
+  }
+  imgs = realloc(imgs, sizeof(Image) * (nr_img + 1));
+  assert(imgs);
+  Image *img = &imgs[nr_img ++];
+  img->file = strdup(file);
+  img->buf = map_image(file, true, &img->fd, &img->size);
+  return nr_img - 1;
+}
+
+static void read_list(const char *list_file) {
+  FILE *fp = fopen(list_file, "r");
+  Assert(fp, "Can not open '%s'", list_file);
+  char line[1024];
+  int cap = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    char *file = strtok(line, " \t\r\n");
+    if (file == NULL || file[0] == '#') continue;
+    if (nr_job == cap) {
+      cap = (cap == 0 ? 64 : cap * 2);
+      jobs = realloc(jobs, sizeof(Job) * cap);
+      assert(jobs);
+    }
+    jobs[nr_job ++] = (Job) { .img = find_image(file) };
+  }
+  fclose(fp);
+}
+
+static void job_log_file(char *buf, size_t size, const char *list_file, int idx) {
+  snprintf(buf, size, "%s.logs/%d.log", list_file, idx);
+}
+
+static void worker(const char *list_file, int idx, int pipe_fd) {
+  char log_file[1024];
+  job_log_file(log_file, sizeof(log_file), list_file, idx);
+  int fd = open(log_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  Assert(fd >= 0, "Can not open '%s'", log_file);
+  dup2(fd, STDOUT_FILENO);
+  dup2(fd, STDERR_FILENO);
+  close(fd);
+  init_log(NULL);
+
+  IFDEF(CONFIG_DEVICE, init_device());
+  Image *img = &imgs[jobs[idx].img];
+  load_image(img->file, img->fd, img->buf, img->size);
+  init_cpu();
+  sdb_set_batch_mode();
+  engine_start();
+
+  Result res = {
+    .bad = is_exit_status_bad(), .state = nemu_state.state,
+    .halt_ret = nemu_state.halt_ret, .nr_inst = cpu_total_inst(),
+  };
+  ssize_t ret = write(pipe_fd, &res, sizeof(res));
+  Assert(ret == sizeof(res), "Can not send the result of job %d", idx);
+  exit(res.bad);
+}
+
+static void spawn(const char *list_file, int idx) {
+  int fds[2];
+  int ret = pipe(fds);
+  Assert(ret == 0, "pipe() fails");
+  fflush(NULL);
+  Job *job = &jobs[idx];
+  job->start = get_time();
+  job->pid = fork();
+  Assert(job->pid >= 0, "fork() fails");
+  if (job->pid == 0) {
+    close(fds[0]);
+    worker(list_file, idx, fds[1]);
+  }
+  close(fds[1]);
+  job->pipe_fd = fds[0];
+}
+
+static void reap(Job *job, int wstatus) {
+  job->time = get_time() - job->start;
+  job->pid = 0; // the pid may be reused by a later job
+  job->wstatus = wstatus;
+  job->has_result = (read(job->pipe_fd, &job->res, sizeof(job->res)) == sizeof(job->res));
+  close(job->pipe_fd);
+}
+
+static bool job_is_bad(Job *job) {
+  return !job->has_result || job->res.bad;
+}
+
+static const char* job_status(Job *job) {
+  if (!job->has_result) return WIFSIGNALED(job->wstatus) ? "signaled" : "crashed";
+  switch (job->res.state) {
+    case NEMU_END: return job->res.halt_ret == 0 ? "good trap" : "bad trap";
+    case NEMU_ABORT: return "abort";
+    case NEMU_QUIT: return "quit";
+    default: return "stopped";
+  }
+}
+
+static void json_str(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; *s; s ++) {
+    if (*s == '"' || *s == '\\') fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20) fprintf(fp, "\\u%04x", *s);
+    else fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void report(const char *list_file, int nr_worker, uint64_t wall_time) {
+  char report_file[1024], log_file[1024];
+  snprintf(report_file, sizeof(report_file), "%s.json", list_file);
+  FILE *fp = fopen(report_file, "w");
+  Assert(fp, "Can not open '%s'", report_file);
+
+  int nr_bad = 0;
+  fprintf(fp, "{\n  \"jobs\": [\n");
+  for (int i = 0; i < nr_job; i ++) {
+    Job *job = &jobs[i];
+    nr_bad += job_is_bad(job);
+    job_log_file(log_file, sizeof(log_file), list_file, i);
+    fprintf(fp, "    { \"image\": ");
+    json_str(fp, imgs[job->img].file);
+    fprintf(fp, ", \"status\": \"%s\", \"bad\": %d", job_status(job), job_is_bad(job));
+    if (job->has_result) {
+      fprintf(fp, ", \"halt_ret\": %" PRIu32 ", \"instructions\": %" PRIu64,
+          job->res.halt_ret, job->res.nr_inst);
+    }
+    if (WIFSIGNALED(job->wstatus)) fprintf(fp, ", \"signal\": %d", WTERMSIG(job->wstatus));
+    fprintf(fp, ", \"time_us\": %" PRIu64 ", \"log\": ", job->time);
+    json_str(fp, log_file);
+    fprintf(fp, " }%s\n", i == nr_job - 1 ? "" : ",");
+  }
+  fprintf(fp, "  ],\n  \"workers\": %d,\n  \"failed\": %d,\n  \"wall_time_us\": %" PRIu64 "\n}\n",
+      nr_worker, nr_bad, wall_time);
+  fclose(fp);
+
+  Log("%d/%d jobs passed in %" PRIu64 " us, see %s", nr_job - nr_bad, nr_job, wall_time, report_file);
+  exit(nr_bad != 0);
+}
+
+void batch_run(const char *list_file, int nr_worker) {
+  IFDEF(CONFIG_DIFFTEST, panic("DiffTest is not supported with a batch list"));
+
+  read_list(list_file);
+  if (nr_worker <= 0) nr_worker = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nr_worker > nr_job) nr_worker = nr_job;
+
+  char log_dir[1024];
+  snprintf(log_dir, sizeof(log_dir), "%s.logs", list_file);
+  int ret = mkdir(log_dir, 0755);
+  Assert(ret == 0 || errno == EEXIST, "Can not create '%s'", log_dir);
+  Log("Run %d jobs (%d images) with %d workers, logs are in %s", nr_job, nr_img, nr_worker, log_dir);
+
+  uint64_t start = get_time();
+  int next = 0, nr_running = 0;
+  while (next < nr_job || nr_running > 0) {
+    for (; nr_running < nr_worker && next < nr_job; nr_running ++) spawn(list_file, next ++);
+
+    int wstatus;
+    pid_t pid = wait(&wstatus);
+    assert(pid > 0);
+    for (int i = 0; i < next; i ++) {
+      if (jobs[i].pid == pid) { reap(&jobs[i], wstatus); nr_running --; break; }
+    }
+  }
+
+  report(list_file, nr_worker, get_time() - start);
+}
@@ -0,0 +1,200 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <elf.h>
+#include <unistd.h>
+
+#ifndef EM_LOONGARCH
+#define EM_LOONGARCH 258
+#endif
+
+#define ELF_MACHINE \
+  MUXDEF(CONFIG_ISA_x86,     EM_386, \
+  MUXDEF(CONFIG_ISA_mips32,  EM_MIPS, \
+  MUXDEF(CONFIG_ISA_riscv32, EM_RISCV, \
+  MUXDEF(CONFIG_ISA_riscv64, EM_RISCV, EM_LOONGARCH))))
+
+// segments smaller than this are simply copied
+#define MAP_THRESHOLD (64 * 1024)
+
+typedef struct {
+  vaddr_t addr;
+  vaddr_t size;
+  const char *name;
+} Symbol;
+
+static Symbol *symtab = NULL;
+static int nr_sym = 0;
+static char *strtab = NULL;
+
+// read a field of the header, program header or symbol regardless of the class
+#define ELF_GET(is64, type, p, field) \
+  ((is64) ? (uint64_t)((const concat(Elf64_, type) *)(p))->field : \
+            (uint64_t)((const concat(Elf32_, type) *)(p))->field)
+
+static int sym_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->addr, y = ((const Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static void load_symtab(const uint8_t *base, size_t file_size, bool is64) {
+  uint64_t shoff = ELF_GET(is64, Ehdr, base, e_shoff);
+  int shnum = ELF_GET(is64, Ehdr, base, e_shnum);
+  int shentsize = ELF_GET(is64, Ehdr, base, e_shentsize);
+  if (shoff == 0 || shoff + (uint64_t)shnum * shentsize > file_size) return;
+
+  for (int i = 0; i < shnum; i ++) {
+    const uint8_t *sh = base + shoff + i * shentsize;
+    if (ELF_GET(is64, Shdr, sh, sh_type) != SHT_SYMTAB) continue;
+
+    int link = ELF_GET(is64, Shdr, sh, sh_link);
+    if (link >= shnum) return;
+    const uint8_t *strsh = base + shoff + link * shentsize;
+    uint64_t str_off = ELF_GET(is64, Shdr, strsh, sh_offset);
+    uint64_t str_size = ELF_GET(is64, Shdr, strsh, sh_size);
+    uint64_t sym_off = ELF_GET(is64, Shdr, sh, sh_offset);
+    uint64_t sym_size = ELF_GET(is64, Shdr, sh, sh_size);
+    uint64_t sym_ent = ELF_GET(is64, Shdr, sh, sh_entsize);
+    if (str_off + str_size > file_size || sym_off + sym_size > file_size || sym_ent == 0) return;
+
+    // the names are kept after the image is unmapped
+    strtab = malloc(str_size + 1);
+    assert(strtab);
+    memcpy(strtab, base + str_off, str_size);
+    strtab[str_size] = '\0';
+
+    int n = sym_size / sym_ent;
+    symtab = malloc(sizeof(Symbol) * n);
+    assert(symtab);
+    for (int j = 0; j < n; j ++) {
+      const uint8_t *sym = base + sym_off + j * sym_ent;
+      uint64_t name = ELF_GET(is64, Sym, sym, st_name);
+      int info = ELF_GET(is64, Sym, sym, st_info);
+      int type = is64 ? ELF64_ST_TYPE(info) : ELF32_ST_TYPE(info);
+      if ((type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE) ||
+          name == 0 || name >= str_size || strtab[name] == '\0' ||
+          ELF_GET(is64, Sym, sym, st_shndx) == SHN_UNDEF) continue;
+      symtab[nr_sym ++] = (Symbol) {
+        .addr = ELF_GET(is64, Sym, sym, st_value),
+        .size = ELF_GET(is64, Sym, sym, st_size),
+        .name = strtab + name,
+      };
+    }
+    qsort(symtab, nr_sym, sizeof(Symbol), sym_cmp);
+    Log("Read %d symbols from the symbol table", nr_sym);
+    return;
+  }
+}
+
+static void load_segment(int fd, const uint8_t *base, paddr_t paddr,
+    uint64_t offset, uint64_t filesz, uint64_t memsz) {
+  uint8_t *haddr = guest_to_host(paddr);
+  uint64_t done = 0;
+
+  if (filesz >= MAP_THRESHOLD) {
+    // map the page aligned middle part, and copy the unaligned head and tail
+    uint64_t pgsize = sysconf(_SC_PAGESIZE);
+    uint64_t head = (pgsize - (offset & (pgsize - 1))) & (pgsize - 1);
+    uint64_t len = (filesz - head) & ~(pgsize - 1);
+    if (pmem_map_file(paddr + head, len, fd, offset + head)) {
+      memcpy(haddr, base + offset, head);
+      done = head + len;
+    }
+  }
+  memcpy(haddr + done, base + offset + done, filesz - done);
+  memset(haddr + filesz, 0, memsz - filesz);
+  pmem_host_written(paddr, memsz);
+}
+
+bool is_elf(const uint8_t *buf, size_t size) {
+  return size >= SELFMAG && memcmp(buf, ELFMAG, SELFMAG) == 0;
+}
+
+long load_elf(const char *file, int fd, const uint8_t *base, size_t file_size) {
+  Assert(file_size >= sizeof(Elf32_Ehdr), "'%s' is too small to be an ELF file", file);
+
+  const unsigned char *ident = base;
+  bool is64 = (ident[EI_CLASS] == ELFCLASS64);
+  Assert(ident[EI_CLASS] == ELFCLASS32 || is64, "Unknown ELF class %d", ident[EI_CLASS]);
+  Assert(ident[EI_DATA] == ELFDATA2LSB, "Only little-endian ELF files are supported");
+  Assert(file_size >= (is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr)), "Truncated ELF header");
+  int machine = ELF_GET(is64, Ehdr, base, e_machine);
+  Assert(machine == ELF_MACHINE, "ELF machine %d does not match the guest ISA %s",
+      machine, str(__GUEST_ISA__));
+
+  uint64_t phoff = ELF_GET(is64, Ehdr, base, e_phoff);
+  int phnum = ELF_GET(is64, Ehdr, base, e_phnum);
+  int phentsize = ELF_GET(is64, Ehdr, base, e_phentsize);
+  Assert(phoff + (uint64_t)phnum * phentsize <= file_size, "Truncated program headers");
+
+  paddr_t img_end = RESET_VECTOR;
+  for (int i = 0; i < phnum; i ++) {
+    const uint8_t *ph = base + phoff + i * phentsize;
+    if (ELF_GET(is64, Phdr, ph, p_type) != PT_LOAD) continue;
+    uint64_t paddr = ELF_GET(is64, Phdr, ph, p_paddr);
+    uint64_t offset = ELF_GET(is64, Phdr, ph, p_offset);
+    uint64_t filesz = ELF_GET(is64, Phdr, ph, p_filesz);
+    uint64_t memsz = ELF_GET(is64, Phdr, ph, p_memsz);
+    if (memsz == 0) continue;
+
+    Assert(filesz <= memsz && offset + filesz <= file_size, "Malformed segment %d", i);
+    Assert(paddr == (paddr_t)paddr && in_pmem(paddr) && in_pmem(paddr + memsz - 1),
+        "Segment [" FMT_PADDR ", " FMT_PADDR ") is out of bound of pmem",
+        (paddr_t)paddr, (paddr_t)(paddr + memsz));
+    if (paddr < RESET_VECTOR) {
+      Log("Segment at " FMT_PADDR " is below the reset vector and is not "
+          "copied to the reference by DiffTest", (paddr_t)paddr);
+    }
+    load_segment(fd, base, paddr, offset, filesz, memsz);
+    if (paddr + memsz > img_end) img_end = paddr + memsz;
+  }
+
+  load_symtab(base, file_size, is64);
+
+  cpu.pc = ELF_GET(is64, Ehdr, base, e_entry);
+  Log("The image is %s (ELF%d), entry = " FMT_WORD, file, is64 ? 64 : 32, cpu.pc);
+
+  return img_end - RESET_VECTOR;
+}
+
+const char* elf_sym_name(vaddr_t addr, vaddr_t *offset) {
+  // find the last symbol whose address is not above `addr`
+  int l = 0, r = nr_sym;
+  while (l < r) {
+    int m = (l + r) / 2;
+    if (symtab[m].addr <= addr) l = m + 1;
+    else r = m;
+  }
+  for (int i = l - 1; i >= 0 && i >= l - 4; i --) {
+    Symbol *s = &symtab[i];
+    if (addr < s->addr + s->size || (s->size == 0 && i == l - 1)) {
+      if (offset) *offset = addr - s->addr;
+      return s->name;
+    }
+  }
+  return NULL;
+}
+
+bool elf_sym_addr(const char *name, vaddr_t *addr) {
+  for (int i = 0; i < nr_sym; i ++) {
+    if (strcmp(symtab[i].name, name) == 0) {
+      *addr = symtab[i].addr;
+      return true;
+    }
+  }
+  return false;
+}
@@ -23,6 +23,7 @@ void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm(const char *triple);
+void init_cpu();
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
@@ -32,58 +33,136 @@ static void welcome() {
   Log("Build time: %s, %s", __TIME__, __DATE__);
   printf("Welcome to %s-NEMU!\n", ANSI_FMT(str(__GUEST_ISA__), ANSI_FG_YELLOW ANSI_BG_RED));
   printf("For help, type \"help\"\n");
-  Log("Exercise: Please remove me in the source code and compile NEMU again.");
-  assert(0);
 }
 
 #ifndef CONFIG_TARGET_AM
 #include <getopt.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 void sdb_set_batch_mode();
+bool is_elf(const uint8_t *buf, size_t size);
+long load_elf(const char *file, int fd, const uint8_t *base, size_t size);
+void batch_run(const char *list_file, int nr_worker);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *batch_list = NULL;
+static char *kernel = NULL;
+static int nr_worker = 0;
 static int difftest_port = 1234;
 
-static long load_img() {
-  if (img_file == NULL) {
-    Log("No image is given. Use the default build-in image.");
-    return 4096; // built-in image size
-  }
+// the trace options are applied after the image is loaded to find its symbols
+static struct {
+  const char *kind;
+  char *args;
+} trace_opt[32];
+static int nr_trace_opt = 0;
 
-  FILE *fp = fopen(img_file, "rb");
-  Assert(fp, "Can not open '%s'", img_file);
+static void add_trace_opt(const char *kind, char *args) {
+  Assert(nr_trace_opt < ARRLEN(trace_opt), "Too many trace options");
+  trace_opt[nr_trace_opt].kind = kind;
+  trace_opt[nr_trace_opt].args = args;
+  nr_trace_opt ++;
+}
 
-  fseek(fp, 0, SEEK_END);
-  long size = ftell(fp);
+static void apply_trace_opt() {
+  for (int i = 0; i < nr_trace_opt; i ++) {
+    if (!trace_set(trace_opt[i].kind, trace_opt[i].args)) exit(1);
+  }
+}
 
-  Log("The image is %s, size = %ld", img_file, size);
+/* Map the whole image read-only. `populate' prefaults the pages, so
+ * processes forked later share them without touching the file again.
+ */
+uint8_t* map_image(const char *file, bool populate, int *fd, size_t *size) {
+  *fd = open(file, O_RDONLY);
+  Assert(*fd >= 0, "Can not open '%s'", file);
+  struct stat st;
+  int ret = fstat(*fd, &st);
+  Assert(ret == 0, "Can not stat '%s'", file);
+  *size = st.st_size;
+  Assert(*size > 0, "'%s' is empty", file);
+  uint8_t *buf = mmap(NULL, *size, PROT_READ,
+      MAP_PRIVATE | (populate ? MAP_POPULATE : 0), *fd, 0);
+  Assert(buf != MAP_FAILED, "Can not map '%s'", file);
+  return buf;
+}
 
-  fseek(fp, 0, SEEK_SET);
-  int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
-  assert(ret == 1);
+long load_image(const char *file, int fd, const uint8_t *buf, size_t size) {
+  if (is_elf(buf, size)) return load_elf(file, fd, buf, size);
 
-  fclose(fp);
+  Log("The image is %s, size = %zu", file, size);
+  memcpy(guest_to_host(RESET_VECTOR), buf, size);
+  pmem_host_written(RESET_VECTOR, size);
   return size;
 }
 
+static long load_kernel() {
+  for (int i = 0; i < isa_nr_bench_kernel; i ++) {
+    const BenchKernel *k = &isa_bench_kernel[i];
+    if (strcmp(k->name, kernel) == 0) {
+      Log("The image is the built-in kernel '%s', size = %zu", k->name, k->size);
+      memcpy(guest_to_host(RESET_VECTOR), k->img, k->size);
+      pmem_host_written(RESET_VECTOR, k->size);
+      return k->size;
+    }
+  }
+  printf("Unknown kernel '%s', available kernels are:", kernel);
+  for (int i = 0; i < isa_nr_bench_kernel; i ++) printf(" %s", isa_bench_kernel[i].name);
+  printf("\n");
+  exit(1);
+}
+
+static long load_img() {
+  if (kernel != NULL) return load_kernel();
+
+  if (img_file == NULL) {
+    Log("No image is given. Use the default build-in image.");
+    return 4096; // built-in image size
+  }
+
+  int fd;
+  size_t size;
+  uint8_t *buf = map_image(img_file, false, &fd, &size);
+  long ret = load_image(img_file, fd, buf, size);
+  munmap(buf, size);
+  close(fd);
+  return ret;
+}
+
 static int parse_args(int argc, char *argv[]) {
   const struct option table[] = {
     {"batch"    , no_argument      , NULL, 'b'},
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"batch-list", required_argument, NULL, 'L'},
+    {"jobs"     , required_argument, NULL, 'j'},
+    {"kernel"   , required_argument, NULL, 'k'},
+    {"trace"    , required_argument, NULL, 't'},
+    {"trace-pc" , required_argument, NULL, 'P'},
+    {"trace-inst", required_argument, NULL, 'I'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:L:j:k:t:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'L': batch_list = optarg; break;
+      case 'j': sscanf(optarg, "%d", &nr_worker); break;
+      case 'k': kernel = optarg; break;
+      case 't': add_trace_opt(strcmp(optarg, "off") == 0 ? "off" : "window", optarg); break;
+      case 'P': add_trace_opt("pc", optarg); break;
+      case 'I': add_trace_opt("inst", optarg); break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -91,6 +170,12 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-L,--batch-list=FILE    run every image listed in FILE and report to FILE.json\n");
+        printf("\t-j,--jobs=N             run N images of the batch list at a time\n");
+        printf("\t-k,--kernel=NAME        run the built-in benchmark kernel NAME\n");
+        printf("\t-t,--trace=START[:END]  trace instructions START to END, or nothing with 'off'\n");
+        printf("\t--trace-pc=LO:HI        only trace pc in [LO, HI), LO and HI can be symbols\n");
+        printf("\t--trace-inst=MASK:MATCH only trace instructions with (inst & MASK) == MATCH\n");
         printf("\n");
         exit(0);
     }
@@ -113,21 +198,9 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize memory. */
   init_mem();
 
-  /* Initialize devices. */
-  IFDEF(CONFIG_DEVICE, init_device());
-
   /* Perform ISA dependent initialization. */
   init_isa();
 
-  /* Load the image to memory. This will overwrite the built-in image. */
-  long img_size = load_img();
-
-  /* Initialize differential testing. */
-  init_difftest(diff_so_file, img_size, difftest_port);
-
-  /* Initialize the simple debugger. */
-  init_sdb();
-
 #ifndef CONFIG_ISA_loongarch32r
   IFDEF(CONFIG_ITRACE, init_disasm(
     MUXDEF(CONFIG_ISA_x86,     "i686",
@@ -137,6 +210,27 @@ void init_monitor(int argc, char *argv[]) {
   ));
 #endif
 
+  /* Everything above is shared by the jobs of a batch list. This does not return. */
+  if (batch_list != NULL) batch_run(batch_list, nr_worker);
+
+  /* Initialize devices. */
+  IFDEF(CONFIG_DEVICE, init_device());
+
+  /* Load the image to memory. This will overwrite the built-in image. */
+  long img_size = load_img();
+
+  /* Set up the trace window and filters given by the options. */
+  apply_trace_opt();
+
+  /* Set up the other harts from the initial state. */
+  init_cpu();
+
+  /* Initialize differential testing. */
+  init_difftest(diff_so_file, img_size, difftest_port);
+
+  /* Initialize the simple debugger. */
+  init_sdb();
+
   /* Display welcome message. */
   welcome();
 }
@@ -146,6 +240,7 @@ static long load_img() {
   size_t size = &bin_end - &bin_start;
   Log("img size = %ld", size);
   memcpy(guest_to_host(RESET_VECTOR), &bin_start, size);
+  pmem_host_written(RESET_VECTOR, size);
   return size;
 }
 
@@ -154,6 +249,7 @@ void am_init_monitor() {
   init_mem();
   init_isa();
   load_img();
+  init_cpu();
   IFDEF(CONFIG_DEVICE, init_device());
   welcome();
 }
@@ -52,6 +52,13 @@ static int cmd_q(char *args) {
   return -1;
 }
 
+static int cmd_trace(char *args) {
+  char *kind = strtok(NULL, " ");
+  if (kind == NULL) trace_display();
+  else trace_set(kind, strtok(NULL, ""));
+  return 0;
+}
+
 static int cmd_help(char *args);
 
 static struct {
@@ -62,6 +69,8 @@ static struct {
   { "help", "Display information about all supported commands", cmd_help },
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
+  { "trace", "Show the trace settings, or change them with 'window START [END]', "
+    "'pc LO HI', 'inst MASK MATCH', 'off' or 'clear'", cmd_trace },
 
   /* TODO: Add more commands */
 
@@ -0,0 +1,151 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The trace window and the trace filters. They are initialized from the
+ * configuration and can be changed from the command line and in SDB.
+ * The window is in the number of instructions executed. An instruction is
+ * traced when the number after it falls into the window, its pc falls into
+ * one of the pc ranges and it matches one of the instruction filters. An
+ * empty set of ranges or filters matches everything.
+ */
+
+#include <common.h>
+
+#define NR_FILTER 16
+
+bool g_log_enable = MUXDEF(CONFIG_TRACE, CONFIG_TRACE_START == 0, false);
+
+static uint64_t win_start = MUXDEF(CONFIG_TRACE, CONFIG_TRACE_START, 1);
+static uint64_t win_end = MUXDEF(CONFIG_TRACE, CONFIG_TRACE_END, 0);
+
+static struct {
+  vaddr_t lo, hi;
+} pc_range[NR_FILTER];
+static int nr_pc_range = 0;
+
+static struct {
+  uint32_t mask, match;
+} inst_filter[NR_FILTER];
+static int nr_inst_filter = 0;
+
+void trace_update(uint64_t nr_inst) {
+  g_log_enable = (nr_inst >= win_start && nr_inst <= win_end);
+}
+
+uint64_t trace_window(uint64_t nr_inst, uint64_t n, bool *on) {
+  uint64_t len = n;
+  *on = false;
+  if (nr_inst + 1 < win_start) len = win_start - 1 - nr_inst;
+  else if (nr_inst < win_end) { *on = true; len = win_end - nr_inst; }
+  // every instruction in this part is either in the window or not
+  g_log_enable = *on;
+  return (len < n ? len : n);
+}
+
+bool trace_inst_enable(vaddr_t pc, uint32_t inst) {
+  bool ok = (nr_pc_range == 0);
+  for (int i = 0; i < nr_pc_range && !ok; i ++) {
+    ok = (pc >= pc_range[i].lo && pc < pc_range[i].hi);
+  }
+  if (!ok) return false;
+  ok = (nr_inst_filter == 0);
+  for (int i = 0; i < nr_inst_filter && !ok; i ++) {
+    ok = ((inst & inst_filter[i].mask) == inst_filter[i].match);
+  }
+  return ok;
+}
+
+static bool parse_num(const char *s, uint64_t *num) {
+  char *end;
+  *num = strtoull(s, &end, 0);
+  return *s != '\0' && *end == '\0';
+}
+
+// a pc is either a number or the name of a symbol of the ELF image
+static bool parse_pc(const char *s, vaddr_t *pc) {
+  uint64_t num;
+  if (parse_num(s, &num)) { *pc = num; return true; }
+  return MUXNDEF(CONFIG_TARGET_AM, elf_sym_addr(s, pc), false);
+}
+
+void trace_display() {
+  if (win_start > win_end) printf("window: off\n");
+  else if (win_end == UINT64_MAX) printf("window: [%" PRIu64 ", -]\n", win_start);
+  else printf("window: [%" PRIu64 ", %" PRIu64 "]\n", win_start, win_end);
+  for (int i = 0; i < nr_pc_range; i ++) {
+    printf("pc: [" FMT_WORD ", " FMT_WORD ")\n", pc_range[i].lo, pc_range[i].hi);
+  }
+  for (int i = 0; i < nr_inst_filter; i ++) {
+    printf("inst: & 0x%08x == 0x%08x\n", inst_filter[i].mask, inst_filter[i].match);
+  }
+}
+
+/* `kind' is one of `window', `pc', `inst', `off' and `clear', and the
+ * operands in `args' are separated by spaces or colons:
+ *   window START [END]   trace instructions START to END (default: the end)
+ *   pc LO HI             only trace pc in [LO, HI), can be given many times
+ *   inst MASK MATCH      only trace inst with (inst & MASK) == MATCH, likewise
+ *   off                  trace nothing
+ *   clear                remove the filters and trace everything
+ */
+bool trace_set(const char *kind, char *args) {
+  if (!ISDEF(CONFIG_TRACE)) { printf("The tracer is not enabled in the configuration\n"); return false; }
+
+  char *a = (args ? strtok(args, " :") : NULL);
+  char *b = (a ? strtok(NULL, " :") : NULL);
+  if (strcmp(kind, "window") == 0) {
+    uint64_t start, end = UINT64_MAX;
+    if (a == NULL || !parse_num(a, &start) || (b != NULL && !parse_num(b, &end))) {
+      printf("Usage: window START [END]\n");
+      return false;
+    }
+    win_start = start;
+    win_end = end;
+  } else if (strcmp(kind, "pc") == 0) {
+    vaddr_t lo, hi;
+    if (a == NULL || b == NULL || !parse_pc(a, &lo) || !parse_pc(b, &hi)) {
+      printf("Usage: pc LO HI, where LO and HI are numbers or symbols\n");
+      return false;
+    }
+    if (nr_pc_range == NR_FILTER) { printf("Too many pc ranges\n"); return false; }
+    pc_range[nr_pc_range].lo = lo;
+    pc_range[nr_pc_range].hi = hi;
+    nr_pc_range ++;
+  } else if (strcmp(kind, "inst") == 0) {
+    uint64_t mask, match;
+    if (a == NULL || b == NULL || !parse_num(a, &mask) || !parse_num(b, &match)) {
+      printf("Usage: inst MASK MATCH\n");
+      return false;
+    }
+    if (nr_inst_filter == NR_FILTER) { printf("Too many instruction filters\n"); return false; }
+    inst_filter[nr_inst_filter].mask = mask;
+    inst_filter[nr_inst_filter].match = match & mask;
+    nr_inst_filter ++;
+  } else if (strcmp(kind, "off") == 0) {
+    win_start = 1;
+    win_end = 0;
+  } else if (strcmp(kind, "clear") == 0) {
+    win_start = 0;
+    win_end = UINT64_MAX;
+    nr_pc_range = nr_inst_filter = 0;
+  } else {
+    printf("Unknown trace setting '%s'\n", kind);
+    return false;
+  }
+
+  extern HART_LOCAL uint64_t g_nr_guest_inst;
+  trace_update(g_nr_guest_inst);
+  return true;
+}
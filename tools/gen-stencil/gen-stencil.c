@@ -0,0 +1,183 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Turn the stencils in an x86-64 relocatable object into C tables for the
+ * copy-and-patch JIT. Every function `stencil_N' must be in its own
+ * section (-ffunction-sections), and only refer to other code and data by
+ * absolute 64-bit relocations (-mcmodel=large -fno-pic). A relocation
+ * against `_JIT_*' is a hole patched at runtime, and one against another
+ * global symbol is resolved by linking the tables into NEMU. A stencil
+ * with anything else is emitted empty, and the JIT does not use it.
+ *
+ * usage: gen-stencil OBJ > stencils.c
+ */
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static const char *holes[] = { "_JIT_PC", "_JIT_INST" };
+#define NR_HOLE (sizeof(holes) / sizeof(holes[0]))
+
+static uint8_t *elf = NULL;
+static Elf64_Shdr *sh = NULL;
+static Elf64_Sym *sym = NULL;
+static const char *str = NULL;
+static int nr_sym = 0;
+
+typedef struct {
+  int n;          // the number in the name
+  Elf64_Sym *sym;
+} Stencil;
+
+static Stencil stencils[4096];
+static int nr_stencil = 0;
+static const char *externs[4096];
+static int nr_extern = 0;
+
+static uint8_t* load(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) { perror(path); exit(1); }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(size);
+  assert(buf);
+  int ret = fread(buf, size, 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+  return buf;
+}
+
+static int hole_idx(const char *name) {
+  for (int i = 0; i < NR_HOLE; i ++) if (strcmp(name, holes[i]) == 0) return i;
+  return -1;
+}
+
+// the relocation section of section `idx', or NULL
+static Elf64_Shdr* rela_of(int idx) {
+  Elf64_Ehdr *eh = (void *)elf;
+  for (int i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type == SHT_RELA && sh[i].sh_info == idx) return &sh[i];
+  }
+  return NULL;
+}
+
+// whether the stencil can be used, and declare the symbols it refers to
+static int check(Stencil *st) {
+  Elf64_Shdr *rs = rela_of(st->sym->st_shndx);
+  if (rs == NULL) return 1;
+  Elf64_Rela *r = (void *)(elf + rs->sh_offset);
+  int nr = rs->sh_size / sizeof(Elf64_Rela);
+  for (int i = 0; i < nr; i ++) {
+    if (ELF64_R_TYPE(r[i].r_info) != R_X86_64_64) return 0;
+    Elf64_Sym *s = &sym[ELF64_R_SYM(r[i].r_info)];
+    if (ELF64_ST_BIND(s->st_info) == STB_LOCAL) return 0;
+    if (r[i].r_offset + 8 > st->sym->st_size) return 0;
+  }
+  for (int i = 0; i < nr; i ++) {
+    const char *name = str + sym[ELF64_R_SYM(r[i].r_info)].st_name;
+    if (hole_idx(name) >= 0) continue;
+    int k;
+    for (k = 0; k < nr_extern && strcmp(externs[k], name) != 0; k ++) ;
+    if (k < nr_extern) continue;
+    assert(nr_extern < sizeof(externs) / sizeof(externs[0]));
+    externs[nr_extern ++] = name;
+    printf("extern char %s[];\n", name);
+  }
+  return 1;
+}
+
+static void emit(int k, Stencil *st, int ok) {
+  if (!ok) {
+    printf("// stencil %d refers to what can not be patched\n", k);
+    return;
+  }
+  Elf64_Shdr *text = &sh[st->sym->st_shndx];
+  uint8_t *code = elf + text->sh_offset + st->sym->st_value;
+  printf("static const uint8_t code_%d[] = {", k);
+  for (int i = 0; i < st->sym->st_size; i ++) printf("%s0x%02x,", (i % 16 == 0 ? "\n  " : " "), code[i]);
+  printf("\n};\n");
+
+  Elf64_Shdr *rs = rela_of(st->sym->st_shndx);
+  int nr = (rs ? rs->sh_size / sizeof(Elf64_Rela) : 0);
+  printf("static const StencilReloc reloc_%d[] = {\n", k);
+  for (int i = 0; i < nr; i ++) {
+    Elf64_Rela *r = (Elf64_Rela *)(elf + rs->sh_offset) + i;
+    const char *name = str + sym[ELF64_R_SYM(r->r_info)].st_name;
+    int hole = hole_idx(name);
+    if (hole >= 0) printf("  { %lu, %d, 0, %ld },\n", r->r_offset - st->sym->st_value, hole, r->r_addend);
+    else printf("  { %lu, -1, (uintptr_t)%s, %ld },\n", r->r_offset - st->sym->st_value, name, r->r_addend);
+  }
+  printf("  { 0, -1, 0, 0 }\n};\n");
+}
+
+static int cmp(const void *a, const void *b) {
+  return ((const Stencil *)a)->n - ((const Stencil *)b)->n;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) { fprintf(stderr, "usage: %s OBJ\n", argv[0]); return 1; }
+  elf = load(argv[1]);
+  Elf64_Ehdr *eh = (void *)elf;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+      eh->e_machine != EM_X86_64 || eh->e_type != ET_REL) {
+    fprintf(stderr, "%s: not an x86-64 relocatable object\n", argv[1]);
+    return 1;
+  }
+  sh = (void *)(elf + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type == SHT_SYMTAB) {
+      sym = (void *)(elf + sh[i].sh_offset);
+      nr_sym = sh[i].sh_size / sizeof(Elf64_Sym);
+      str = (void *)(elf + sh[sh[i].sh_link].sh_offset);
+    }
+  }
+  assert(sym != NULL);
+
+  for (int i = 0; i < nr_sym; i ++) {
+    int n;
+    if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC) continue;
+    if (sscanf(str + sym[i].st_name, "stencil_%d", &n) != 1) continue;
+    assert(nr_stencil < sizeof(stencils) / sizeof(stencils[0]));
+    stencils[nr_stencil ++] = (Stencil){ .n = n, .sym = &sym[i] };
+  }
+  // stencils are numbered in the order of the instruction list
+  qsort(stencils, nr_stencil, sizeof(Stencil), cmp);
+
+  printf("// generated by gen-stencil from %s, do not edit\n\n", argv[1]);
+  printf("#include <stencil.h>\n\n");
+  int ok[nr_stencil];
+  for (int k = 0; k < nr_stencil; k ++) ok[k] = check(&stencils[k]);
+  printf("\n");
+  for (int k = 0; k < nr_stencil; k ++) emit(k, &stencils[k], ok[k]);
+
+  int max = 0;
+  printf("\nconst Stencil jit_stencils[] = {\n");
+  for (int k = 0; k < nr_stencil; k ++) {
+    if (ok[k]) {
+      printf("  { code_%d, sizeof(code_%d), reloc_%d },\n", k, k, k);
+      if (stencils[k].sym->st_size > max) max = stencils[k].sym->st_size;
+    } else {
+      printf("  { NULL, 0, NULL },\n");
+    }
+  }
+  printf("};\n");
+  printf("const int jit_nr_stencil = %d;\n", nr_stencil);
+  printf("const int jit_stencil_max_size = %d;\n", max);
+  return 0;
+}